@@ -1,4 +1,6 @@
 #include <EspBleControls.h>
+#include <algorithm>
+#include <cctype>
 
 // --------------------------------------------------------------------------------------------------------------------
 
@@ -24,38 +26,37 @@ const std::string shortToHex(short number) {
     return intToString((uint16_t)number, 4, 16);
 }
 
-template <typename IntegerType>
-const IntegerType bytesToIntegerType(uint8_t* bytes, bool big_endian = false) {
-    IntegerType result = 0;
-    if (!big_endian)
-        for (int n = sizeof(result); n >= 0; n--)
-            result = (result << 8) + bytes[n];
-    else
-        for (unsigned n = 0; n < sizeof(result); n++)
-            result = (result << 8) + bytes[n];
-    return result;
+size_t formatDecimal(const int32_t value, const uint8_t fractionDigits, char* text) {
+    const uint8_t digits = std::min(fractionDigits, (uint8_t) MAX_FRACTION_DIGITS);
+    uint32_t magnitude = (value < 0) ? 0U - (uint32_t) value : (uint32_t) value;
+    char reversed[12];
+    size_t length = 0;
+    do {
+        reversed[length++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0 || length <= digits);
+    size_t position = 0;
+    if (value < 0) text[position++] = '-';
+    while (length > 0) {
+        text[position++] = reversed[--length];
+        if (length == digits && digits > 0) text[position++] = '.';
+    }
+    text[position] = '\0';
+    return position;
 }
 
-const float bytesToFloat(uint8_t* bytes, bool big_endian = false) {
-    float result = 0;
-    uint8_t* floatPointer = (uint8_t*)&result;
-    if (!big_endian) {
-        floatPointer[3] = bytes[3];
-        floatPointer[2] = bytes[2];
-        floatPointer[1] = bytes[1];
-        floatPointer[0] = bytes[0];
-    } else {
-        floatPointer[3] = bytes[0];
-        floatPointer[2] = bytes[1];
-        floatPointer[1] = bytes[2];
-        floatPointer[0] = bytes[3];
+const std::string selectionToBytes(uint32_t selection, size_t itemsCount) {
+    std::string result((itemsCount + 7) / 8, 0);
+    for (size_t index = 0; index < itemsCount; index++) {
+        if ((selection >> index) & 1) result[index / 8] |= 0x80 >> (index % 8);
     }
     return result;
 }
 
 const std::vector<char> bytesToBools(uint8_t* bytes, size_t length) {
     std::vector<char> result;
-    for (int index = 0; index < length; index++) {
+    if (bytes == nullptr) return result;
+    for (size_t index = 0; index < length; index++) {
         uint8_t c = *bytes;
         auto bits = std::bitset<8>(c);
         for (int bit = 7; bit >= 0; bit--) {
@@ -78,12 +79,61 @@ const std::string bytesToConsole(uint8_t* bytes, size_t length) {
     return result;
 }
 
+static SystemClock systemClock;
+static ClockSource* currentClockSource = &systemClock;
+
+ClockSource* getClockSource() {
+    return currentClockSource;
+}
+
+void setClockSource(ClockSource* clockSource) {
+    currentClockSource = (clockSource != nullptr) ? clockSource : &systemClock;
+}
+
+uint64_t ClockSource::getEpochTime() {
+    uint32_t epoch;
+    uint16_t epochMillis;
+    do {
+        epoch = getEpoch();
+        epochMillis = getEpochMillis();
+    } while (epoch != getEpoch());
+    return (uint64_t) epoch * 1000 + epochMillis;
+}
+
+void SystemClock::slewEpoch(const int32_t offsetMillis) {
+    // adjtime() replaces the slew in progress, so what is left of it is added to the new offset
+    struct timeval remaining = { 0, 0 };
+    adjtime(nullptr, &remaining);
+    const int64_t offsetMicros = (int64_t) offsetMillis * 1000 + (int64_t) remaining.tv_sec * 1000000 + remaining.tv_usec;
+    const struct timeval delta = { (time_t) (offsetMicros / 1000000), (suseconds_t) (offsetMicros % 1000000) };
+    adjtime(&delta, nullptr);
+}
+
+void VirtualClock::advance(const uint32_t milliseconds) {
+    m_millis += milliseconds;
+    if (m_slewMillis == 0) {
+        m_slewBudget = 0;
+        return;
+    }
+    m_slewBudget += milliseconds;
+    const int32_t step = std::min((uint32_t) abs(m_slewMillis), m_slewBudget / CLOCK_SLEW_DIVIDER);
+    const int32_t slew = (m_slewMillis < 0) ? -step : step;
+    m_slewBudget -= step * CLOCK_SLEW_DIVIDER;
+    m_epochSetMillis -= slew;
+    m_slewMillis -= slew;
+}
+
 const bool hasTimePassed(uint32_t fromTimeStamp, uint16_t durationSeconds, bool rtcSync = false) {
     if (!rtcSync) {
-        return (millis() - fromTimeStamp) >= (durationSeconds * 1000);
+        return (getClockSource()->getMillis() - fromTimeStamp) >= (durationSeconds * 1000);
     } else {
-        ESP32Time espClock;
-        return (millis() - fromTimeStamp) >= (durationSeconds * 1000) && (espClock.getMillis() % 1000 >= 100);
+        // Due checks run in the first half of the epoch second, so they lock to the start of the second, or when half a
+        // second late. With a synchronized clock a check every second runs within a loop iteration of the start of the second,
+        // longer check delays can still run up to their delay after a division boundary.
+        ClockSource* clock = getClockSource();
+        const uint32_t elapsed = clock->getMillis() - fromTimeStamp;
+        const uint32_t duration = durationSeconds * 1000;
+        return (elapsed + 500 >= duration && clock->getEpochMillis() < 500) || elapsed >= duration + 500;
     }
 }
 
@@ -107,9 +157,18 @@ const std::string getCharParamValue(const std::string uuid, UuidSection position
     return result;
 }
 
+// Saving and restoring build the key from the UUID the same way: the CID+count in lower case, like the stacks print the UUIDs
+const std::string getPreferencesKey(const std::string uuid) {
+    std::string key = getCharParamValue(uuid, SUFFIX);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+    return key;
+}
+
 const bool isNotSaveExcluded(std::string controlId) {
     return (controlId != ((std::string)CLOCK_UUID_SUFFIX).append("01")) && 
-        (controlId.substr(0,10) != ((std::string)MOMNT_UUID_SUFFIX).substr(0,10));
+        (controlId.substr(0,10) != ((std::string)MOMNT_UUID_SUFFIX).substr(0,10)) &&
+        (controlId.substr(0,10) != ((std::string)TRANS_UUID_SUFFIX).substr(0,10)) &&
+        (controlId.substr(0,10) != ((std::string)XYPAD_UUID_SUFFIX).substr(0,10));
 };
 
 const int getClosestDivision(uint16_t divisionMinutes) {
@@ -127,6 +186,522 @@ const int getClosestDivision(uint16_t divisionMinutes) {
 
 // --------------------------------------------------------------------------------------------------------------------
 
+TrafficRecorder::TrafficRecorder(const uint16_t capacity, BleTransport* transport) {
+    m_records.resize(capacity > 0 ? capacity : 1);
+    m_transport = transport;
+    m_isPaused = false;
+    m_nextSequence = 0;
+    m_count = 0;
+}
+
+void TrafficRecorder::record(const TrafficEventType type, const uint16_t handle, const uint8_t* payload, const size_t length) {
+    if (m_isPaused) return;
+    TrafficRecord record;
+    record.timeStamp = getClockSource()->getMillis();
+    record.handle = handle;
+    record.type = type;
+    record.length = (length > UINT8_MAX) ? UINT8_MAX : length;
+    if (payload != nullptr) memcpy(record.payload, payload, std::min(length, (size_t) TRAFFIC_PAYLOAD_SIZE));
+    add(record);
+}
+
+void TrafficRecorder::add(const TrafficRecord& record) {
+    portENTER_CRITICAL(&m_lock);
+    m_records[m_nextSequence % m_records.size()] = record;
+    m_nextSequence++;
+    if (m_count < m_records.size()) m_count++;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+void TrafficRecorder::recordCharacteristic(const TrafficEventType type, BLECharacteristic* characteristic, const uint8_t* payload, const size_t length) {
+    record(type, (m_transport != nullptr) ? m_transport->getHandle(characteristic) : characteristic->getHandle(), payload, length);
+}
+
+uint32_t TrafficRecorder::getFirstSequence() {
+    return m_nextSequence - m_count;
+}
+
+bool TrafficRecorder::get(const uint32_t sequence, TrafficRecord& record) {
+    portENTER_CRITICAL(&m_lock);
+    bool isAvailable = (m_nextSequence - sequence) <= m_count && sequence != m_nextSequence;
+    if (isAvailable) record = m_records[sequence % m_records.size()];
+    portEXIT_CRITICAL(&m_lock);
+    return isAvailable;
+}
+
+size_t TrafficRecorder::writePage(uint32_t fromSequence, uint8_t* page, const size_t capacity) {
+    // Page layout : first sequence (uint32), records count (uint16), then each record as
+    // timeStamp (uint32), handle (uint16), type (uint8), length (uint8) and the kept payload bytes
+    if ((m_nextSequence - fromSequence) > m_count) fromSequence = getFirstSequence();
+    size_t pageSize = encodeValue(fromSequence, page, capacity);
+    size_t countPosition = pageSize;
+    pageSize += sizeof(uint16_t);
+    uint16_t recordsCount = 0;
+    TrafficRecord record;
+    for (uint32_t sequence = fromSequence; get(sequence, record); sequence++) {
+        const size_t payloadSize = std::min((size_t) record.length, (size_t) TRAFFIC_PAYLOAD_SIZE);
+        if (pageSize + sizeof(record.timeStamp) + sizeof(record.handle) + 2 + payloadSize > capacity) break;
+        pageSize += encodeValue(record.timeStamp, page + pageSize, capacity - pageSize);
+        pageSize += encodeValue(record.handle, page + pageSize, capacity - pageSize);
+        page[pageSize++] = record.type;
+        page[pageSize++] = record.length;
+        memcpy(page + pageSize, record.payload, payloadSize);
+        pageSize += payloadSize;
+        recordsCount++;
+    }
+    encodeValue(recordsCount, page + countPosition, capacity - countPosition);
+    return pageSize;
+}
+
+uint16_t TrafficRecorder::readPage(const uint8_t* page, const size_t length) {
+    uint32_t firstSequence;
+    uint16_t recordsCount;
+    if (!decodeValue(page, length, firstSequence)) return 0;
+    size_t position = sizeof(firstSequence);
+    if (!decodeValue(page + position, length - position, recordsCount)) return 0;
+    position += sizeof(recordsCount);
+    uint16_t added = 0;
+    TrafficRecord record = {};
+    for (; added < recordsCount; added++) {
+        if (!decodeValue(page + position, length - position, record.timeStamp)) break;
+        position += sizeof(record.timeStamp);
+        if (length - position < sizeof(record.handle) + 2 || !decodeValue(page + position, length - position, record.handle)) break;
+        position += sizeof(record.handle);
+        record.type = page[position++];
+        record.length = page[position++];
+        const size_t payloadSize = std::min((size_t) record.length, (size_t) TRAFFIC_PAYLOAD_SIZE);
+        if (record.type > AUTH_EVENT || length - position < payloadSize) break;
+        memcpy(record.payload, page + position, payloadSize);
+        position += payloadSize;
+        add(record);
+    }
+    return added;
+}
+
+void TrafficRecorder::dump(Print& output) {
+    static const char* typeNames[] = { "WRITE", "NOTIFY", "CONNECT", "DISCONNECT", "AUTH" };
+    TrafficRecord record;
+    for (uint32_t sequence = getFirstSequence(); get(sequence, record); sequence++) {
+        const size_t payloadSize = std::min((size_t) record.length, (size_t) TRAFFIC_PAYLOAD_SIZE);
+        output.printf("%lu %lu %s %04X %u : %s\n", (unsigned long) sequence, (unsigned long) record.timeStamp, typeNames[record.type],
+            record.handle, record.length, bytesToConsole(record.payload, payloadSize).c_str());
+    }
+}
+
+void TrafficRecorder::clear() {
+    portENTER_CRITICAL(&m_lock);
+    m_count = 0;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+TrafficDumpCallback::TrafficDumpCallback(TrafficRecorder* recorder, bool* isDeviceAuthorised) {
+    m_recorder = recorder;
+    m_pIsDeviceAuthorised = isDeviceAuthorised;
+    m_cursor = 0;
+}
+
+void TrafficDumpCallback::onWrite(BLECharacteristic* pChar) {
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    if (*m_pIsDeviceAuthorised) decodeValue(value.data(), value.length(), m_cursor);
+}
+
+void TrafficDumpCallback::onRead(BLECharacteristic* pChar) {
+    uint8_t page[TRAFFIC_PAGE_SIZE];
+    size_t pageSize = (*m_pIsDeviceAuthorised) ? m_recorder->writePage(m_cursor, page, sizeof(page)) : 0;
+    pChar->setValue(page, pageSize);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static size_t encodeVarint(uint32_t value, uint8_t* bytes) {
+    size_t length = 0;
+    do {
+        const uint8_t lowBits = value & 0x7F;
+        value >>= 7;
+        bytes[length++] = lowBits | (value != 0 ? 0x80 : 0);
+    } while (value != 0);
+    return length;
+}
+
+static uint32_t zigzagEncode(const int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static int32_t zigzagDecode(const uint32_t value) {
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+static const size_t HISTORY_HEADER_SIZE = 2 * sizeof(uint16_t) + 5 * sizeof(uint32_t) + 2 * sizeof(int32_t);
+
+HistoryBuffer::HistoryBuffer(const uint16_t capacity, const uint16_t sampleSeconds) {
+    m_capacity = capacity > 0 ? capacity : 1;
+    m_sampleSeconds = sampleSeconds > 0 ? sampleSeconds : 1;
+    m_bytes.resize((size_t) m_capacity * HISTORY_BYTES_PER_SAMPLE);
+    m_resets = 0;
+    m_nextSequence = 0;
+    clear();
+}
+
+void HistoryBuffer::add(const uint32_t epoch, const int32_t value) {
+    portENTER_CRITICAL(&m_lock);
+    uint8_t record[10];
+    size_t length = 0;
+    uint32_t sampleEpoch = epoch;
+    if (m_count > 0) {
+        // The epoch is rounded to a whole number of intervals from the previous sample, so the decoded epochs are exact
+        const uint32_t intervals = (epoch > m_newest.epoch) ? (epoch - m_newest.epoch + m_sampleSeconds / 2) / m_sampleSeconds : 0;
+        sampleEpoch = m_newest.epoch + intervals * m_sampleSeconds;
+        length = encodeVarint(intervals, record);
+        length += encodeVarint(zigzagEncode((int32_t) ((uint32_t) value - (uint32_t) m_newest.value)), record + length);
+    }
+    while (m_count > 0 && (m_count >= m_capacity || m_bytes.size() - m_used < length)) removeOldest();
+    m_newest = { m_nextSequence, sampleEpoch, value };
+    if (m_count == 0) {
+        m_oldest = m_newest;
+    } else {
+        push(record, length);
+    }
+    m_count++;
+    m_nextSequence++;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+void HistoryBuffer::push(const uint8_t* bytes, const size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        m_bytes[(m_start + m_used + index) % m_bytes.size()] = bytes[index];
+    }
+    m_used += length;
+}
+
+size_t HistoryBuffer::readDelta(const std::vector<uint8_t>& bytes, size_t position, uint32_t& intervals, int32_t& valueDelta) {
+    size_t length = 0;
+    for (uint8_t field = 0; field < 2; field++) {
+        uint32_t value = 0;
+        uint8_t byte;
+        uint8_t shift = 0;
+        do {
+            byte = bytes[(position + length++) % bytes.size()];
+            value |= (uint32_t) (byte & 0x7F) << shift;
+            shift += 7;
+        } while ((byte & 0x80) != 0 && shift < 35);
+        if (field == 0) intervals = value; else valueDelta = zigzagDecode(value);
+    }
+    return length;
+}
+
+void HistoryBuffer::removeOldest() {
+    if (m_count <= 1) {
+        m_count = 0;
+        m_start = 0;
+        m_used = 0;
+        return;
+    }
+    uint32_t intervals;
+    int32_t valueDelta;
+    const size_t length = readDelta(m_bytes, m_start, intervals, valueDelta);
+    m_oldest.sequence++;
+    m_oldest.epoch += intervals * m_sampleSeconds;
+    m_oldest.value = (int32_t) ((uint32_t) m_oldest.value + (uint32_t) valueDelta);
+    m_start = (m_start + length) % m_bytes.size();
+    m_used -= length;
+    m_count--;
+}
+
+bool HistoryBuffer::isValid(const Cursor& cursor) {
+    // The records of the samples still in the buffer never move, adding samples only removes the oldest ones
+    return cursor.resets == m_resets && m_count > 0 && (int32_t) (cursor.state.sequence - m_oldest.sequence) >= 0;
+}
+
+size_t HistoryBuffer::advance(Cursor& cursor) {
+    uint32_t intervals;
+    int32_t valueDelta;
+    const size_t length = readDelta(m_bytes, cursor.position, intervals, valueDelta);
+    cursor.position = (cursor.position + length) % m_bytes.size();
+    cursor.state.sequence++;
+    cursor.state.epoch += intervals * m_sampleSeconds;
+    cursor.state.value = (int32_t) ((uint32_t) cursor.state.value + (uint32_t) valueDelta);
+    return length;
+}
+
+size_t HistoryBuffer::writePage(uint32_t fromSequence, uint8_t* page, const size_t capacity) {
+    // Page layout : first sequence (uint32), its epoch (uint32) and value (int32), sample seconds (uint16), samples count (uint16),
+    // then for each of the next samples the varint of the elapsed intervals and the zigzag varint of the value difference.
+    // The records are decoded HISTORY_DECODE_CHUNK samples at a time, each chunk in its own short critical section.
+    Cursor cursor;
+    uint32_t nextSequence = 0;
+    bool isStarted = false;
+    bool isPositioned = false;
+    while (!isPositioned) {
+        portENTER_CRITICAL(&m_lock);
+        if (!isStarted || !isValid(cursor)) {
+            // Samples removed while seeking move the page to the oldest one left
+            if ((m_nextSequence - fromSequence) > m_count) fromSequence = m_nextSequence - m_count;
+            cursor = { m_oldest, m_start, m_resets };
+            if (fromSequence == m_nextSequence) cursor = { { m_nextSequence, m_newest.epoch, m_newest.value }, 0, m_resets };
+            nextSequence = m_nextSequence;
+            isStarted = true;
+        }
+        for (uint16_t index = 0; index < HISTORY_DECODE_CHUNK && cursor.state.sequence != fromSequence; index++) advance(cursor);
+        isPositioned = cursor.state.sequence == fromSequence;
+        portEXIT_CRITICAL(&m_lock);
+    }
+    size_t pageSize = encodeValue(cursor.state.sequence, page, capacity);
+    pageSize += encodeValue(cursor.state.epoch, page + pageSize, capacity - pageSize);
+    pageSize += encodeValue(cursor.state.value, page + pageSize, capacity - pageSize);
+    pageSize += encodeValue(m_sampleSeconds, page + pageSize, capacity - pageSize);
+    const size_t countPosition = pageSize;
+    pageSize += sizeof(uint16_t);
+    uint16_t samplesCount = (cursor.state.sequence != nextSequence) ? 1 : 0;
+    // Only the samples there were when the page started are copied
+    bool isPageDone = nextSequence - cursor.state.sequence <= 1;
+    while (!isPageDone) {
+        portENTER_CRITICAL(&m_lock);
+        // If the next sample was removed meanwhile the page ends here, the app asks for the following page from its last sample
+        isPageDone = !isValid(cursor);
+        for (uint16_t index = 0; !isPageDone && index < HISTORY_DECODE_CHUNK; index++) {
+            const Cursor previous = cursor;
+            const size_t length = advance(cursor);
+            if (pageSize + length > capacity) {
+                cursor = previous;
+                isPageDone = true;
+                break;
+            }
+            for (size_t byteIndex = 0; byteIndex < length; byteIndex++) {
+                page[pageSize++] = m_bytes[(previous.position + byteIndex) % m_bytes.size()];
+            }
+            samplesCount++;
+            isPageDone = nextSequence - cursor.state.sequence <= 1;
+        }
+        portEXIT_CRITICAL(&m_lock);
+    }
+    encodeValue(samplesCount, page + countPosition, capacity - countPosition);
+    return pageSize;
+}
+
+std::vector<uint8_t> HistoryBuffer::serialize() {
+    // Layout : sample seconds (uint16), samples count (uint16), next sequence (uint32), oldest and newest samples
+    // as sequence (uint32), epoch (uint32) and value (int32), then the delta records from the oldest one.
+    // The vector is allocated before the critical section, that only copies the records.
+    std::vector<uint8_t> data(HISTORY_HEADER_SIZE + m_bytes.size());
+    uint8_t* bytes = data.data();
+    portENTER_CRITICAL(&m_lock);
+    size_t length = encodeValue(m_sampleSeconds, bytes, data.size());
+    length += encodeValue(m_count, bytes + length, data.size() - length);
+    length += encodeValue(m_nextSequence, bytes + length, data.size() - length);
+    for (const SampleState* state : { &m_oldest, &m_newest }) {
+        length += encodeValue(state->sequence, bytes + length, data.size() - length);
+        length += encodeValue(state->epoch, bytes + length, data.size() - length);
+        length += encodeValue(state->value, bytes + length, data.size() - length);
+    }
+    const size_t used = m_used;
+    const size_t firstPartSize = std::min(m_used, m_bytes.size() - m_start);
+    memcpy(bytes + length, m_bytes.data() + m_start, firstPartSize);
+    memcpy(bytes + length + firstPartSize, m_bytes.data(), used - firstPartSize);
+    portEXIT_CRITICAL(&m_lock);
+    data.resize(HISTORY_HEADER_SIZE + used);
+    return data;
+}
+
+bool HistoryBuffer::deserialize(const uint8_t* data, const size_t length) {
+    const size_t headerSize = HISTORY_HEADER_SIZE;
+    uint16_t sampleSeconds = 0;
+    uint16_t count = 0;
+    if (length < headerSize || !decodeValue(data, sizeof(uint16_t), sampleSeconds) || !decodeValue(data + 2, sizeof(uint16_t), count)) return false;
+    // Samples saved with another interval or a larger capacity are dropped
+    if (sampleSeconds != m_sampleSeconds || count > m_capacity || length - headerSize > m_bytes.size()) return false;
+    portENTER_CRITICAL(&m_lock);
+    size_t position = 2 * sizeof(uint16_t);
+    decodeValue(data + position, sizeof(uint32_t), m_nextSequence);
+    position += sizeof(uint32_t);
+    for (SampleState* state : { &m_oldest, &m_newest }) {
+        decodeValue(data + position, sizeof(uint32_t), state->sequence);
+        position += sizeof(uint32_t);
+        decodeValue(data + position, sizeof(uint32_t), state->epoch);
+        position += sizeof(uint32_t);
+        decodeValue(data + position, sizeof(int32_t), state->value);
+        position += sizeof(int32_t);
+    }
+    m_count = count;
+    m_resets++;
+    m_start = 0;
+    m_used = length - headerSize;
+    memcpy(m_bytes.data(), data + headerSize, m_used);
+    portEXIT_CRITICAL(&m_lock);
+    return true;
+}
+
+void HistoryBuffer::clear() {
+    portENTER_CRITICAL(&m_lock);
+    m_resets++;
+    m_start = 0;
+    m_used = 0;
+    m_count = 0;
+    m_oldest = { m_nextSequence, 0, 0 };
+    m_newest = m_oldest;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+HistoryCallback::HistoryCallback(HistoryBuffer* history, bool* isDeviceAuthorised, TrafficRecorder** recorder) {
+    m_history = history;
+    m_pIsDeviceAuthorised = isDeviceAuthorised;
+    m_ppRecorder = recorder;
+    m_cursor = 0;
+}
+
+void HistoryCallback::onWrite(BLECharacteristic* pChar) {
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    if (m_ppRecorder != nullptr && *m_ppRecorder != nullptr) (*m_ppRecorder)->recordCharacteristic(WRITE_EVENT, pChar, value.data(), value.length());
+    if (*m_pIsDeviceAuthorised) decodeValue(value.data(), value.length(), m_cursor);
+}
+
+void HistoryCallback::onRead(BLECharacteristic* pChar) {
+    uint8_t page[HISTORY_PAGE_SIZE];
+    size_t pageSize = (*m_pIsDeviceAuthorised) ? m_history->writePage(m_cursor, page, sizeof(page)) : 0;
+    pChar->setValue(page, pageSize);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+ReadCallback::ReadCallback(std::function<void()> onRead, bool* isDeviceAuthorised) {
+    m_onRead = onRead;
+    m_pIsDeviceAuthorised = isDeviceAuthorised;
+}
+
+void ReadCallback::onRead(BLECharacteristic* pChar) {
+    if (*m_pIsDeviceAuthorised) m_onRead();
+}
+
+WriteCallback::WriteCallback(
+    std::function<void(const uint8_t*, size_t)> onWrite,
+    bool* isDeviceAuthorised,
+    TrafficRecorder** recorder,
+    std::function<bool(const uint8_t*, size_t)> shouldRecordWrite
+) {
+    m_onWrite = onWrite;
+    m_pIsDeviceAuthorised = isDeviceAuthorised;
+    m_ppRecorder = recorder;
+    m_shouldRecordWrite = shouldRecordWrite;
+}
+
+void WriteCallback::onWrite(BLECharacteristic* pChar) {
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    const bool shouldRecord = m_ppRecorder != nullptr && *m_ppRecorder != nullptr
+        && (m_shouldRecordWrite == nullptr || m_shouldRecordWrite(value.data(), value.length()));
+    if (shouldRecord) (*m_ppRecorder)->recordCharacteristic(WRITE_EVENT, pChar, value.data(), value.length());
+    if (*m_pIsDeviceAuthorised) m_onWrite(value.data(), value.length());
+}
+
+void WriteCallback::onNotify(BLECharacteristic* pChar) {
+    if (m_ppRecorder == nullptr || *m_ppRecorder == nullptr) return;
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    (*m_ppRecorder)->recordCharacteristic(NOTIFY_EVENT, pChar, value.data(), value.length());
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+struct Crc32Table {
+    uint32_t values[256];
+    constexpr Crc32Table() : values() {
+        for (uint32_t index = 0; index < 256; index++) {
+            uint32_t crc = index;
+            for (uint8_t bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            values[index] = crc;
+        }
+    }
+};
+
+static constexpr Crc32Table crc32Table;
+
+uint32_t updateCrc32(uint32_t crc, const uint8_t* data, const size_t length) {
+    crc = ~crc;
+    for (size_t index = 0; index < length; index++) crc = crc32Table.values[(crc ^ data[index]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+PartitionSink::PartitionSink(const char* publicKeyPem) {
+    m_publicKeyPem = publicKeyPem;
+    mbedtls_md_init(&m_digest);
+    mbedtls_md_setup(&m_digest, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+}
+
+PartitionSink::~PartitionSink() {
+    mbedtls_md_free(&m_digest);
+}
+
+bool PartitionSink::begin(const uint32_t imageSize) {
+    mbedtls_md_starts(&m_digest);
+    return Update.begin(imageSize, U_FLASH);
+}
+
+bool PartitionSink::write(const uint8_t* data, const size_t length) {
+    mbedtls_md_update(&m_digest, data, length);
+    return Update.write((uint8_t*) data, length) == length;
+}
+
+static bool isP256Key(mbedtls_pk_context& publicKey) {
+    if (!mbedtls_pk_can_do(&publicKey, MBEDTLS_PK_ECKEY)) return false;
+    // The key pair fields are private from mbedTLS 3 (IDF 5)
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    return mbedtls_pk_ec(publicKey)->MBEDTLS_PRIVATE(grp).id == MBEDTLS_ECP_DP_SECP256R1;
+#else
+    return mbedtls_pk_ec(publicKey)->grp.id == MBEDTLS_ECP_DP_SECP256R1;
+#endif
+}
+
+bool PartitionSink::verify(const uint8_t* signature, const size_t length) {
+    uint8_t hash[32];
+    mbedtls_md_finish(&m_digest, hash);
+    // Without a key the bootloader checks the signature of the app, but only if secure boot is enabled
+    if (m_publicKeyPem == nullptr) return esp_secure_boot_enabled();
+    mbedtls_pk_context publicKey;
+    mbedtls_pk_init(&publicKey);
+    const bool isValid = mbedtls_pk_parse_public_key(&publicKey, (const uint8_t*) m_publicKeyPem, strlen(m_publicKeyPem) + 1) == 0 &&
+        isP256Key(publicKey) &&
+        mbedtls_pk_verify(&publicKey, MBEDTLS_MD_SHA256, hash, sizeof(hash), signature, length) == 0;
+    mbedtls_pk_free(&publicKey);
+    return isValid;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+LatencySamples::LatencySamples(const uint16_t capacity) {
+    m_samples.resize(capacity > 0 ? capacity : 1);
+    clear();
+}
+
+void LatencySamples::add(const uint32_t latencyMicros) {
+    portENTER_CRITICAL(&m_lock);
+    m_samples[m_count % m_samples.size()] = latencyMicros;
+    m_count++;
+    if (latencyMicros > m_max) m_max = latencyMicros;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+uint32_t LatencySamples::getPercentile(const uint8_t percent) {
+    // The copy is allocated before taking the lock, only the samples are copied with the interrupts disabled
+    std::vector<uint32_t> samples(m_samples.size());
+    portENTER_CRITICAL(&m_lock);
+    const size_t count = std::min((size_t) m_count, m_samples.size());
+    memcpy(samples.data(), m_samples.data(), count * sizeof(uint32_t));
+    portEXIT_CRITICAL(&m_lock);
+    samples.resize(count);
+    if (samples.empty()) return 0;
+    std::vector<uint32_t>::iterator percentile = samples.begin() + (samples.size() - 1) * std::min(percent, (uint8_t) 100) / 100;
+    std::nth_element(samples.begin(), percentile, samples.end());
+    return *percentile;
+}
+
+void LatencySamples::clear() {
+    portENTER_CRITICAL(&m_lock);
+    m_count = 0;
+    m_max = 0;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
 const CallbackType CharacteristicCallback::getValueType() {
     if (m_pIntFunc != nullptr) return INTEGER;
     if (m_pFloatFunc != nullptr) return FLOAT;
@@ -135,50 +710,168 @@ const CallbackType CharacteristicCallback::getValueType() {
     return NONE;
 }
 
+void CharacteristicCallback::saveValue(Preferences& preferences, BLECharacteristic* pChar, const CallbackType type) {
+    if (pChar == nullptr) return;
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    saveValue(preferences, pChar, value.data(), value.length(), type);
+}
+
+void CharacteristicCallback::saveValue(
+    Preferences& preferences,
+    BLECharacteristic* pChar,
+    const uint8_t* bytes,
+    const size_t length,
+    const CallbackType type
+) {
+    if (pChar == nullptr) return;
+    const std::string controlId = getPreferencesKey(pChar->getUUID().toString());
+    if (!isNotSaveExcluded(controlId)) return;
+    const uint8_t* m_byteArray = bytes;
+    size_t m_dataSize = length;
+    int32_t intValue;
+    if (type == INTEGER && decodeValue(m_byteArray, m_dataSize, intValue)) {
+        preferences.putInt(controlId.c_str(), intValue);
+    }
+    float_t floatValue;
+    if (type == FLOAT && decodeValue(m_byteArray, m_dataSize, floatValue)) {
+        preferences.putFloat(controlId.c_str(), floatValue);
+    }
+    if (type == STRING) {
+        // The characteristic and the pending copy keep the value in a std::string, so the data is already null terminated
+        preferences.putString(controlId.c_str(), (const char*) m_byteArray);
+    }
+    if (type == VECTOR) {
+        preferences.putBytes(controlId.c_str(), m_byteArray, m_dataSize);
+    }
+}
+
 void CharacteristicCallback::saveValuesTask(void* params) {
     SaveDataParams* data = (SaveDataParams*) params;
     Preferences m_preferences;
-    m_preferences.begin(PREFERENCES_ID, false);
-    const std::string controlId = getCharParamValue(data->pChar->getUUID().toString(), SUFFIX);
-    uint8_t* m_byteArray = data->pChar->getData();
-    if (isNotSaveExcluded(controlId) && data->pChar != nullptr) {        
-        if (data->type == INTEGER) {
-            int32_t intValue = bytesToIntegerType<int32_t>(m_byteArray);
-            m_preferences.putInt(controlId.c_str(), intValue);
-        }
-        if (data->type == FLOAT) {
-            float_t floatValue = bytesToFloat(m_byteArray);
-            m_preferences.putFloat(controlId.c_str(), floatValue);
-        }
-        if (data->type == STRING) {
-            std::string stringValue = data->pChar->getValue();
-            m_preferences.putString(controlId.c_str(), stringValue.c_str());
-            uint8_t savedStringValue[512]; //TODO set this to pChar->getLenght()?
-            m_preferences.getString(controlId.c_str(), (char*)&savedStringValue[0], sizeof(savedStringValue));
-            //printf("Saved %s string to %s\n", (char*)savedStringValue, controlId.c_str());
-        }
-        if (data->type == VECTOR) {
-            size_t m_dataSize = data->pChar->getLength();
-            m_preferences.putBytes(controlId.c_str(), m_byteArray, m_dataSize);
-            uint8_t savedValue[m_dataSize];
-            m_preferences.getBytes(controlId.c_str(), savedValue, m_dataSize);
-        }
-        m_preferences.end();
-    }
+    m_preferences.begin(data->preferencesId, false);
+    saveValue(m_preferences, data->pChar, data->type);
+    m_preferences.end();
+    if (data->latencyProbe != nullptr) data->latencyProbe->add(micros() - data->writeTimeStamp);
+    delete data;
     vTaskDelete(NULL);
 }
 
 void CharacteristicCallback::executeCallback(BLECharacteristic* pChar, bool shouldSaveValues = false) {
-    if (m_pFloatFunc != nullptr) m_pFloatFunc(bytesToFloat(pChar->getData()));
-    if (m_pIntFunc != nullptr) m_pIntFunc(bytesToIntegerType<long>(pChar->getData()));
-    if (m_pStringFunc != nullptr) m_pStringFunc(pChar->getValue());
-    if (m_pVectFunc != nullptr) m_pVectFunc(bytesToBools(pChar->getData(), pChar->getLength()));
-    m_saveDataParams = { pChar, getValueType() };
-    if (shouldSaveValues) xTaskCreate(saveValuesTask, "saveValues", 8192, (void *) &m_saveDataParams, 10, &saveValuesTaskHandle);
+    const uint32_t writeTimeStamp = micros();
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    float_t floatValue;
+    int32_t intValue;
+    if (m_validator != nullptr && !m_validator(std::string_view((const char*) value.data(), value.length()))) return restoreValidValue(pChar);
+    if (m_pFloatFunc != nullptr) {
+        if (!decodeValue(value.data(), value.length(), floatValue)) return restoreValidValue(pChar);
+        m_pFloatFunc(floatValue);
+    }
+    if (m_pIntFunc != nullptr) {
+        if (!decodeValue(value.data(), value.length(), intValue)) return restoreValidValue(pChar);
+        m_pIntFunc(intValue);
+    }
+    keepValidValue(pChar);
+    if (m_pStringFunc != nullptr) m_pStringFunc(std::string_view((const char*) value.data(), value.length()));
+    if (m_pVectFunc != nullptr) m_pVectFunc(bytesToBools((uint8_t*) value.data(), value.length()));
+    if (!shouldSaveValues || !m_isPersistent) return;
+    if (m_isSequenced) {
+        // A burst of high rate writes is saved once, by savePendingValue() when the writes stop. The copy is made before the
+        // lock and only swapped under it, nothing is allocated with the interrupts disabled.
+        std::string pendingValue((const char*) value.data(), value.length());
+        portENTER_CRITICAL(&m_saveLock);
+        m_pendingValue.swap(pendingValue);
+        m_isSavePending = true;
+        m_pendingSaveTimeStamp = millis();
+        m_pendingWriteTimeStamp = writeTimeStamp;
+        portEXIT_CRITICAL(&m_saveLock);
+        return;
+    }
+    // Each save task gets its own copy, a write that arrives meanwhile must not change the time stamp of the previous one
+    SaveDataParams* saveDataParams = new SaveDataParams { pChar, getValueType(), writeTimeStamp, m_saveLatencyProbe, m_preferencesId };
+    if (xTaskCreate(saveValuesTask, "saveValues", 8192, (void *) saveDataParams, 10, &saveValuesTaskHandle) != pdPASS) delete saveDataParams;
+}
+
+void CharacteristicCallback::savePendingValue(BLECharacteristic* pChar, const bool isForced) {
+    if (!m_isSavePending) return;
+    portENTER_CRITICAL(&m_saveLock);
+    const bool isDue = m_isSavePending && (isForced || millis() - m_pendingSaveTimeStamp >= SAVE_DEBOUNCE_MS);
+    std::string pendingValue;
+    if (isDue) {
+        m_isSavePending = false;
+        pendingValue.swap(m_pendingValue);
+    }
+    const uint32_t writeTimeStamp = m_pendingWriteTimeStamp;
+    portEXIT_CRITICAL(&m_saveLock);
+    if (!isDue) return;
+    Preferences preferences;
+    preferences.begin(m_preferencesId, false);
+    saveValue(preferences, pChar, (const uint8_t*) pendingValue.c_str(), pendingValue.length(), getValueType());
+    preferences.end();
+    if (m_saveLatencyProbe != nullptr) m_saveLatencyProbe->add(micros() - writeTimeStamp);
+}
+
+void CharacteristicCallback::cancelPendingSave() {
+    portENTER_CRITICAL(&m_saveLock);
+    m_isSavePending = false;
+    portEXIT_CRITICAL(&m_saveLock);
+}
+
+bool CharacteristicCallback::isValidValue(const uint8_t* bytes, const size_t length) {
+    if (m_pFloatFunc != nullptr && length != encodedSize<float_t>()) return false;
+    if (m_pIntFunc != nullptr && length != encodedSize<int32_t>()) return false;
+    return m_validator == nullptr || m_validator(std::string_view((const char*) bytes, length));
+}
+
+void CharacteristicCallback::keepValidValue(BLECharacteristic* pChar) {
+    // Only the numeric values can fail to decode, the string and vector values are valid unless there is a validator
+    if (m_pFloatFunc == nullptr && m_pIntFunc == nullptr && m_validator == nullptr) return;
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    m_validValue.assign((const char*) value.data(), value.length());
+}
+
+void CharacteristicCallback::restoreValidValue(BLECharacteristic* pChar) {
+    pChar->setValue((uint8_t*) m_validValue.data(), m_validValue.length());
+    m_lastValue = m_validValue;
+}
+
+void CharacteristicCallback::onStatus(BLECharacteristic* pChar, Status status, CharacteristicStatusCode code) {
+    if (m_notifier != nullptr) m_notifier->onStatus(pChar, status);
+}
+
+void CharacteristicCallback::record(const TrafficEventType type, BLECharacteristic* pChar) {
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    m_recorder->recordCharacteristic(type, pChar, value.data(), value.length());
+}
+
+bool CharacteristicCallback::acceptSequence(BLECharacteristic* pChar) {
+    const CharacteristicValue value = getCharacteristicValue(pChar);
+    const uint8_t* bytes = value.data();
+    const size_t length = value.length();
+    // Int values have a fixed size, the string values of the high rate controls never contain a 0 byte
+    const size_t valueLength = length - WRITE_SEQUENCE_SIZE;
+    const bool hasSequence = length > WRITE_SEQUENCE_SIZE && bytes[valueLength] == 0
+        && (m_pIntFunc == nullptr || valueLength == sizeof(int32_t));
+    if (!hasSequence) {
+        m_lastValue.assign((const char*) bytes, length);
+        return true;
+    }
+    uint16_t sequence;
+    decodeValue(bytes + valueLength + 1, sizeof(uint16_t), sequence);
+    // The difference is signed so the sequence number can wrap around
+    if (m_hasSequence && (int16_t) (sequence - m_lastSequence) <= 0) {
+        m_staleWrites++;
+        pChar->setValue((uint8_t*) m_lastValue.data(), m_lastValue.length());
+        return false;
+    }
+    m_hasSequence = true;
+    m_lastSequence = sequence;
+    m_lastValue.assign((const char*) bytes, valueLength);
+    pChar->setValue((uint8_t*) m_lastValue.data(), m_lastValue.length());
+    return true;
 }
 
 CharacteristicCallback::CharacteristicCallback(
-    std::function<void(long)> func = nullptr,
+    std::function<void(int32_t)> func = nullptr,
     bool* isDeviceAuthorised = nullptr
 ) {
     m_pIntFunc = func;
@@ -194,7 +887,7 @@ CharacteristicCallback::CharacteristicCallback(
 };
 
 CharacteristicCallback::CharacteristicCallback(
-    std::function<void(std::string)> func = nullptr,
+    std::function<void(std::string_view)> func = nullptr,
     bool* isDeviceAuthorised = nullptr
 ) {
     m_pStringFunc = func;
@@ -211,110 +904,609 @@ CharacteristicCallback::CharacteristicCallback(
 
 // --------------------------------------------------------------------------------------------------------------------
 
-IntervalControl::IntervalControl(
-    const uint16_t checkDelaySeconds,
-    bool* isDeviceAuthorised,
-    std::function<void(bool)> onIntervalToggle
-){
-    m_checkDelaySeconds = checkDelaySeconds;
-    m_isDeviceAuthorised = isDeviceAuthorised;
-    m_onIntervalToggle = onIntervalToggle;
-    m_callback = [&](std::vector<char> intervals){
-         m_intervals = intervals;
-         m_lastUpdateTimeStamp = millis() - m_checkDelaySeconds * 1000;
-         update();
-    };
+ControlNotifier::ControlNotifier() {
+    m_transport = nullptr;
+    m_queueHead = 0;
+    m_queueCount = 0;
+    m_holdCount = 0;
+    m_inFlight = 0;
+    m_isCongested = false;
+    m_isSending = false;
+    m_confirmsSends = false;
+    m_lastSendTimeStamp = 0;
+    m_stats = {};
 }
 
-void IntervalControl::update() {
-    if (m_checkDelaySeconds != 0 && hasTimePassed(m_lastUpdateTimeStamp, m_checkDelaySeconds, true)) {
-        if (m_onIntervalToggle != nullptr && (m_intervals.size() >= DAY_HOURS)) {
-            size_t intervalIndex = getIntervalIndex(espClock.getEpoch(), m_intervals.size());
-            m_onIntervalToggle(m_intervals[intervalIndex] == 1);
-        }
-        m_lastUpdateTimeStamp = millis();
-    }
+void ControlNotifier::setTransport(BleTransport* transport) {
+    m_transport = transport;
+    m_confirmsSends = transport->confirmsNotifications();
 }
 
-// --------------------------------------------------------------------------------------------------------------------
-
-ClockControl::ClockControl(
-    uint32_t initialValue,
-    const uint16_t notifyDelaySeconds,
-    bool* isDeviceAuthorised,
-    std::function<void(uint32_t)> onTimeSet
-){
-    m_notifyDelaySeconds = notifyDelaySeconds;
-    m_isDeviceAuthorised = isDeviceAuthorised;
-    m_onTimeSet = onTimeSet;
-    m_callback = [&](uint32_t time) { 
-        espClock.setTime(time);
-        m_onTimeSet(time);
-        update();
-    };
-    espClock.setTime(initialValue);
+void ControlNotifier::addCharacteristic(BLECharacteristic* characteristic) {
+    if (findSlot(characteristic) >= 0) return;
+    m_slots.push_back({ characteristic, false, 0 });
+    m_queue.resize(m_slots.size());
 }
 
-void ClockControl::update() {
-    if (m_notifyDelaySeconds != 0 && hasTimePassed(m_lastUpdateTimeStamp, m_notifyDelaySeconds, true)) {
-      uint32_t timeValue = espClock.getEpoch();
-      m_bleCharacteristic->setValue(timeValue);
-      if (*m_isDeviceAuthorised) m_bleCharacteristic->notify();
-      m_lastUpdateTimeStamp = millis();
+int16_t ControlNotifier::findSlot(BLECharacteristic* characteristic) {
+    for (size_t index = 0; index < m_slots.size(); index++) {
+        if (m_slots[index].characteristic == characteristic) return index;
     }
+    return -1;
 }
 
-// --------------------------------------------------------------------------------------------------------------------
+int16_t ControlNotifier::findSlot(const uint16_t handle) {
+    for (size_t index = 0; index < m_slots.size(); index++) {
+        const uint16_t slotHandle = (m_transport != nullptr) ? m_transport->getHandle(m_slots[index].characteristic)
+            : m_slots[index].characteristic->getHandle();
+        if (slotHandle == handle) return index;
+    }
+    return -1;
+}
 
-BooleanControl::BooleanControl(
-    ControlPublisher<std::string>* publisher,
-    bool* isDeviceAuthorised,
-    std::function<void(std::string)> onChange
-){
-    m_publisher = publisher;
-    m_isDeviceAuthorised = isDeviceAuthorised;
-    m_onChange = onChange;
-    m_callback = [&](std::string value) {
-        if (m_onChange != nullptr) m_onChange(value);
-        if (m_publisher != nullptr) m_publisher->setValue(value, this);
-    };
+void ControlNotifier::enqueue(const uint16_t slotIndex) {
+    m_slots[slotIndex].isPending = true;
+    m_queue[(m_queueHead + m_queueCount) % m_queue.size()] = slotIndex;
+    m_queueCount++;
+    if (m_queueCount > m_stats.maxPending) m_stats.maxPending = m_queueCount;
 }
 
-void BooleanControl::update() {
-    if (m_publisher != nullptr && m_bleCharacteristic != nullptr){
-        std::string currentValue = (m_publisher->getValue().length() > 0) ? m_publisher->getValue() : "OFF";
-        m_bleCharacteristic->setValue(currentValue);
-        if (*m_isDeviceAuthorised) m_bleCharacteristic->notify();
-        m_lastNotificationTimeStamp = millis();
+void ControlNotifier::retry(const int16_t slotIndex) {
+    if (slotIndex < 0 || m_slots[slotIndex].isPending) return;
+    if (m_slots[slotIndex].retries >= NOTIFICATION_RETRIES) {
+        m_stats.dropped++;
+        return;
     }
+    m_slots[slotIndex].retries++;
+    m_stats.retries++;
+    enqueue(slotIndex);
 }
 
-// --------------------------------------------------------------------------------------------------------------------
+void ControlNotifier::notify(BLECharacteristic* characteristic) {
+    portENTER_CRITICAL(&m_lock);
+    const int16_t slotIndex = findSlot(characteristic);
+    if (slotIndex >= 0) {
+        m_stats.queued++;
+        if (m_slots[slotIndex].isPending) {
+            m_stats.superseded++;
+        } else {
+            m_slots[slotIndex].retries = 0;
+            enqueue(slotIndex);
+        }
+    }
+    portEXIT_CRITICAL(&m_lock);
+    if (slotIndex < 0) characteristic->notify();
+    else send();
+}
 
-IntControl::IntControl(
-        ControlPublisher<int32_t>* publisher,
-        bool* isDeviceAuthorised,
-        std::function<void(int32_t)> onChange
-){
-    m_publisher = publisher;
-    m_isDeviceAuthorised = isDeviceAuthorised;
-    m_onChange = onChange;
-    m_callback = [&](int32_t value) {
-        if (m_onChange != nullptr) m_onChange(value);
-        if (m_publisher != nullptr) m_publisher->setValue(value, this);
-    };
+void ControlNotifier::send() {
+    portENTER_CRITICAL(&m_lock);
+    // Only one task drains the queue, a confirmation received while sending doesn't start another drain
+    const bool isSending = m_isSending;
+    m_isSending = true;
+    portEXIT_CRITICAL(&m_lock);
+    if (isSending) return;
+    while (true) {
+        portENTER_CRITICAL(&m_lock);
+        if (m_inFlight > 0 && getClockSource()->getMillis() - m_lastSendTimeStamp >= NOTIFICATION_TIMEOUT_MS) m_inFlight = 0;
+        if (m_holdCount > 0 || m_isCongested || m_inFlight >= NOTIFICATIONS_IN_FLIGHT || m_queueCount == 0) {
+            m_isSending = false;
+            portEXIT_CRITICAL(&m_lock);
+            return;
+        }
+        NotificationSlot& slot = m_slots[m_queue[m_queueHead]];
+        m_queueHead = (m_queueHead + 1) % m_queue.size();
+        m_queueCount--;
+        slot.isPending = false;
+        m_inFlight++;
+        m_lastSendTimeStamp = getClockSource()->getMillis();
+        BLECharacteristic* characteristic = slot.characteristic;
+        portEXIT_CRITICAL(&m_lock);
+        // The stack reports the result in onStatus() before notify() returns
+        if (m_transport != nullptr) m_transport->notify(characteristic);
+        else characteristic->notify();
+    }
 }
 
-void IntControl::update() {
-    if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
-        int currentValue = m_publisher->getValue();
-        m_bleCharacteristic->setValue(currentValue);
-        if (*m_isDeviceAuthorised) m_bleCharacteristic->notify();
-        m_lastNotificationTimeStamp = millis();
+void ControlNotifier::onStatus(BLECharacteristic* characteristic, BLECharacteristicCallbacks::Status status) {
+    portENTER_CRITICAL(&m_lock);
+    if (status == BLECharacteristicCallbacks::SUCCESS_NOTIFY) {
+        // Without confirmations from the stack a notification is done once the stack accepted it
+        if (!m_confirmsSends) {
+            m_stats.sent++;
+            if (m_inFlight > 0) m_inFlight--;
+        }
+    } else if (status == BLECharacteristicCallbacks::ERROR_NOTIFY_DISABLED || status == BLECharacteristicCallbacks::ERROR_NO_CLIENT ||
+        status == BLECharacteristicCallbacks::ERROR_GATT) {
+        // Nothing was handed to the stack, only a GATT error is worth another try
+        if (m_inFlight > 0) m_inFlight--;
+        if (status == BLECharacteristicCallbacks::ERROR_GATT) retry(findSlot(characteristic));
     }
+    portEXIT_CRITICAL(&m_lock);
 }
 
-// --------------------------------------------------------------------------------------------------------------------
+void ControlNotifier::onConfirmed(const uint16_t handle, const bool isSuccessful) {
+    portENTER_CRITICAL(&m_lock);
+    if (m_inFlight > 0) m_inFlight--;
+    if (isSuccessful) m_stats.sent++;
+    else retry(findSlot(handle));
+    portEXIT_CRITICAL(&m_lock);
+    send();
+}
+
+void ControlNotifier::onCongestion(const bool isCongested) {
+    portENTER_CRITICAL(&m_lock);
+    if (isCongested && !m_isCongested) m_stats.congestions++;
+    m_isCongested = isCongested;
+    portEXIT_CRITICAL(&m_lock);
+    if (!isCongested) send();
+}
+
+void ControlNotifier::clear() {
+    portENTER_CRITICAL(&m_lock);
+    m_stats.dropped += m_queueCount;
+    for (NotificationSlot& slot : m_slots) slot.isPending = false;
+    m_queueHead = 0;
+    m_queueCount = 0;
+    m_inFlight = 0;
+    m_isCongested = false;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+NotificationStats ControlNotifier::getStats() {
+    portENTER_CRITICAL(&m_lock);
+    NotificationStats stats = m_stats;
+    portEXIT_CRITICAL(&m_lock);
+    return stats;
+}
+
+void ControlNotifier::hold() {
+    portENTER_CRITICAL(&m_lock);
+    m_holdCount++;
+    portEXIT_CRITICAL(&m_lock);
+}
+
+void ControlNotifier::release() {
+    portENTER_CRITICAL(&m_lock);
+    if (m_holdCount > 0) m_holdCount--;
+    portEXIT_CRITICAL(&m_lock);
+    send();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+TransitionEngine::Channel::Channel(const uint16_t durationMs, const Easing easing, const uint8_t componentsCount) {
+    m_durationMs = durationMs;
+    m_easing = easing;
+    m_componentsCount = componentsCount;
+    m_isRunning = false;
+    m_hasValue = false;
+}
+
+void TransitionEngine::Channel::update() {
+    // Runs in the task of the Bluetooth stack while step() runs in the loop, the outputs are written outside of the lock
+    int32_t to[4];
+    int32_t output[4];
+    readTarget(to);
+    const uint32_t timeStamp = getClockSource()->getMillis();
+    portENTER_CRITICAL(&m_lock);
+    memcpy(m_to, to, sizeof(m_to));
+    const bool isImmediate = !m_hasValue || m_durationMs == 0;
+    if (isImmediate) {
+        // The first value (or a transition without duration) is applied without fading
+        memcpy(m_current, m_to, sizeof(m_current));
+        memcpy(output, m_current, sizeof(output));
+        m_hasValue = true;
+        m_isRunning = false;
+    } else {
+        memcpy(m_from, m_current, sizeof(m_from));
+        m_startTimeStamp = timeStamp;
+        m_isRunning = true;
+    }
+    portEXIT_CRITICAL(&m_lock);
+    if (isImmediate) writeOutput(output);
+}
+
+bool TransitionEngine::Channel::step(const uint32_t timeStamp) {
+    int32_t output[4];
+    portENTER_CRITICAL(&m_lock);
+    if (!m_isRunning) {
+        portEXIT_CRITICAL(&m_lock);
+        return false;
+    }
+    const uint32_t elapsedMs = timeStamp - m_startTimeStamp;
+    const int32_t progress = (elapsedMs >= m_durationMs) ? TRANSITION_ONE : ((int64_t) elapsedMs << 16) / m_durationMs;
+    const int32_t eased = TransitionEngine::ease(m_easing, progress);
+    for (uint8_t component = 0; component < m_componentsCount; component++) {
+        m_current[component] = m_from[component] + ((((int64_t) m_to[component] - m_from[component]) * eased) >> 16);
+    }
+    memcpy(output, m_current, sizeof(output));
+    m_isRunning = progress < TRANSITION_ONE;
+    const bool isRunning = m_isRunning;
+    portEXIT_CRITICAL(&m_lock);
+    writeOutput(output);
+    return isRunning;
+}
+
+TransitionEngine::TransitionEngine(const uint16_t tickMs) {
+    m_tickMs = tickMs;
+    m_lastTickTimeStamp = 0;
+}
+
+int32_t TransitionEngine::ease(const Easing easing, const int32_t progress) {
+    const int64_t p = progress;
+    switch (easing) {
+        case EASE_IN: return (p * p) >> 16;
+        case EASE_OUT: return (p * (2 * TRANSITION_ONE - p)) >> 16;
+        case EASE_IN_OUT: return (((p * p) >> 16) * (3 * TRANSITION_ONE - 2 * p)) >> 16;
+        default: return progress;
+    }
+}
+
+void TransitionEngine::attach(
+    ControlPublisher<int32_t>* publisher,
+    const uint16_t durationMs,
+    const Easing easing,
+    std::function<void(int32_t)> output
+) {
+    Channel* channel = new Channel(durationMs, easing, 1);
+    channel->readTarget = [publisher](int32_t* components) { components[0] = publisher->getValue(); };
+    channel->writeOutput = [output](const int32_t* components) { output(components[0]); };
+    m_channels.push_back(channel);
+    publisher->subscribe(channel);
+}
+
+void TransitionEngine::attach(
+    ControlPublisher<RgbColor>* publisher,
+    const uint16_t durationMs,
+    const Easing easing,
+    std::function<void(const RgbColor&)> output
+) {
+    Channel* channel = new Channel(durationMs, easing, 4);
+    channel->readTarget = [publisher](int32_t* components) {
+        const RgbColor& color = publisher->getValue();
+        components[0] = color.red;
+        components[1] = color.green;
+        components[2] = color.blue;
+        components[3] = color.white;
+    };
+    channel->writeOutput = [output](const int32_t* components) {
+        output({ (uint8_t) components[0], (uint8_t) components[1], (uint8_t) components[2], (uint8_t) components[3] });
+    };
+    m_channels.push_back(channel);
+    publisher->subscribe(channel);
+}
+
+void TransitionEngine::update() {
+    const uint32_t timeStamp = getClockSource()->getMillis();
+    if (timeStamp - m_lastTickTimeStamp < m_tickMs) return;
+    m_lastTickTimeStamp = timeStamp;
+    for (Channel* channel : m_channels) channel->step(timeStamp);
+}
+
+bool TransitionEngine::isRunning() {
+    for (Channel* channel : m_channels) {
+        if (channel->isRunning()) return true;
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+IntervalControl::IntervalControl(
+    const uint16_t checkDelaySeconds,
+    bool* isDeviceAuthorised,
+    std::function<void(bool)> onIntervalToggle
+){
+    m_checkDelaySeconds = checkDelaySeconds;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onIntervalToggle = onIntervalToggle;
+    m_revision = 0;
+    m_callback = [&](std::vector<char> intervals){
+         m_intervals = intervals;
+         m_revision++;
+         m_lastUpdateTimeStamp = getClockSource()->getMillis() - m_checkDelaySeconds * 1000;
+         update();
+    };
+}
+
+void IntervalControl::update() {
+    if (m_checkDelaySeconds != 0 && hasTimePassed(m_lastUpdateTimeStamp, m_checkDelaySeconds, true)) {
+        const int8_t state = getState();
+        if (m_onIntervalToggle != nullptr && state != -1) m_onIntervalToggle(state == 1);
+        m_lastUpdateTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+int8_t IntervalControl::getState() {
+    // A value that isn't a whole number of divisions of the day is ignored, it would index past the intervals
+    const size_t divisions = m_intervals.size();
+    if (divisions < DAY_HOURS || divisions > DAY_MINUTES || DAY_MINUTES % divisions != 0) return -1;
+    return m_intervals[getIntervalIndex(getClockSource()->getEpoch(), divisions)] == 1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+CalendarControl::CalendarControl(
+    const CalendarType calendarType,
+    const uint32_t initialSelection,
+    bool* isDeviceAuthorised
+){
+    for (size_t index = 0; index < sizeof(initialSelection) * 8; index++) m_selection.push_back((initialSelection >> index) & 1);
+    m_calendarType = calendarType;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_revision = 0;
+    m_callback = [&](std::vector<char> selection) {
+        m_selection = selection;
+        m_revision++;
+    };
+}
+
+bool CalendarControl::matches(const struct tm& date) {
+    size_t index = 0;
+    switch (m_calendarType) {
+        case DAYS_OF_WEEK: index = date.tm_wday; break;
+        case DAYS_OF_MONTH: index = date.tm_mday - 1; break;
+        case MONTHS_OF_YEAR: index = date.tm_mon; break;
+    }
+    return index < m_selection.size() && m_selection[index] == 1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+ScheduleControl::ScheduleControl(
+    const uint16_t checkDelaySeconds,
+    std::function<void(bool)> onScheduleToggle
+){
+    m_checkDelaySeconds = checkDelaySeconds;
+    m_onScheduleToggle = onScheduleToggle;
+    m_isCompiled = false;
+    m_lastState = -1;
+    m_lastUpdateTimeStamp = 0;
+}
+
+void ScheduleControl::addRule(IntervalControl* interval, std::vector<CalendarControl*> calendars) {
+    if (interval == nullptr) return;
+    m_rules.push_back({ interval, calendars });
+    m_isCompiled = false;
+}
+
+uint32_t ScheduleControl::getRulesRevision() {
+    uint32_t revision = 0;
+    for (ScheduleRule& rule : m_rules) {
+        revision += rule.interval->getRevision();
+        for (CalendarControl* calendar : rule.calendars) revision += calendar->getRevision();
+    }
+    return revision;
+}
+
+void ScheduleControl::compile(const uint32_t epoch) {
+    const time_t dayStart = epoch - epoch % DAY_SECONDS;
+    struct tm date;
+    gmtime_r(&dayStart, &date);
+
+    std::vector<ScheduleRule*> activeRules;
+    std::vector<uint32_t> boundaries = { 0 };
+    for (ScheduleRule& rule : m_rules) {
+        // Only the interval lengths of the control (whole minutes that divide the day) give boundaries on whole seconds
+        const size_t divisions = rule.interval->getIntervals().size();
+        if (divisions < DAY_HOURS || divisions > DAY_MINUTES || DAY_MINUTES % divisions != 0) continue;
+        bool isRuleActive = true;
+        for (CalendarControl* calendar : rule.calendars) isRuleActive = isRuleActive && calendar->matches(date);
+        if (!isRuleActive) continue;
+        activeRules.push_back(&rule);
+        for (size_t division = 1; division < divisions; division++) boundaries.push_back(division * (DAY_SECONDS / divisions));
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+    m_transitions.clear();
+    for (uint32_t boundary : boundaries) {
+        bool isOn = false;
+        for (ScheduleRule* rule : activeRules) {
+            const std::vector<char>& intervals = rule->interval->getIntervals();
+            const size_t division = std::min((size_t) boundary / (DAY_SECONDS / intervals.size()), intervals.size() - 1);
+            isOn = isOn || intervals[division] == 1;
+        }
+        if (m_transitions.empty() || m_transitions.back().isOn != isOn) m_transitions.push_back({ boundary, isOn });
+    }
+
+    m_compiledDay = epoch / DAY_SECONDS;
+    m_compiledRevision = getRulesRevision();
+    m_isCompiled = true;
+}
+
+uint32_t ScheduleControl::getNextTransition() {
+    const uint32_t epoch = getClockSource()->getEpoch();
+    if (!m_isCompiled || m_compiledDay != epoch / DAY_SECONDS || m_compiledRevision != getRulesRevision()) compile(epoch);
+    const uint32_t daySecond = epoch % DAY_SECONDS;
+    std::vector<Transition>::iterator next = std::upper_bound(
+        m_transitions.begin(), m_transitions.end(), daySecond,
+        [](const uint32_t second, const Transition& transition) { return second < transition.daySecond; }
+    );
+    const uint32_t dayStart = epoch - daySecond;
+    return (next != m_transitions.end()) ? dayStart + next->daySecond : dayStart + DAY_SECONDS;
+}
+
+void ScheduleControl::update() {
+    if (m_checkDelaySeconds != 0 && hasTimePassed(m_lastUpdateTimeStamp, m_checkDelaySeconds, true)) {
+        const bool isOn = getState();
+        if (m_onScheduleToggle != nullptr && m_lastState != isOn) m_onScheduleToggle(isOn);
+        m_lastState = isOn;
+        m_lastUpdateTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+bool ScheduleControl::getState() {
+    const uint32_t epoch = getClockSource()->getEpoch();
+    if (!m_isCompiled || m_compiledDay != epoch / DAY_SECONDS || m_compiledRevision != getRulesRevision()) compile(epoch);
+    std::vector<Transition>::iterator next = std::upper_bound(
+        m_transitions.begin(), m_transitions.end(), epoch % DAY_SECONDS,
+        [](const uint32_t second, const Transition& transition) { return second < transition.daySecond; }
+    );
+    return (next - 1)->isOn;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+ClockControl::ClockControl(
+    uint32_t initialValue,
+    const uint16_t notifyDelaySeconds,
+    bool* isDeviceAuthorised,
+    std::function<void(uint32_t)> onTimeSet
+){
+    m_notifyDelaySeconds = notifyDelaySeconds;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onTimeSet = onTimeSet;
+    m_lastOffset = 0;
+    m_driftPpb = 0;
+    m_driftOffsetMillis = 0;
+    m_driftCorrection = 0;
+    m_driftBaseTimeStamp = 0;
+    m_driftTimeStamp = 0;
+    m_syncCount = 0;
+    m_hasDriftBase = false;
+    m_hasDrift = false;
+    m_callback = [&](std::string_view value) { 
+        const uint8_t* bytes = (const uint8_t*) value.data();
+        uint64_t appMillis;
+        uint16_t roundTripMillis;
+        uint32_t time;
+        if (value.length() == CLOCK_SYNC_SIZE
+            && decodeValue(bytes, value.length(), appMillis)
+            && decodeValue(bytes + sizeof(uint64_t), value.length() - sizeof(uint64_t), roundTripMillis)) {
+            // The write reached the device about half a round trip after the app took the time
+            synchronize(appMillis + roundTripMillis / 2);
+        } else if (value.length() == sizeof(uint32_t) && decodeValue(bytes, value.length(), time)) {
+            getClockSource()->setEpoch(time);
+            if (m_onTimeSet != nullptr) m_onTimeSet(time);
+        } else {
+            return;
+        }
+        // The drift is corrected in the loop, the write only shows the new time
+        setCharacteristicValue(m_bleCharacteristic, getClockSource()->getEpoch());
+    };
+    getClockSource()->setEpoch(initialValue);
+}
+
+void ClockControl::synchronize(const uint64_t referenceMillis) {
+    ClockSource* clock = getClockSource();
+    const uint32_t now = clock->getMillis();
+    const int64_t offset = (int64_t) (referenceMillis - clock->getEpochTime());
+    const bool shouldStep = offset > CLOCK_STEP_THRESHOLD_MS || offset < -CLOCK_STEP_THRESHOLD_MS;
+    if (shouldStep) clock->setEpoch(referenceMillis / 1000, referenceMillis % 1000);
+    else clock->slewEpoch(offset);
+
+    portENTER_CRITICAL(&m_lock);
+    m_lastOffset = (int32_t) std::min(std::max(offset, (int64_t) INT32_MIN), (int64_t) INT32_MAX);
+    m_syncCount++;
+    if (shouldStep || !m_hasDriftBase) {
+        // A stepped clock says nothing about the drift, it's measured again from here
+        m_hasDriftBase = true;
+        m_driftBaseTimeStamp = now;
+        m_driftOffsetMillis = 0;
+    } else {
+        m_driftOffsetMillis += offset;
+        const uint32_t elapsed = now - m_driftBaseTimeStamp;
+        if (elapsed >= CLOCK_DRIFT_MIN_SECONDS * 1000UL) {
+            const int64_t maxDriftPpb = CLOCK_MAX_DRIFT_PPM * 1000LL;
+            const int64_t residualPpb = m_driftOffsetMillis * 1000000000LL / elapsed;
+            // The first estimate is taken as it is, the next ones only move it half way to smooth the link latency jitter
+            const int64_t driftPpb = m_driftPpb + (m_hasDrift ? residualPpb / 2 : residualPpb);
+            m_driftPpb = (int32_t) std::min(std::max(driftPpb, -maxDriftPpb), maxDriftPpb);
+            if (!m_hasDrift) m_driftTimeStamp = now;
+            m_hasDrift = true;
+            m_driftBaseTimeStamp = now;
+            m_driftOffsetMillis = 0;
+        }
+    }
+    portEXIT_CRITICAL(&m_lock);
+    if (m_onTimeSet != nullptr) m_onTimeSet(referenceMillis / 1000);
+}
+
+void ClockControl::correctDrift() {
+    portENTER_CRITICAL(&m_lock);
+    // Read inside the lock, a sync in between could move the drift time stamp past this time
+    const uint32_t now = getClockSource()->getMillis();
+    const int32_t elapsed = (int32_t) (now - m_driftTimeStamp);
+    if (!m_hasDrift || elapsed < CLOCK_DRIFT_PERIOD_MS) {
+        portEXIT_CRITICAL(&m_lock);
+        return;
+    }
+    m_driftCorrection += (int64_t) elapsed * m_driftPpb;
+    m_driftTimeStamp = now;
+    const int32_t slewMillis = m_driftCorrection / 1000000000LL;
+    m_driftCorrection -= slewMillis * 1000000000LL;
+    portEXIT_CRITICAL(&m_lock);
+    if (slewMillis != 0) getClockSource()->slewEpoch(slewMillis);
+}
+
+void ClockControl::update() {
+    correctDrift();
+    if (m_notifyDelaySeconds != 0 && hasTimePassed(m_lastUpdateTimeStamp, m_notifyDelaySeconds, true)) {
+      uint32_t timeValue = getClockSource()->getEpoch();
+      setCharacteristicValue(m_bleCharacteristic, timeValue);
+      if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+      m_lastUpdateTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+BooleanControl::BooleanControl(
+    ControlPublisher<std::string>* publisher,
+    bool* isDeviceAuthorised,
+    std::function<void(const std::string&)> onChange
+){
+    m_publisher = publisher;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onChange = onChange;
+    m_callback = [&](std::string_view value) {
+        if (m_publisher != nullptr) {
+            m_publisher->setValue(value, this);
+            if (m_onChange != nullptr) m_onChange(m_publisher->getValue());
+        } else if (m_onChange != nullptr) {
+            m_value = value;
+            m_onChange(m_value);
+        }
+    };
+}
+
+void BooleanControl::update() {
+    if (m_publisher != nullptr && m_bleCharacteristic != nullptr){
+        std::string_view currentValue = (m_publisher->getValue().length() > 0) ? std::string_view(m_publisher->getValue()) : "OFF";
+        setCharacteristicValue(m_bleCharacteristic, currentValue);
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+IntControl::IntControl(
+        ControlPublisher<int32_t>* publisher,
+        bool* isDeviceAuthorised,
+        std::function<void(int32_t)> onChange
+){
+    m_publisher = publisher;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onChange = onChange;
+    m_callback = [&](int32_t value) {
+        if (m_onChange != nullptr) m_onChange(value);
+        if (m_publisher != nullptr) m_publisher->setValue(value, this);
+    };
+}
+
+void IntControl::update() {
+    if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
+        int currentValue = m_publisher->getValue();
+        setCharacteristicValue(m_bleCharacteristic, currentValue);
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
 
 FloatControl::FloatControl(
         ControlPublisher<float_t>* publisher,
@@ -333,69 +1525,691 @@ FloatControl::FloatControl(
 void FloatControl::update() {
     if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
         float_t currentValue = m_publisher->getValue();
-        m_bleCharacteristic->setValue(currentValue);
-        if (*m_isDeviceAuthorised) m_bleCharacteristic->notify();
-        m_lastNotificationTimeStamp = millis();
+        setCharacteristicValue(m_bleCharacteristic, currentValue);
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
     }
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 
 StringControl::StringControl(
+        const uint16_t maxLength,
         ControlPublisher<std::string>* publisher,
         bool* isDeviceAuthorised,
-        std::function<void(std::string)> onChange
+        std::function<void(const std::string&)> onChange
 ){
     m_publisher = publisher;
     m_isDeviceAuthorised = isDeviceAuthorised;
     m_onChange = onChange;
-    m_callback = [&](std::string value) {
-        if (m_onChange != nullptr) m_onChange(value);
-        if (m_publisher != nullptr) m_publisher->setValue(value, this);
+    if (m_publisher != nullptr) m_publisher->reserve(maxLength);
+    else m_value.reserve(maxLength);
+    m_callback = [&](std::string_view value) {
+        if (m_publisher != nullptr) {
+            m_publisher->setValue(value, this);
+            if (m_onChange != nullptr) m_onChange(m_publisher->getValue());
+        } else if (m_onChange != nullptr) {
+            m_value = value;
+            m_onChange(m_value);
+        }
     };
 }
 
 void StringControl::update() {
     if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
-        std::string currentValue = m_publisher->getValue();
-        m_bleCharacteristic->setValue(currentValue);
-        if (*m_isDeviceAuthorised) m_bleCharacteristic->notify();
-        m_lastNotificationTimeStamp = millis();
+        setCharacteristicValue(m_bleCharacteristic, m_publisher->getValue());
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+const int8_t hexDigitValue(const char digit) {
+    if (digit >= '0' && digit <= '9') return digit - '0';
+    if (digit >= 'A' && digit <= 'F') return digit - 'A' + 0xA;
+    if (digit >= 'a' && digit <= 'f') return digit - 'a' + 0xA;
+    return -1;
+}
+
+bool ColorControl::parseColor(std::string_view hexValue, RgbColor& color) {
+    if (!hexValue.empty() && hexValue[0] == '#') hexValue.remove_prefix(1);
+    if (hexValue.length() != 6 && hexValue.length() != 8) return false;
+    uint8_t channels[4] = { 0, 0, 0, 0 };
+    for (size_t index = 0; index < hexValue.length(); index++) {
+        const int8_t digit = hexDigitValue(hexValue[index]);
+        if (digit < 0) return false;
+        channels[index / 2] = (channels[index / 2] << 4) | digit;
+    }
+    color = { channels[0], channels[1], channels[2], channels[3] };
+    return true;
+}
+
+size_t ColorControl::formatColor(const RgbColor& color, const bool isRgbw, char* hexValue) {
+    static const char digits[] = "0123456789ABCDEF";
+    const uint8_t channels[4] = { color.red, color.green, color.blue, color.white };
+    const size_t length = isRgbw ? 8 : 6;
+    for (size_t index = 0; index < length; index++) {
+        hexValue[index] = digits[(index % 2 == 0) ? channels[index / 2] >> 4 : channels[index / 2] & 0xF];
+    }
+    return length;
+}
+
+ColorControl::ColorControl(
+        const bool isRgbw,
+        ControlPublisher<RgbColor>* publisher,
+        bool* isDeviceAuthorised,
+        std::function<void(const RgbColor&)> onChange
+){
+    m_isRgbw = isRgbw;
+    m_publisher = publisher;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onChange = onChange;
+    m_callback = [&](std::string_view value) {
+        // The value was already checked by the validator of the callback
+        if (!parseColor(value, m_value)) return;
+        if (m_onChange != nullptr) m_onChange(m_value);
+        if (m_publisher != nullptr) m_publisher->setValue(m_value, this);
+    };
+}
+
+void ColorControl::update() {
+    if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
+        char hexValue[8];
+        setCharacteristicValue(m_bleCharacteristic, std::string_view(hexValue, formatColor(m_publisher->getValue(), m_isRgbw, hexValue)));
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+XYControl::XYControl(
+        const int16_t maxX,
+        const int16_t maxY,
+        const uint16_t releaseMillis,
+        ControlPublisher<XYPosition>* publisher,
+        bool* isDeviceAuthorised,
+        std::function<void(const XYPosition&)> onChange
+){
+    m_bleCharacteristic = nullptr;
+    m_publisher = publisher;
+    m_value = { 0, 0 };
+    m_maxX = std::max(maxX, (int16_t) 1);
+    m_maxY = std::max(maxY, (int16_t) 1);
+    m_releaseMillis = releaseMillis;
+    m_lastWriteTimeStamp = 0;
+    m_stateLock = xSemaphoreCreateMutex();
+    m_isHeld = false;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onChange = onChange;
+    m_callback = [&](int32_t value) {
+        const XYPosition position = XYPosition::fromPacked(value);
+        xSemaphoreTake(m_stateLock, portMAX_DELAY);
+        m_lastWriteTimeStamp = getClockSource()->getMillis();
+        m_isHeld = !position.isCentered();
+        setPosition({
+            std::min(std::max(position.x, (int16_t) -m_maxX), m_maxX),
+            std::min(std::max(position.y, (int16_t) -m_maxY), m_maxY)
+        });
+        xSemaphoreGive(m_stateLock);
+    };
+}
+
+XYPosition XYControl::getValue() {
+    xSemaphoreTake(m_stateLock, portMAX_DELAY);
+    const XYPosition value = m_value;
+    xSemaphoreGive(m_stateLock);
+    return value;
+}
+
+void XYControl::setPosition(const XYPosition& position) {
+    m_value = position;
+    if (m_onChange != nullptr) m_onChange(m_value);
+    if (m_publisher != nullptr) m_publisher->setValue(m_value, this);
+}
+
+void XYControl::update() {
+    if (m_publisher != nullptr && m_bleCharacteristic != nullptr) {
+        setCharacteristicValue(m_bleCharacteristic, (int32_t) m_publisher->getValue().toPacked());
+        if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+    }
+}
+
+void XYControl::checkRelease() {
+    if (m_releaseMillis == 0 || !m_isHeld) return;
+    xSemaphoreTake(m_stateLock, portMAX_DELAY);
+    // A write may have arrived since the check above, so the time is checked again with the lock held
+    const bool shouldRelease = m_isHeld && getClockSource()->getMillis() - m_lastWriteTimeStamp >= m_releaseMillis;
+    if (shouldRelease) {
+        m_isHeld = false;
+        setPosition({ 0, 0 });
+    }
+    xSemaphoreGive(m_stateLock);
+    if (!shouldRelease) return;
+    // The app wrote the last position itself, so the centred one is sent back to it
+    if (m_publisher != nullptr) update();
+    else if (m_bleCharacteristic != nullptr) setCharacteristicValue(m_bleCharacteristic, (int32_t) 0);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+HistoryControl::HistoryControl(
+    const std::string preferencesKey,
+    const uint16_t capacity,
+    const uint16_t sampleSeconds,
+    ControlPublisher<int32_t>* publisher,
+    const bool shouldPersist,
+    bool* isDeviceAuthorised
+) : m_history(capacity, sampleSeconds) {
+    m_bleCharacteristic = nullptr;
+    m_publisher = publisher;
+    m_preferencesKey = preferencesKey;
+    m_sampleSeconds = sampleSeconds > 0 ? sampleSeconds : 1;
+    m_lastSampleTimeStamp = 0;
+    m_hasSample = false;
+    m_shouldPersist = shouldPersist;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    if (m_shouldPersist) {
+        Preferences m_preferences;
+        m_preferences.begin(PREFERENCES_ID, true);
+        const size_t length = m_preferences.getBytesLength(m_preferencesKey.c_str());
+        if (length > 0) {
+            std::vector<uint8_t> data(length);
+            m_preferences.getBytes(m_preferencesKey.c_str(), data.data(), length);
+            m_history.deserialize(data.data(), length);
+        }
+        m_preferences.end();
+    }
+}
+
+void HistoryControl::setCharacteristic(BLECharacteristic* bleCharacteristic) {
+    m_bleCharacteristic = bleCharacteristic;
+    if (m_publisher != nullptr) m_publisher->subscribe(this);
+}
+
+void HistoryControl::update() {
+    if (m_publisher == nullptr) return;
+    if (m_hasSample && !hasTimePassed(m_lastSampleTimeStamp, m_sampleSeconds)) return;
+    addSample(m_publisher->getValue());
+}
+
+void HistoryControl::addSample(const int32_t value) {
+    m_history.add(getClockSource()->getEpoch(), value);
+    m_lastSampleTimeStamp = getClockSource()->getMillis();
+    m_hasSample = true;
+    if (m_shouldPersist && m_history.getNextSequence() % HISTORY_PERSIST_SAMPLES == 0) {
+        xTaskCreate(saveHistoryTask, "saveHistory", 4096, (void *) this, 10, NULL);
+    }
+}
+
+void HistoryControl::saveHistoryTask(void* params) {
+    HistoryControl* control = (HistoryControl*) params;
+    const std::vector<uint8_t> data = control->m_history.serialize();
+    Preferences m_preferences;
+    m_preferences.begin(PREFERENCES_ID, false);
+    m_preferences.putBytes(control->m_preferencesKey.c_str(), data.data(), data.size());
+    m_preferences.end();
+    vTaskDelete(NULL);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+OtaControl::OtaControl(
+    FirmwareSink* sink,
+    const uint16_t windowChunks,
+    const bool restartWhenDone,
+    bool* isDeviceAuthorised,
+    std::function<void(OtaStatus)> onStatusChanged,
+    TrafficRecorder** recorder
+) {
+    m_bleCharacteristic = nullptr;
+    m_sink = sink;
+    m_ppRecorder = recorder;
+    m_windowChunks = windowChunks > 0 ? windowChunks : 1;
+    m_restartWhenDone = restartWhenDone;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+    m_onStatusChanged = onStatusChanged;
+    m_status = OTA_IDLE;
+    m_imageSize = 0;
+    m_imageCrc = 0;
+    m_receivedBytes = 0;
+    m_crc = 0;
+    m_acksCount = 0;
+    m_doneTimeStamp = 0;
+    m_nextSequence = 0;
+    m_chunksSinceAck = 0;
+}
+
+void OtaControl::setCharacteristic(BLECharacteristic* bleCharacteristic) {
+    m_bleCharacteristic = bleCharacteristic;
+    // The data chunks would fill the recorder in a moment, only the commands around them are recorded
+    m_bleCharacteristic->setCallbacks(new WriteCallback(
+        [this](const uint8_t* data, size_t length) { onMessage(data, length); }, m_isDeviceAuthorised, m_ppRecorder,
+        [](const uint8_t* data, size_t length) { return length == 0 || data[0] != OTA_DATA; }
+    ));
+}
+
+void OtaControl::update() {
+    if (m_status == OTA_DONE && m_restartWhenDone && getClockSource()->getMillis() - m_doneTimeStamp >= OTA_RESTART_DELAY_MS) esp_restart();
+}
+
+void OtaControl::onMessage(const uint8_t* data, const size_t length) {
+    if (length == 0) return;
+    switch (data[0]) {
+        case OTA_START: {
+            uint32_t imageSize = 0;
+            uint32_t imageCrc = 0;
+            if (!decodeValue(data + 1, length - 1, imageSize) || !decodeValue(data + 5, length - 5, imageCrc)) return;
+            start(imageSize, imageCrc);
+            break;
+        }
+        case OTA_DATA: {
+            uint16_t sequence = 0;
+            if (!decodeValue(data + 1, length - 1, sequence)) return;
+            writeChunk(sequence, data + 3, length - 3);
+            break;
+        }
+        case OTA_END:
+            finish(data + 1, length - 1);
+            break;
+        case OTA_ABORT:
+            if (isTransferring()) m_sink->abort();
+            m_status = OTA_IDLE;
+            acknowledge(OTA_IDLE);
+            if (m_onStatusChanged != nullptr) m_onStatusChanged(OTA_IDLE);
+            break;
+    }
+}
+
+void OtaControl::start(const uint32_t imageSize, const uint32_t imageCrc) {
+    if (isTransferring()) m_sink->abort();
+    m_imageSize = imageSize;
+    m_imageCrc = imageCrc;
+    m_receivedBytes = 0;
+    m_crc = 0;
+    m_nextSequence = 0;
+    m_chunksSinceAck = 0;
+    if (imageSize == 0 || !m_sink->begin(imageSize)) return fail(OTA_WRITE_ERROR);
+    m_status = OTA_READY;
+    acknowledge(OTA_READY);
+    if (m_onStatusChanged != nullptr) m_onStatusChanged(OTA_READY);
+}
+
+void OtaControl::writeChunk(const uint16_t sequence, const uint8_t* data, const size_t length) {
+    if (!isTransferring()) return;
+    if (sequence != m_nextSequence) {
+        // The chunks already written (sent again after a lost ack) are ignored, a gap is reported once
+        const bool isDuplicate = (uint16_t) (m_nextSequence - sequence) <= m_windowChunks;
+        if (!isDuplicate && m_status != OTA_OUT_OF_SEQUENCE) {
+            m_status = OTA_OUT_OF_SEQUENCE;
+            acknowledge(OTA_OUT_OF_SEQUENCE);
+        }
+        return;
+    }
+    if (m_receivedBytes + length > m_imageSize) return fail(OTA_SIZE_ERROR);
+    if (!m_sink->write(data, length)) return fail(OTA_WRITE_ERROR);
+    m_crc = updateCrc32(m_crc, data, length);
+    m_receivedBytes += length;
+    m_nextSequence++;
+    m_chunksSinceAck++;
+    m_status = OTA_WINDOW_ACK;
+    if (m_chunksSinceAck >= m_windowChunks || m_receivedBytes == m_imageSize) acknowledge(OTA_WINDOW_ACK);
+}
+
+void OtaControl::finish(const uint8_t* signature, const size_t length) {
+    if (!isTransferring()) return;
+    if (m_receivedBytes != m_imageSize) return fail(OTA_SIZE_ERROR);
+    if (m_crc != m_imageCrc) return fail(OTA_CRC_ERROR);
+    if (!m_sink->verify(signature, length)) return fail(OTA_SIGNATURE_ERROR);
+    if (!m_sink->end()) return fail(OTA_WRITE_ERROR);
+    m_status = OTA_DONE;
+    m_doneTimeStamp = getClockSource()->getMillis();
+    acknowledge(OTA_DONE);
+    if (m_onStatusChanged != nullptr) m_onStatusChanged(OTA_DONE);
+}
+
+void OtaControl::fail(const OtaStatus status) {
+    if (isTransferring()) m_sink->abort();
+    m_status = status;
+    acknowledge(status);
+    if (m_onStatusChanged != nullptr) m_onStatusChanged(status);
+}
+
+void OtaControl::acknowledge(const OtaStatus status) {
+    // Ack layout : status (uint8), next expected sequence (uint16), bytes written (uint32), CRC-32 of the written bytes (uint32)
+    uint8_t ack[1 + sizeof(uint16_t) + 2 * sizeof(uint32_t)];
+    ack[0] = status;
+    size_t ackSize = 1;
+    ackSize += encodeValue(m_nextSequence, ack + ackSize, sizeof(ack) - ackSize);
+    ackSize += encodeValue(m_receivedBytes, ack + ackSize, sizeof(ack) - ackSize);
+    ackSize += encodeValue(m_crc, ack + ackSize, sizeof(ack) - ackSize);
+    m_chunksSinceAck = 0;
+    m_acksCount++;
+    if (m_bleCharacteristic == nullptr) return;
+    m_bleCharacteristic->setValue(ack, ackSize);
+    if (*m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+MomentaryControl::MomentaryControl(
+    const bool isNC,
+    const uint16_t holdMillis,
+    bool* isDeviceAuthorised,
+    std::function<void(bool)> onChange,
+    TrafficRecorder** recorder
+) {
+    m_bleCharacteristic = nullptr;
+    m_onChange = onChange;
+    m_stateLock = xSemaphoreCreateMutex();
+    m_ppRecorder = recorder;
+    m_pressTimeStamp = 0;
+    m_refreshTimeStamp = 0;
+    m_forcedReleases = 0;
+    m_holdMillis = holdMillis;
+    m_isNC = isNC;
+    m_isPressed = false;
+    m_isDeviceAuthorised = isDeviceAuthorised;
+}
+
+void MomentaryControl::setCharacteristic(BLECharacteristic* bleCharacteristic) {
+    m_bleCharacteristic = bleCharacteristic;
+    uint8_t released = 0;
+    m_bleCharacteristic->setValue(&released, 1);
+    m_bleCharacteristic->setCallbacks(new WriteCallback([this](const uint8_t* data, size_t length) { onWrite(data, length); }, m_isDeviceAuthorised, m_ppRecorder));
+}
+
+void MomentaryControl::onWrite(const uint8_t* data, const size_t length) {
+    const uint32_t receivedMicros = micros();
+    if (length != 1) return;
+    const bool isPressed = data[0] != 0;
+    xSemaphoreTake(m_stateLock, portMAX_DELAY);
+    // A refresh of the held button only restarts the watchdog
+    if (isPressed) m_refreshTimeStamp = getClockSource()->getMillis();
+    const bool hasChanged = isPressed != m_isPressed;
+    m_isPressed = isPressed;
+    if (hasChanged && isPressed) m_pressTimeStamp = receivedMicros;
+    if (hasChanged && m_onChange != nullptr) m_onChange(isPressed != m_isNC);
+    xSemaphoreGive(m_stateLock);
+    if (hasChanged) m_callbackLatency.add(micros() - receivedMicros);
+}
+
+bool MomentaryControl::forceRelease(const bool onlyIfExpired) {
+    xSemaphoreTake(m_stateLock, portMAX_DELAY);
+    const bool shouldRelease = m_isPressed && (!onlyIfExpired || getClockSource()->getMillis() - m_refreshTimeStamp >= m_holdMillis);
+    if (shouldRelease) {
+        m_isPressed = false;
+        m_forcedReleases++;
+        if (m_onChange != nullptr) m_onChange(m_isNC);
+    }
+    xSemaphoreGive(m_stateLock);
+    if (shouldRelease && m_bleCharacteristic != nullptr) {
+        uint8_t released = 0;
+        m_bleCharacteristic->setValue(&released, 1);
+    }
+    return shouldRelease;
+}
+
+void MomentaryControl::checkRelease() {
+    if (m_holdMillis == 0 || !m_isPressed) return;
+    // The link is still up, so the app is told that the button was released
+    if (forceRelease(true) && *m_isDeviceAuthorised) notifyValue(m_bleCharacteristic);
+}
+
+void MomentaryControl::release() {
+    forceRelease(false);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+BondTable::BondTable(const uint8_t capacity) {
+    m_transport = nullptr;
+    m_capacity = capacity;
+    m_useCounter = 0;
+}
+
+void BondTable::load() {
+    Preferences m_preferences;
+    m_preferences.begin(BONDS_PREFERENCES_ID, true);
+    size_t peersCount = m_preferences.getBytesLength("peers") / sizeof(BondedPeer);
+    m_peers.resize(peersCount);
+    if (peersCount > 0) m_preferences.getBytes("peers", m_peers.data(), peersCount * sizeof(BondedPeer));
+    m_useCounter = m_preferences.getUInt("counter", 0);
+    m_preferences.end();
+    for (size_t index = m_peers.size(); index > 0; index--) {
+        if (!m_transport->isBonded(m_peers[index - 1].address)) m_peers.erase(m_peers.begin() + index - 1);
+    }
+}
+
+void BondTable::save() {
+    Preferences m_preferences;
+    m_preferences.begin(BONDS_PREFERENCES_ID, false);
+    m_preferences.putBytes("peers", m_peers.data(), m_peers.size() * sizeof(BondedPeer));
+    m_preferences.putUInt("counter", m_useCounter);
+    m_preferences.end();
+}
+
+bool BondTable::contains(const uint8_t* address) {
+    for (BondedPeer& peer : m_peers) {
+        if (memcmp(peer.address, address, sizeof(BleAddress)) == 0) return true;
+    }
+    return false;
+}
+
+void BondTable::touch(const uint8_t* address) {
+    for (BondedPeer& peer : m_peers) {
+        if (memcmp(peer.address, address, sizeof(BleAddress)) == 0) {
+            // The most recently used peer reconnecting doesn't change the order, so the flash isn't written
+            if (peer.lastUsed == m_useCounter) return;
+            peer.lastUsed = ++m_useCounter;
+            save();
+            return;
+        }
+    }
+    m_useCounter++;
+    if (m_peers.size() >= m_capacity) {
+        std::vector<BondedPeer>::iterator leastUsed = m_peers.begin();
+        for (std::vector<BondedPeer>::iterator peer = m_peers.begin(); peer != m_peers.end(); peer++) {
+            if (peer->lastUsed < leastUsed->lastUsed) leastUsed = peer;
+        }
+        m_transport->removeBond(leastUsed->address);
+        m_peers.erase(leastUsed);
+    }
+    // The table is saved as raw bytes, so the padding is zeroed too
+    BondedPeer newPeer;
+    memset(&newPeer, 0, sizeof(BondedPeer));
+    memcpy(newPeer.address, address, sizeof(BleAddress));
+    newPeer.lastUsed = m_useCounter;
+    m_peers.push_back(newPeer);
+    save();
+}
+
+void BondTable::remove(const uint8_t* address) {
+    for (std::vector<BondedPeer>::iterator peer = m_peers.begin(); peer != m_peers.end(); peer++) {
+        if (memcmp(peer->address, address, sizeof(BleAddress)) == 0) {
+            m_peers.erase(peer);
+            break;
+        }
     }
+    m_transport->removeBond(address);
+    save();
+}
+
+void BondTable::clear(const uint8_t* keptAddress) {
+    if (keptAddress == nullptr) {
+        m_transport->removeAllBonds();
+        m_peers.clear();
+        m_useCounter = 0;
+        Preferences m_preferences;
+        m_preferences.begin(BONDS_PREFERENCES_ID, false);
+        m_preferences.clear();
+        m_preferences.end();
+        return;
+    }
+    for (size_t index = m_peers.size(); index > 0; index--) {
+        if (memcmp(m_peers[index - 1].address, keptAddress, sizeof(BleAddress)) == 0) continue;
+        m_transport->removeBond(m_peers[index - 1].address);
+        m_peers.erase(m_peers.begin() + index - 1);
+    }
+    save();
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 
-EspBleControlsFactory::EspBleControlsFactory(const std::string deviceName, const uint32_t passkey) {
+EspBleControlsFactory::EspBleControlsFactory(const std::string deviceName, const uint32_t passkey, BleTransport* transport) {
 
     m_isDeviceConnected = false;
     m_isDeviceAuthorised = false;
+    m_shouldAdvertise = false;
     m_pin = passkey;
-
-    BLEDevice::init(deviceName);
+    m_authTimeoutSeconds = PAIRING_TIMEOUT_SECONDS;
+    m_readvertiseDelayMs = READVERTISE_DELAY_MS;
+    m_pairingState = DISCONNECTED;
+    m_pairingStats = {};
+    m_isBondedPeer = false;
+    m_isCreatingBatch = false;
+    m_resetMode = HARD_RESET;
+    m_pendingReset = NO_RESET;
+    m_trafficRecorder = nullptr;
+    m_replaySequence = 0;
+    m_replayEndSequence = 0;
+    m_transportStats = {};
+    m_pairingEvents = xQueueCreate(PAIRING_EVENTS_QUEUE_SIZE, sizeof(PairingEvent));
+
+#if defined(ESP_BLE_CONTROLS_NIMBLE)
+    m_transport = (transport != nullptr) ? transport : new NimBleTransport();
+#elif defined(ESP_BLE_CONTROLS_MOCK)
+    m_transport = (transport != nullptr) ? transport : new MockTransport();
+#else
+    m_transport = (transport != nullptr) ? transport : new BluedroidTransport();
+#endif
+    const uint32_t freeHeap = ESP.getFreeHeap();
+    const uint32_t startTimeStamp = micros();
+    m_transport->begin(deviceName, m_pin, this);
+    m_transportStats.startupMicros = micros() - startTimeStamp;
+    m_transportStats.stackHeapBytes = freeHeap - ESP.getFreeHeap();
+    m_notifier.setTransport(m_transport);
+    m_bondTable.setTransport(m_transport);
 
     if (m_pin == 0) {
         m_isDeviceAuthorised = true;
     } else {
-        BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);
-        BLESecurityCallbacks* secCallback = new SecurityCallback(
-            [&](bool isDeviceAuthorised) -> void { 
-                m_isDeviceAuthorised = isDeviceAuthorised; 
-                if (!isDeviceAuthorised) m_pServer->removePeerDevice(m_pServer->getConnId(), true);
-            }
-        );
-        BLEDevice::setSecurityCallbacks(secCallback);
+        m_bondTable.load();
     }
+}
 
-    m_pServer = BLEDevice::createServer();
-    BLEServerCallbacks* serverCallback = new ServerCallback(
-        [&](bool isDeviceConnected) -> void { 
-            m_isDeviceConnected = isDeviceConnected;
-            if (!isDeviceConnected) m_isDeviceAuthorised = false;
+void EspBleControlsFactory::onConnection(const bool isConnected, const uint8_t* address) {
+    if (!isConnected) {
+        m_notifier.clear();
+        // The app numbers the writes of each connection from scratch
+        resetSequences();
+        for (MomentaryControl* button : m_momentaryControls) button->release();
+    }
+    postPairingEvent(isConnected ? DEVICE_CONNECTED : DEVICE_DISCONNECTED, 0, address);
+}
+
+void EspBleControlsFactory::onAuthentication(const bool isSuccessful, const uint8_t failReason, const uint8_t* address) {
+    // processPairingEvents() decides, a pairing that was already rejected or timed out must not authorise the peer
+    postPairingEvent(isSuccessful ? AUTH_SUCCEEDED : AUTH_FAILED, failReason, address);
+}
+
+void EspBleControlsFactory::onNotificationConfirmed(const uint16_t handle, const bool isSuccessful) {
+    m_notifier.onConfirmed(handle, isSuccessful);
+}
+
+void EspBleControlsFactory::onCongestion(const bool isCongested) {
+    m_notifier.onCongestion(isCongested);
+}
+
+void EspBleControlsFactory::setPairingTimeouts(const uint16_t authTimeoutSeconds, const uint16_t readvertiseDelayMs) {
+    m_authTimeoutSeconds = authTimeoutSeconds;
+    m_readvertiseDelayMs = readvertiseDelayMs;
+}
+
+void EspBleControlsFactory::postPairingEvent(PairingEventType type, uint8_t reason, const uint8_t* address) {
+    PairingEvent event = { type, reason, getClockSource()->getMillis() };
+    if (address != nullptr) memcpy(event.address, address, sizeof(BleAddress));
+    xQueueSend(m_pairingEvents, &event, 0);
+    if (m_trafficRecorder != nullptr) {
+        if (type == DEVICE_CONNECTED) m_trafficRecorder->record(CONNECT_EVENT, 0, address, sizeof(BleAddress));
+        if (type == DEVICE_DISCONNECTED) m_trafficRecorder->record(DISCONNECT_EVENT, 0, nullptr, 0);
+        if (type == AUTH_SUCCEEDED || type == AUTH_FAILED) {
+            const uint8_t authResult[] = { type == AUTH_SUCCEEDED, reason };
+            m_trafficRecorder->record(AUTH_EVENT, 0, authResult, sizeof(authResult));
         }
-    );
-    m_pServer->setCallbacks(serverCallback);
-    m_pService = m_pServer->createService(BLEUUID(SERVICE_UUID), 127U, 0);
+    }
+}
+
+void EspBleControlsFactory::onPairingFailed(PairingFailure failure, uint8_t reason, uint32_t timeStamp) {
+    m_pairingStats.failures++;
+    m_pairingStats.lastFailure = failure;
+    m_pairingStats.lastFailReason = reason;
+    m_pairingStats.lastDurationMs = timeStamp - m_pairingTimeStamp;
+    m_isDeviceAuthorised = false;
+    m_pairingState = REJECTED;
+}
+
+void EspBleControlsFactory::processPairingEvents() {
+    PairingEvent event;
+    while (xQueueReceive(m_pairingEvents, &event, 0) == pdTRUE) {
+        switch (event.type) {
+            case DEVICE_CONNECTED:
+                m_isDeviceConnected = true;
+                m_pairingTimeStamp = event.timeStamp;
+                memcpy(m_peerAddress, event.address, sizeof(BleAddress));
+                if (m_pin == 0) {
+                    m_isDeviceAuthorised = true;
+                    m_pairingState = AUTHORISED;
+                } else {
+                    // A known peer is asked to encrypt the link with its stored keys right away, without waiting for it to
+                    // hit an encrypted attribute first
+                    m_isBondedPeer = m_bondTable.contains(event.address) && m_transport->isBonded(event.address);
+                    if (m_isBondedPeer) m_transport->encryptLink(m_peerAddress);
+                    else m_pairingStats.attempts++;
+                    if (m_pairingState != AUTHORISED) m_pairingState = AWAITING_AUTH;
+                }
+                break;
+            case AUTH_SUCCEEDED:
+                // A pairing that completes after it was rejected, timed out or the peer left is ignored
+                if (m_pairingState != AWAITING_AUTH && m_pairingState != AUTHORISED) break;
+                if (m_pairingState == AWAITING_AUTH) {
+                    if (m_isBondedPeer) {
+                        m_pairingStats.bondedReconnections++;
+                        m_pairingStats.lastReconnectionMs = event.timeStamp - m_pairingTimeStamp;
+                    } else {
+                        m_pairingStats.successes++;
+                        m_pairingStats.lastDurationMs = event.timeStamp - m_pairingTimeStamp;
+                    }
+                }
+                m_bondTable.touch(event.address);
+                m_isDeviceAuthorised = true;
+                m_pairingState = AUTHORISED;
+                break;
+            case AUTH_FAILED:
+                onPairingFailed(AUTH_REJECTED, event.reason, event.timeStamp);
+                // The peer lost its keys, forget the bond so the next connection goes through a fresh pairing
+                if (m_isBondedPeer) m_bondTable.remove(event.address);
+                m_transport->disconnect();
+                break;
+            case DEVICE_DISCONNECTED:
+                if (m_pairingState == AWAITING_AUTH) onPairingFailed(LINK_LOST, 0, event.timeStamp);
+                m_isDeviceConnected = false;
+                m_isDeviceAuthorised = false;
+                m_pairingState = DISCONNECTED;
+                m_shouldAdvertise = true;
+                m_disconnectionTimeStamp = event.timeStamp;
+                break;
+        }
+    }
+    if (m_pairingState == AWAITING_AUTH && (getClockSource()->getMillis() - m_pairingTimeStamp) >= m_authTimeoutSeconds * 1000UL) {
+        onPairingFailed(AUTH_TIMEOUT, 0, getClockSource()->getMillis());
+        m_transport->disconnect();
+    }
+    if (m_shouldAdvertise && (getClockSource()->getMillis() - m_disconnectionTimeStamp) >= m_readvertiseDelayMs) {
+        m_shouldAdvertise = false;
+        m_transport->startAdvertising();
+    }
 }
 
 const std::string EspBleControlsFactory::generateCharUuid(
@@ -405,6 +2219,7 @@ const std::string EspBleControlsFactory::generateCharUuid(
     const int16_t val3 = 0
 ) {
     uint16_t charCount = getCharCounterIndex(suffix) + 1;
+    if (NUMBERED_INSTANCES) m_charsCounter[suffix] = charCount;
     std::string uuid = CHAR_UUID_PREFIX;
     uuid.append("-").append(shortToHex(val1)).append("-").append(shortToHex(val2)).append("-").append(shortToHex(val3)).append("-");
     uuid.append(suffix).append(intToString(charCount, 2, 16));
@@ -428,11 +2243,17 @@ const boolean EspBleControlsFactory::doesCharCounterExists(const std::string cha
 
 void EspBleControlsFactory::createClearPrefsAndResetControl() {
     std::function<void(int32_t)> action = [&](int32_t shouldClear) {
+        if (m_resetMode == SOFT_RESET) {
+            if (shouldClear == 1) xTaskCreate(clearPreferencesTask, "clearValues", 4096, NULL, 10, NULL);
+            m_pendingReset = (shouldClear == 1) ? RESTORE_INITIAL_VALUES : RESTORE_SAVED_VALUES;
+            return;
+        }
         if (shouldClear == 1) {
             Preferences m_preferences;
             m_preferences.begin(PREFERENCES_ID, false);
             m_preferences.clear();
             m_preferences.end();
+            m_bondTable.clear();
         }
         delay(1000);
         esp_restart();
@@ -441,73 +2262,241 @@ void EspBleControlsFactory::createClearPrefsAndResetControl() {
     createCharacteristic(generateCharUuid(CLRPF_UUID_SUFFIX), "Clear values", 0, false, callback);
 }
 
+void EspBleControlsFactory::clearPreferencesTask(void* params) {
+    Preferences m_preferences;
+    m_preferences.begin(PREFERENCES_ID, false);
+    m_preferences.clear();
+    m_preferences.end();
+    vTaskDelete(NULL);
+}
+
+void EspBleControlsFactory::softReset(const PendingReset pendingReset) {
+    // The bonds are cleared here, in the loop task that processes the pairing events, keeping the peer connected now
+    if (pendingReset == RESTORE_INITIAL_VALUES) m_bondTable.clear(m_isDeviceConnected ? m_peerAddress : nullptr);
+    for (ControlEntry& entry : m_controlEntries) {
+        const std::string controlId = getCharParamValue(entry.uuid, CHARID);
+        if (controlId == CLOCK_UUID_SUFFIX || controlId == CLRPF_UUID_SUFFIX) continue;
+        // A value still waiting to be saved would be saved over the cleared or restored one
+        if (entry.callback != nullptr) entry.callback->cancelPendingSave();
+        if (pendingReset == RESTORE_INITIAL_VALUES) entry.resetValue();
+        else restoreValue(entry.characteristic, entry.uuid, entry.callback);
+        if (entry.shouldNotify && m_isDeviceAuthorised) m_notifier.notify(entry.characteristic);
+    }
+}
+
+void EspBleControlsFactory::enableTrafficRecorder(const uint16_t capacity, const bool exposeCharacteristic) {
+    if (m_trafficRecorder != nullptr) return;
+    m_trafficRecorder = new TrafficRecorder(capacity, m_transport);
+    for (ControlEntry& entry : m_controlEntries) {
+        if (entry.callback != nullptr) entry.callback->setRecorder(m_trafficRecorder);
+    }
+    if (exposeCharacteristic) {
+        BLECharacteristic* characteristic = m_transport->createCharacteristic(
+            generateCharUuid(TRFIC_UUID_SUFFIX, capacity), CHAR_READ | CHAR_WRITE, "Traffic records"
+        );
+        characteristic->setCallbacks(new TrafficDumpCallback(m_trafficRecorder, &m_isDeviceAuthorised));
+    }
+}
+
+void EspBleControlsFactory::replayTraffic(const uint16_t speedFactor) {
+    TrafficRecord firstRecord;
+    if (m_trafficRecorder == nullptr || !m_trafficRecorder->get(m_trafficRecorder->getFirstSequence(), firstRecord)) return;
+    m_replaySpeedFactor = speedFactor;
+    m_replaySequence = m_trafficRecorder->getFirstSequence();
+    m_replayEndSequence = m_trafficRecorder->getNextSequence();
+    m_replayFirstRecordTimeStamp = firstRecord.timeStamp;
+    m_replayStartTimeStamp = getClockSource()->getMillis();
+    // The writes the replay triggers (ex. the notifications) would overwrite the records that are still to be replayed
+    m_trafficRecorder->setPaused(true);
+    resetSequences();
+}
+
+void EspBleControlsFactory::replayNextWrites() {
+    TrafficRecord record;
+    while (m_replaySequence != m_replayEndSequence) {
+        if (!m_trafficRecorder->get(m_replaySequence, record)) {
+            m_replaySequence++;
+            continue;
+        }
+        const uint32_t recordDelay = record.timeStamp - m_replayFirstRecordTimeStamp;
+        if (m_replaySpeedFactor != 0 && (getClockSource()->getMillis() - m_replayStartTimeStamp) < recordDelay / m_replaySpeedFactor) return;
+        // A truncated payload isn't the value that was written, so it's skipped. The replayed values are never saved,
+        // a replay must not overwrite the values of the device.
+        if (record.type == WRITE_EVENT && record.length <= TRAFFIC_PAYLOAD_SIZE) {
+            for (ControlEntry& entry : m_controlEntries) {
+                if (m_transport->getHandle(entry.characteristic) != record.handle || entry.callback == nullptr) continue;
+                entry.characteristic->setValue(record.payload, record.length);
+                entry.callback->replayWrite(entry.characteristic);
+                break;
+            }
+        }
+        // The app numbered the writes of each recorded connection from scratch
+        if (record.type == DISCONNECT_EVENT) resetSequences();
+        m_replaySequence++;
+    }
+    m_trafficRecorder->setPaused(false);
+    resetSequences();
+}
+
+void EspBleControlsFactory::resetSequences() {
+    for (const ControlEntry& entry : m_controlEntries) {
+        if (entry.callback != nullptr) entry.callback->resetSequence();
+    }
+}
+
+void EspBleControlsFactory::createTransactionControl(const std::string description) {
+    if (doesCharCounterExists(TRANS_UUID_SUFFIX)) return;
+    std::function<void(std::string_view)> action = [&](std::string_view batch) { applyTransaction(batch); };
+    CharacteristicCallback* callback = new CharacteristicCallback(action, &m_isDeviceAuthorised);
+    createCharacteristic(generateCharUuid(TRANS_UUID_SUFFIX), description, std::string(), false, callback);
+}
+
+ControlEntry* EspBleControlsFactory::findControlEntry(const uint8_t* controlId) {
+    // Without NUMBERED_INSTANCES the instances of a type share the count 01, an ID that matches more than one is ambiguous
+    ControlEntry* match = nullptr;
+    for (ControlEntry& entry : m_controlEntries) {
+        const std::string suffix = getCharParamValue(entry.uuid, SUFFIX);
+        bool isMatching = suffix.length() == TRANSACTION_ID_SIZE * 2;
+        for (size_t index = 0; isMatching && index < TRANSACTION_ID_SIZE; index++) {
+            const int8_t high = hexDigitValue(suffix[index * 2]);
+            const int8_t low = hexDigitValue(suffix[index * 2 + 1]);
+            isMatching = high >= 0 && low >= 0 && ((high << 4) | low) == controlId[index];
+        }
+        if (isMatching && match != nullptr) return nullptr;
+        if (isMatching) match = &entry;
+    }
+    return match;
+}
+
+void EspBleControlsFactory::applyTransaction(std::string_view batch) {
+    const uint8_t* data = (const uint8_t*) batch.data();
+    std::vector<ControlEntry*> entries;
+    std::vector<size_t> offsets;
+    size_t offset = 0;
+    while (offset < batch.length()) {
+        if (batch.length() - offset < TRANSACTION_ID_SIZE + 1) return;
+        const size_t valueLength = data[offset + TRANSACTION_ID_SIZE];
+        if (batch.length() - offset - TRANSACTION_ID_SIZE - 1 < valueLength) return;
+        ControlEntry* entry = findControlEntry(data + offset);
+        if (entry == nullptr || entry->callback == nullptr) return;
+        const std::string controlId = getCharParamValue(entry->uuid, CHARID);
+        if (controlId == TRANS_UUID_SUFFIX || controlId == CLRPF_UUID_SUFFIX || controlId == CLOCK_UUID_SUFFIX) return;
+        // All the values are checked before any callback runs, so a bad record leaves every control unchanged
+        const uint8_t* value = data + offset + TRANSACTION_ID_SIZE + 1;
+        if (!entry->callback->isValidValue(value, valueLength)) return;
+        if (entry->callback->getValueType() == VECTOR && valueLength != getCharacteristicValue(entry->characteristic).length()) return;
+        entries.push_back(entry);
+        offsets.push_back(offset + TRANSACTION_ID_SIZE + 1);
+        offset += TRANSACTION_ID_SIZE + 1 + valueLength;
+    }
+    if (entries.empty()) return;
+    m_notifier.hold();
+    for (size_t index = 0; index < entries.size(); index++) {
+        ControlEntry* entry = entries[index];
+        entry->characteristic->setValue((uint8_t*) data + offsets[index], data[offsets[index] - 1]);
+        entry->callback->executeCallback(entry->characteristic, false);
+        if (entry->shouldNotify && m_isDeviceAuthorised) m_notifier.notify(entry->characteristic);
+    }
+    m_notifier.release();
+    xTaskCreate(saveTransactionTask, "saveTransaction", 8192, (void *) new std::vector<ControlEntry*>(entries), 10, NULL);
+}
+
+void EspBleControlsFactory::saveTransactionTask(void* params) {
+    std::vector<ControlEntry*>* entries = (std::vector<ControlEntry*>*) params;
+    Preferences m_preferences;
+    m_preferences.begin(PREFERENCES_ID, false);
+    for (ControlEntry* entry : *entries) {
+        CharacteristicCallback::saveValue(m_preferences, entry->characteristic, entry->callback->getValueType());
+    }
+    m_preferences.end();
+    delete entries;
+    vTaskDelete(NULL);
+}
+
 void EspBleControlsFactory::startService() {
     createClearPrefsAndResetControl();
-    m_pService->start();
-    startAdvertising();
-    if (m_pin != 0) setBleSecurity();
+    m_transport->start();
+    m_transportStats.freeHeapBytes = ESP.getFreeHeap();
 }
 
 void EspBleControlsFactory::updateControls() {
+    for (ScheduleControl* schedule : m_schedules) schedule->update();
+    for (TransitionEngine* transitionEngine : m_transitionEngines) transitionEngine->update();
+    for (XYControl* pad : m_releasingPads) pad->checkRelease();
+    for (MomentaryControl* button : m_momentaryControls) button->checkRelease();
+    processPairingEvents();
+    if (isReplayingTraffic()) replayNextWrites();
+    if (m_pendingReset != NO_RESET) {
+        PendingReset pendingReset = m_pendingReset;
+        m_pendingReset = NO_RESET;
+        softReset(pendingReset);
+    }
     if (m_selfUpdatingControls.size() > 0) {
         for (BLEControl* control : m_selfUpdatingControls) control->update();
     }
+    savePendingValues(false);
+    m_notifier.send();
 }
 
-void EspBleControlsFactory::setBleSecurity() {
-    esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_MITM_BOND;
-    esp_ble_io_cap_t iocap = ESP_IO_CAP_OUT;
-    uint8_t key_size = 16;
-    uint8_t init_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
-    uint8_t rsp_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
-    uint8_t auth_option = ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE;
-    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_STATIC_PASSKEY, &m_pin, sizeof(uint32_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(uint8_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(uint8_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH, &auth_option, sizeof(uint8_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(uint8_t));
-    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
+void EspBleControlsFactory::savePendingValues(const bool isForced) {
+    for (ControlEntry& entry : m_controlEntries) {
+        if (entry.callback != nullptr) entry.callback->savePendingValue(entry.characteristic, isForced);
+    }
 }
 
-void EspBleControlsFactory::startAdvertising() {
-    BLEAdvertisementData advData;
-    advData.setCompleteServices(BLEUUID(SERVICE_UUID));
-    BLEAdvertising* pAdvertising = BLEDevice::getAdvertising();
-    pAdvertising->setScanResponse(false);
-    pAdvertising->setMinPreferred(0x0);
-    pAdvertising->setScanResponseData(advData);
-    BLEDevice::startAdvertising();
+SimulationReport EspBleControlsFactory::simulate(VirtualClock* clock, const uint32_t durationMs, const uint32_t stepMs) {
+    SimulationReport report = { 0, std::vector<uint32_t>(m_intervalControls.size(), 0), std::vector<uint32_t>(m_schedules.size(), 0) };
+    if (clock == nullptr || stepMs == 0) return report;
+    // Only the states are evaluated, the callbacks that would drive the outputs (and save or notify values) don't run
+    std::vector<int8_t> intervalStates, scheduleStates;
+    for (IntervalControl* interval : m_intervalControls) intervalStates.push_back(interval->getState());
+    for (ScheduleControl* schedule : m_schedules) scheduleStates.push_back(schedule->getState());
+    for (uint32_t elapsedMs = 0; elapsedMs < durationMs; elapsedMs += stepMs) {
+        clock->advance(std::min(stepMs, durationMs - elapsedMs));
+        report.steps++;
+        for (size_t index = 0; index < m_intervalControls.size(); index++) {
+            const int8_t state = m_intervalControls[index]->getState();
+            if (state != intervalStates[index] && state != -1 && intervalStates[index] != -1) report.intervalTransitions[index]++;
+            intervalStates[index] = state;
+        }
+        for (size_t index = 0; index < m_schedules.size(); index++) {
+            const int8_t state = m_schedules[index]->getState();
+            if (state != scheduleStates[index]) report.scheduleTransitions[index]++;
+            scheduleStates[index] = state;
+        }
+    }
+    return report;
 }
 
 void EspBleControlsFactory::restoreValue(BLECharacteristic* characteristic, const std::string uuid, CharacteristicCallback* callback) {
-    Preferences m_preferences;
-    m_preferences.begin(PREFERENCES_ID, false);
-    const std::string controlId = getCharParamValue(uuid, SUFFIX);
+    Preferences localPreferences;
+    Preferences& m_preferences = m_isCreatingBatch ? m_batchPreferences : localPreferences;
+    if (!m_isCreatingBatch) m_preferences.begin(PREFERENCES_ID, false);
+    const std::string controlId = getPreferencesKey(uuid);
     if (isNotSaveExcluded(controlId) && m_preferences.isKey(controlId.c_str())) {
         CallbackType valueType = callback->getValueType();
         if (valueType == INTEGER) {
-            int value = m_preferences.getInt(controlId.c_str());
-            characteristic->setValue(value);
+            int32_t value = m_preferences.getInt(controlId.c_str());
+            setCharacteristicValue(characteristic, value);
         }
         if (valueType == FLOAT) {
-            float value = m_preferences.getFloat(controlId.c_str());
-            characteristic->setValue(value);
+            float_t value = m_preferences.getFloat(controlId.c_str());
+            setCharacteristicValue(characteristic, value);
         }
         if (valueType == STRING) {
-            uint8_t value[512];
-            m_preferences.getString(controlId.c_str(), (char*)&value[0], sizeof(value));
-            characteristic->setValue((char*)value);
+            char value[513];
+            size_t valueSize = m_preferences.getString(controlId.c_str(), value, sizeof(value));
+            characteristic->setValue((uint8_t*) value, (valueSize > 0) ? valueSize - 1 : 0);
         }
         if (valueType == VECTOR) {
-            size_t valueSize = stoi(getCharParamValue(uuid, PARAM1), 0, 16) / 8;
+            size_t valueSize = m_preferences.getBytesLength(controlId.c_str());
             uint8_t value[valueSize];
             m_preferences.getBytes(controlId.c_str(), value, valueSize);
             characteristic->setValue(value, valueSize);
         }
         callback->executeCallback(characteristic);
     }
-    m_preferences.end();
+    if (!m_isCreatingBatch) m_preferences.end();
 }
 
 template <typename ValueType> 
@@ -516,32 +2505,30 @@ BLECharacteristic* EspBleControlsFactory::createCharacteristic(
     const std::string description,
     ValueType initialValue,
     const boolean shouldNotify,
-    CharacteristicCallback* callback
+    CharacteristicCallback* callback,
+    const boolean isHighRate
 ) { 
-    uint32_t properties = BLECharacteristic::PROPERTY_READ;
-    if (shouldNotify) properties = properties + BLECharacteristic::PROPERTY_NOTIFY;
-    if (callback != nullptr) properties = properties + BLECharacteristic::PROPERTY_WRITE;
+    uint8_t properties = CHAR_READ;
+    if (shouldNotify) properties = properties | CHAR_NOTIFY;
+    if (callback != nullptr) properties = properties | CHAR_WRITE;
+    if (callback != nullptr && isHighRate) properties = properties | CHAR_WRITE_NR;
+    if (callback != nullptr) callback->setSequenced(isHighRate);
     
-    BLECharacteristic* characteristic = m_pService->createCharacteristic(BLEUUID(uuid), properties);
-    if (m_pin != 0) characteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED);
-    
-    if (shouldNotify) {
-        BLE2902* cccd;
-        cccd = new BLE2902();
-        cccd->setNotifications(true);
-        characteristic->addDescriptor(cccd);
-    } else {
-        characteristic->setValue(initialValue);
-    }
-
-    BLEDescriptor* cudd;
-    cudd = new BLEDescriptor((uint16_t)0x2901);
-    cudd->setValue(description);
-    characteristic->addDescriptor(cudd);
+    BLECharacteristic* characteristic = m_transport->createCharacteristic(uuid, properties, description);
+    if (!shouldNotify) setCharacteristicValue(characteristic, initialValue);
 
+    if (callback != nullptr) callback->keepValidValue(characteristic);
     restoreValue(characteristic, uuid, callback);
 
     characteristic->setCallbacks(callback);
+    if (callback != nullptr) callback->setRecorder(m_trafficRecorder);
+    if (callback != nullptr) callback->setNotifier(&m_notifier);
+    if (shouldNotify) m_notifier.addCharacteristic(characteristic);
+
+    m_controlEntries.push_back({ characteristic, uuid, callback, shouldNotify, [=]() {
+        setCharacteristicValue(characteristic, initialValue);
+        if (callback != nullptr) callback->executeCallback(characteristic, false);
+    }});
 
     return characteristic;
 };
@@ -556,45 +2543,104 @@ ClockControl* EspBleControlsFactory::createClockControl(
         createStringControl(description, 256, "Only one Clock control instance can be created!", nullptr, nullptr);
         return nullptr;
     } else {
-        const std::string newUuid = generateCharUuid(CLOCK_UUID_SUFFIX, notifyDelaySeconds);
+        const std::string newUuid = generateCharUuid(CLOCK_UUID_SUFFIX, notifyDelaySeconds, 1);
         ClockControl* clockControl = new ClockControl(initialValue, notifyDelaySeconds, &m_isDeviceAuthorised, onTimeSet);
         BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, true, clockControl->getCallback());
         clockControl->setCharacteristic(bleCharacteristic);
+        clockControl->setNotifier(&m_notifier);
         m_selfUpdatingControls.push_back(clockControl);
         return clockControl;
     }
 }
 
-IntervalControl* EspBleControlsFactory::createIntervalControl(
+IntervalControl* EspBleControlsFactory::createIntervalControl(
+    const std::string description,
+    const uint16_t divisionMinutes,
+    const uint16_t checkDelaySeconds,
+    std::function<void(bool)> onIntervalToggle
+) {
+    if (doesCharCounterExists(CLOCK_UUID_SUFFIX)) {
+        const std::string newUuid = generateCharUuid(INTRV_UUID_SUFFIX, getClosestDivision(divisionMinutes), checkDelaySeconds);
+        // One bit for each division of the day
+        const std::string initialValue(DAY_MINUTES / getClosestDivision(divisionMinutes) / 8, 0);
+        IntervalControl* intervalControl = new IntervalControl(checkDelaySeconds, &m_isDeviceAuthorised, onIntervalToggle);
+        BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, false, intervalControl->getCallback());
+        intervalControl->setCharacteristic(bleCharacteristic);
+        intervalControl->setNotifier(&m_notifier);
+        m_selfUpdatingControls.push_back(intervalControl);
+        m_intervalControls.push_back(intervalControl);
+        return intervalControl;
+    } else {
+        createStringControl(description, 256, "There is no Clock control defined!\nPlease add one before creating an Interval control!", nullptr, nullptr);
+        return nullptr;
+    }
+}
+
+CalendarControl* EspBleControlsFactory::createCalendarControl(
+    const std::string uuid,
+    const std::string description,
+    const CalendarType calendarType,
+    const uint32_t initialSelection
+) {
+    const size_t itemsCount = (calendarType == DAYS_OF_WEEK) ? WEEK_DAYS : (calendarType == DAYS_OF_MONTH) ? MONTH_DAYS : YEAR_MONTHS;
+    const std::string initialValue = selectionToBytes(initialSelection, itemsCount);
+    CalendarControl* calendarControl = new CalendarControl(calendarType, initialSelection, &m_isDeviceAuthorised);
+    BLECharacteristic* bleCharacteristic = createCharacteristic(uuid, description, initialValue, false, calendarControl->getCallback());
+    calendarControl->setCharacteristic(bleCharacteristic);
+    calendarControl->setNotifier(&m_notifier);
+    return calendarControl;
+}
+
+CalendarControl* EspBleControlsFactory::createWeekDaysControl(
+    const std::string description,
+    const bool allowMultiple,
+    const uint32_t initialSelection
+) {
+    return createCalendarControl(generateCharUuid(WEEKD_UUID_SUFFIX, allowMultiple), description, DAYS_OF_WEEK, initialSelection);
+}
+
+CalendarControl* EspBleControlsFactory::createMonthDaysControl(
+    const std::string description,
+    const bool allowMultiple,
+    const uint32_t initialSelection
+) {
+    return createCalendarControl(generateCharUuid(DAYOM_UUID_SUFFIX, MONTH_DAYS, allowMultiple), description, DAYS_OF_MONTH, initialSelection);
+}
+
+CalendarControl* EspBleControlsFactory::createMonthsControl(
     const std::string description,
-    const uint16_t divisionMinutes,
+    const bool allowMultiple,
+    const uint32_t initialSelection
+) {
+    return createCalendarControl(generateCharUuid(MONTH_UUID_SUFFIX, allowMultiple), description, MONTHS_OF_YEAR, initialSelection);
+}
+
+ScheduleControl* EspBleControlsFactory::createScheduleControl(
     const uint16_t checkDelaySeconds,
-    std::function<void(bool)> onIntervalToggle
+    std::function<void(bool)> onScheduleToggle
 ) {
-    if (doesCharCounterExists(CLOCK_UUID_SUFFIX)) {
-        const std::string newUuid = generateCharUuid(INTRV_UUID_SUFFIX, getClosestDivision(divisionMinutes), checkDelaySeconds);
-        const std::string initialValue(DAY_MINUTES / getClosestDivision(divisionMinutes), 0);
-        IntervalControl* intervalControl = new IntervalControl(checkDelaySeconds, &m_isDeviceAuthorised, onIntervalToggle);
-        BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, false, intervalControl->getCallback());
-        intervalControl->setCharacteristic(bleCharacteristic);
-        m_selfUpdatingControls.push_back(intervalControl);
-        return intervalControl;
-    } else {
-        createStringControl(description, 256, "There is no Clock control defined!\nPlease add one before creating an Interval control!", nullptr, nullptr);
-        return nullptr;
-    }
+    ScheduleControl* scheduleControl = new ScheduleControl(checkDelaySeconds, onScheduleToggle);
+    m_schedules.push_back(scheduleControl);
+    return scheduleControl;
+}
+
+TransitionEngine* EspBleControlsFactory::createTransitionEngine(const uint16_t tickMs) {
+    TransitionEngine* transitionEngine = new TransitionEngine(tickMs);
+    m_transitionEngines.push_back(transitionEngine);
+    return transitionEngine;
 }
 
 BooleanControl* EspBleControlsFactory::createSwitchControl(
     std::string description,
     std::string initialValue,
     ControlPublisher<std::string>* publisher,
-    std::function<void(std::string)> onSwitchToggle
+    std::function<void(const std::string&)> onSwitchToggle
 ) {
     const std::string newUuid = generateCharUuid(SWTCH_UUID_SUFFIX);
     BooleanControl* switchControl = new BooleanControl(publisher, &m_isDeviceAuthorised, onSwitchToggle);
     BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, switchControl->getCallback());
     switchControl->setCharacteristic(bleCharacteristic);
+    switchControl->setNotifier(&m_notifier);
     return switchControl;
 }
 
@@ -603,12 +2649,29 @@ BooleanControl* EspBleControlsFactory::createMomentaryControl(
     std::string initialValue,
     bool isNC, 
     ControlPublisher<std::string>* publisher,
-    std::function<void(std::string)> onButtonPressed
+    std::function<void(const std::string&)> onButtonPressed
 ) {
     const std::string newUuid = generateCharUuid(MOMNT_UUID_SUFFIX, isNC);
     BooleanControl* momentaryControl = new BooleanControl(publisher, &m_isDeviceAuthorised, onButtonPressed);
-    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, momentaryControl->getCallback());
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, momentaryControl->getCallback(), true);
+    momentaryControl->setCharacteristic(bleCharacteristic);
+    momentaryControl->setNotifier(&m_notifier);
+    return momentaryControl;
+}
+
+MomentaryControl* EspBleControlsFactory::createMomentaryControl(
+    const std::string description,
+    const bool isNC,
+    const uint16_t holdMillis,
+    std::function<void(bool)> onButtonChanged
+) {
+    const std::string newUuid = generateCharUuid(PUSHB_UUID_SUFFIX, isNC, holdMillis);
+    MomentaryControl* momentaryControl = new MomentaryControl(isNC, holdMillis, &m_isDeviceAuthorised, onButtonChanged, &m_trafficRecorder);
+    BLECharacteristic* bleCharacteristic = m_transport->createCharacteristic(newUuid, CHAR_READ | CHAR_WRITE | CHAR_WRITE_NR | CHAR_NOTIFY, description);
+    m_notifier.addCharacteristic(bleCharacteristic);
     momentaryControl->setCharacteristic(bleCharacteristic);
+    momentaryControl->setNotifier(&m_notifier);
+    m_momentaryControls.push_back(momentaryControl);
     return momentaryControl;
 }
 
@@ -623,8 +2686,9 @@ IntControl* EspBleControlsFactory::createSliderControl(
 ) {
     const std::string newUuid = generateCharUuid(SLIDR_UUID_SUFFIX, minValue, maxValue, steps);
     IntControl* sliderControl = new IntControl(publisher, &m_isDeviceAuthorised, onSliderMoved);
-    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, sliderControl->getCallback());
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, sliderControl->getCallback(), true);
     sliderControl->setCharacteristic(bleCharacteristic);
+    sliderControl->setNotifier(&m_notifier);
     return sliderControl;
 }
 
@@ -640,6 +2704,7 @@ IntControl* EspBleControlsFactory::createIntControl(
     IntControl* intControl = new IntControl(publisher, &m_isDeviceAuthorised, onIntReceived);
     BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, intControl->getCallback());
     intControl->setCharacteristic(bleCharacteristic);
+    intControl->setNotifier(&m_notifier);
     return intControl;
 }
 
@@ -652,12 +2717,34 @@ IntControl* EspBleControlsFactory::createAngleControl(
 ) {
     const std::string newUuid = generateCharUuid(ANGLE_UUID_SUFFIX, isComapss);
     IntControl* angleControl = new IntControl(publisher, &m_isDeviceAuthorised, onAngleChanged);
-    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, angleControl->getCallback());
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, angleControl->getCallback(), true);
     angleControl->setCharacteristic(bleCharacteristic);
+    angleControl->setNotifier(&m_notifier);
     return angleControl;
 }
 
 
+IntControl* EspBleControlsFactory::createDecimalControl(
+    std::string description,
+    short minValue,
+    short maxValue,
+    uint8_t fractionDigits,
+    int32_t initialValue,
+    ControlPublisher<int32_t>* publisher,
+    std::function<void(int32_t)> onDecimalReceived
+) {
+    // The app scales the limits by 10^digits, so they have to stay in 32 bits with the digits that are kept
+    uint8_t digits = std::min(fractionDigits, (uint8_t) MAX_FRACTION_DIGITS);
+    const int64_t limit = std::max(abs(minValue), abs(maxValue));
+    while (digits > 0 && limit * decimalScale(digits) > INT32_MAX) digits--;
+    const std::string newUuid = generateCharUuid(DECML_UUID_SUFFIX, minValue, maxValue, digits);
+    IntControl* decimalControl = new IntControl(publisher, &m_isDeviceAuthorised, onDecimalReceived);
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, decimalControl->getCallback());
+    decimalControl->setCharacteristic(bleCharacteristic);
+    decimalControl->setNotifier(&m_notifier);
+    return decimalControl;
+}
+
 FloatControl* EspBleControlsFactory::createFloatControl(
     std::string description,
     short minValue,
@@ -670,23 +2757,136 @@ FloatControl* EspBleControlsFactory::createFloatControl(
     FloatControl* floatControl = new FloatControl(publisher, &m_isDeviceAuthorised, onFloatReceived);
     BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, floatControl->getCallback());
     floatControl->setCharacteristic(bleCharacteristic);
+    floatControl->setNotifier(&m_notifier);
     return floatControl;
 }
 
+template <typename ValueType>
+SensorControl<ValueType>* EspBleControlsFactory::createSensorControl(
+    const std::string uuid,
+    const std::string description,
+    const uint16_t notifySeconds,
+    const uint16_t cacheSeconds,
+    std::function<ValueType()> sample
+) {
+    SensorControl<ValueType>* sensorControl = new SensorControl<ValueType>(notifySeconds, cacheSeconds, &m_isDeviceAuthorised, sample);
+    BLECharacteristic* bleCharacteristic = m_transport->createCharacteristic(uuid, CHAR_READ | CHAR_NOTIFY | CHAR_SUBSCRIBE, description);
+    m_notifier.addCharacteristic(bleCharacteristic);
+    sensorControl->setCharacteristic(bleCharacteristic);
+    sensorControl->setNotifier(&m_notifier);
+    sensorControl->setSubscriptionCheck([this, bleCharacteristic]() { return m_transport->isSubscribed(bleCharacteristic); });
+    m_selfUpdatingControls.push_back(sensorControl);
+    return sensorControl;
+}
+
+SensorControl<int32_t>* EspBleControlsFactory::createIntSensorControl(
+    const std::string description,
+    const uint16_t notifySeconds,
+    const uint16_t cacheSeconds,
+    std::function<int32_t()> sample
+) {
+    return createSensorControl(generateCharUuid(INTGR_UUID_SUFFIX, 0, 0), description, notifySeconds, cacheSeconds, sample);
+}
+
+SensorControl<float_t>* EspBleControlsFactory::createFloatSensorControl(
+    const std::string description,
+    const uint16_t notifySeconds,
+    const uint16_t cacheSeconds,
+    std::function<float_t()> sample
+) {
+    return createSensorControl(generateCharUuid(FLOAT_UUID_SUFFIX, 0, 0), description, notifySeconds, cacheSeconds, sample);
+}
+
 StringControl* EspBleControlsFactory::createStringControl(
     std::string description,
     uint16_t maxLength,
     std::string initialValue,
     ControlPublisher<std::string>* publisher,
-    std::function<void(std::string)> onTextReceived
+    std::function<void(const std::string&)> onTextReceived
 ) {
     const std::string newUuid = generateCharUuid(STRNG_UUID_SUFFIX, maxLength);
-    StringControl* stringControl = new StringControl(publisher, &m_isDeviceAuthorised, onTextReceived);
+    StringControl* stringControl = new StringControl(std::max(maxLength, (uint16_t) initialValue.length()), publisher, &m_isDeviceAuthorised, onTextReceived);
     BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, stringControl->getCallback());
     stringControl->setCharacteristic(bleCharacteristic);
+    stringControl->setNotifier(&m_notifier);
     return stringControl;
 }
 
+std::vector<BLEControl*> EspBleControlsFactory::createDeclaredControls(
+    const ControlDeclaration* declarations,
+    const ControlUuid* uuids,
+    const uint8_t* instances,
+    const size_t count
+) {
+    std::vector<BLEControl*> controls;
+    controls.reserve(count);
+    m_controlEntries.reserve(m_controlEntries.size() + count);
+    m_isCreatingBatch = m_batchPreferences.begin(PREFERENCES_ID, false);
+    for (size_t index = 0; index < count; index++) {
+        const ControlDeclaration& declaration = declarations[index];
+        const std::string suffix = declaration.suffix;
+        // The compiler numbered the controls of each type from 1, if some were created before the UUID is generated again
+        std::string uuid = uuids[index].data();
+        if (getCharCounterIndex(suffix) + 1 == instances[index]) {
+            if (NUMBERED_INSTANCES) m_charsCounter[suffix] = instances[index];
+        } else {
+            uuid = generateCharUuid(suffix, declaration.params[0], declaration.params[1], declaration.params[2]);
+        }
+
+        BLEControl* control = nullptr;
+        BLECharacteristic* bleCharacteristic = nullptr;
+        if (declaration.valueType == INTEGER) {
+            IntControl* intControl = new IntControl(declaration.intPublisher, &m_isDeviceAuthorised, declaration.onIntReceived);
+            bleCharacteristic = createCharacteristic(
+                uuid, declaration.description, declaration.intValue, declaration.shouldNotify(), intControl->getCallback(),
+                suffix == SLIDR_UUID_SUFFIX || suffix == ANGLE_UUID_SUFFIX
+            );
+            control = intControl;
+        } else if (declaration.valueType == FLOAT) {
+            FloatControl* floatControl = new FloatControl(declaration.floatPublisher, &m_isDeviceAuthorised, declaration.onFloatReceived);
+            bleCharacteristic = createCharacteristic(uuid, declaration.description, declaration.floatValue, declaration.shouldNotify(), floatControl->getCallback());
+            control = floatControl;
+        } else if (suffix == STRNG_UUID_SUFFIX) {
+            const std::string initialValue = declaration.stringValue;
+            const uint16_t maxLength = std::max((uint16_t) declaration.params[0], (uint16_t) initialValue.length());
+            StringControl* stringControl = new StringControl(maxLength, declaration.stringPublisher, &m_isDeviceAuthorised, declaration.onStringReceived);
+            bleCharacteristic = createCharacteristic(uuid, declaration.description, initialValue, declaration.shouldNotify(), stringControl->getCallback());
+            control = stringControl;
+        } else {
+            const std::string initialValue = declaration.stringValue;
+            BooleanControl* booleanControl = new BooleanControl(declaration.stringPublisher, &m_isDeviceAuthorised, declaration.onStringReceived);
+            bleCharacteristic = createCharacteristic(
+                uuid, declaration.description, initialValue, declaration.shouldNotify(), booleanControl->getCallback(),
+                suffix == MOMNT_UUID_SUFFIX
+            );
+            control = booleanControl;
+        }
+        control->setCharacteristic(bleCharacteristic);
+        control->setNotifier(&m_notifier);
+        controls.push_back(control);
+    }
+    if (m_isCreatingBatch) m_batchPreferences.end();
+    m_isCreatingBatch = false;
+    return controls;
+}
+
+ColorControl* EspBleControlsFactory::createColorControl(
+    std::string description,
+    const bool isRgbw,
+    const RgbColor initialValue,
+    ControlPublisher<RgbColor>* publisher,
+    std::function<void(const RgbColor&)> onColorChanged
+) {
+    const std::string newUuid = generateCharUuid(COLOR_UUID_SUFFIX, isRgbw);
+    char hexValue[8];
+    const std::string initialHexValue(hexValue, ColorControl::formatColor(initialValue, isRgbw, hexValue));
+    ColorControl* colorControl = new ColorControl(isRgbw, publisher, &m_isDeviceAuthorised, onColorChanged);
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialHexValue, publisher != nullptr, colorControl->getCallback(), true);
+    colorControl->setCharacteristic(bleCharacteristic);
+    colorControl->setNotifier(&m_notifier);
+    return colorControl;
+}
+
 StringControl* EspBleControlsFactory::createColorControl(
     std::string description,
     std::string initialValue,
@@ -694,8 +2894,560 @@ StringControl* EspBleControlsFactory::createColorControl(
     std::function<void(std::string)> onColorChanged
 ) {
     const std::string newUuid = generateCharUuid(COLOR_UUID_SUFFIX);
-    StringControl* colorControl = new StringControl(publisher, &m_isDeviceAuthorised, onColorChanged);
-    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, colorControl->getCallback());
+    StringControl* colorControl = new StringControl(initialValue.length(), publisher, &m_isDeviceAuthorised, onColorChanged);
+    CharacteristicCallback* callback = colorControl->getCallback();
+    callback->setValidator([](std::string_view hexValue) { RgbColor color; return ColorControl::parseColor(hexValue, color); });
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, initialValue, publisher != nullptr, callback, true);
     colorControl->setCharacteristic(bleCharacteristic);
+    colorControl->setNotifier(&m_notifier);
     return colorControl;
 }
+
+XYControl* EspBleControlsFactory::createXYControl(
+    const std::string description,
+    const int16_t maxX,
+    const int16_t maxY,
+    const uint8_t ratePerSecond,
+    const bool returnsToCenter,
+    ControlPublisher<XYPosition>* publisher,
+    std::function<void(const XYPosition&)> onPadMoved
+) {
+    const int16_t rate = std::min(std::max(ratePerSecond, (uint8_t) 1), (uint8_t) 100);
+    const std::string newUuid = generateCharUuid(XYPAD_UUID_SUFFIX, maxX, maxY, returnsToCenter ? -rate : rate);
+    const uint16_t releaseMillis = returnsToCenter ? std::max(XY_RELEASE_PERIODS * 1000 / rate, XY_RELEASE_MIN_MS) : 0;
+    XYControl* xyControl = new XYControl(maxX, maxY, releaseMillis, publisher, &m_isDeviceAuthorised, onPadMoved);
+    CharacteristicCallback* callback = xyControl->getCallback();
+    callback->setPersistent(false);
+    BLECharacteristic* bleCharacteristic = createCharacteristic(newUuid, description, (int32_t) 0, publisher != nullptr, callback, true);
+    xyControl->setCharacteristic(bleCharacteristic);
+    xyControl->setNotifier(&m_notifier);
+    if (returnsToCenter) m_releasingPads.push_back(xyControl);
+    return xyControl;
+}
+
+HistoryControl* EspBleControlsFactory::createHistoryControl(
+    const std::string description,
+    const uint16_t capacity,
+    const uint16_t sampleSeconds,
+    ControlPublisher<int32_t>* publisher,
+    const bool shouldPersist
+) {
+    const std::string newUuid = generateCharUuid(HISTR_UUID_SUFFIX, capacity, sampleSeconds);
+    HistoryControl* historyControl = new HistoryControl(
+        getPreferencesKey(newUuid), capacity, sampleSeconds, publisher, shouldPersist, &m_isDeviceAuthorised
+    );
+    BLECharacteristic* bleCharacteristic = m_transport->createCharacteristic(newUuid, CHAR_READ | CHAR_WRITE, description);
+    bleCharacteristic->setCallbacks(new HistoryCallback(historyControl->getHistory(), &m_isDeviceAuthorised, &m_trafficRecorder));
+    historyControl->setCharacteristic(bleCharacteristic);
+    historyControl->setNotifier(&m_notifier);
+    m_selfUpdatingControls.push_back(historyControl);
+    return historyControl;
+}
+
+OtaControl* EspBleControlsFactory::createOtaControl(
+    const std::string description,
+    FirmwareSink* sink,
+    const bool restartWhenDone,
+    std::function<void(OtaStatus)> onStatusChanged
+) {
+    if (m_pin == 0) {
+        createStringControl(description, 256, "The firmware update needs a pin!\nPlease set one to encrypt the link before creating an OTA control!", nullptr, nullptr);
+        return nullptr;
+    }
+    const std::string newUuid = generateCharUuid(FWOTA_UUID_SUFFIX, OTA_WINDOW_CHUNKS);
+    OtaControl* otaControl = new OtaControl(
+        sink != nullptr ? sink : new PartitionSink(), OTA_WINDOW_CHUNKS, restartWhenDone, &m_isDeviceAuthorised, onStatusChanged, &m_trafficRecorder
+    );
+    BLECharacteristic* bleCharacteristic = m_transport->createCharacteristic(newUuid, CHAR_READ | CHAR_WRITE | CHAR_WRITE_NR | CHAR_NOTIFY, description);
+    m_notifier.addCharacteristic(bleCharacteristic);
+    otaControl->setCharacteristic(bleCharacteristic);
+    otaControl->setNotifier(&m_notifier);
+    m_selfUpdatingControls.push_back(otaControl);
+    return otaControl;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+SimulatedCentral::SimulatedCentral(EspBleControlsFactory* factory) {
+    m_factory = factory;
+}
+
+bool SimulatedCentral::addWrites(
+    const std::string controlSuffix,
+    const uint16_t instance,
+    const uint16_t ratePerSecond,
+    std::function<std::string(uint32_t)> payloadGenerator
+) {
+    const std::string controlId = controlSuffix + intToString(instance, 2, 16);
+    for (const ControlEntry& entry : m_factory->getControlEntries()) {
+        if (getCharParamValue(entry.uuid, SUFFIX) != controlId || entry.callback == nullptr || ratePerSecond == 0) continue;
+        const uint16_t periodMs = (ratePerSecond >= 1000) ? 1 : 1000 / ratePerSecond;
+        m_streams.push_back({ entry, periodMs, 0, 0, payloadGenerator });
+        return true;
+    }
+    return false;
+}
+
+std::string SimulatedCentral::generatePayload(WriteStream& stream) {
+    if (stream.payloadGenerator != nullptr) return stream.payloadGenerator(stream.step);
+    uint8_t bytes[sizeof(int32_t)];
+    const int16_t minValue = stoi(getCharParamValue(stream.entry.uuid, PARAM1), 0, 16);
+    const int16_t maxValue = stoi(getCharParamValue(stream.entry.uuid, PARAM2), 0, 16);
+    switch (stream.entry.callback->getValueType()) {
+        case INTEGER: {
+            const int32_t value = (maxValue > minValue) ? minValue + (int32_t) (stream.step % (maxValue - minValue + 1)) : stream.step;
+            return std::string((char*) bytes, encodeValue(value, bytes, sizeof(bytes)));
+        }
+        case FLOAT: {
+            const float_t value = (maxValue > minValue) ? minValue + (int32_t) (stream.step % (maxValue - minValue + 1)) : stream.step;
+            return std::string((char*) bytes, encodeValue(value, bytes, sizeof(bytes)));
+        }
+        case STRING: {
+            const uint16_t maxLength = (uint16_t) minValue > 0 ? (uint16_t) minValue : 16;
+            return std::string(1 + stream.step % maxLength, 'a' + stream.step % 26);
+        }
+        case VECTOR:
+            return std::string(getCharacteristicValue(stream.entry.characteristic).length(), (char) stream.step);
+        default:
+            return std::string();
+    }
+}
+
+LoadTestReport SimulatedCentral::run(const uint32_t durationMs) {
+    LoadTestReport report = {};
+    m_dispatchLatencies.clear();
+    m_persistLatencies.clear();
+    // The values are saved to a namespace of their own, which is cleared at the end, so the saved values of the device are kept
+    for (WriteStream& stream : m_streams) stream.entry.callback->setSaveLatencyProbe(&m_persistLatencies);
+    for (WriteStream& stream : m_streams) stream.entry.callback->setPreferencesId(LOAD_TEST_PREFERENCES_ID);
+    report.freeHeapBefore = ESP.getFreeHeap();
+
+    const uint32_t startTimeStamp = millis();
+    for (WriteStream& stream : m_streams) stream.nextWriteTimeStamp = startTimeStamp;
+    while (millis() - startTimeStamp < durationMs) {
+        for (WriteStream& stream : m_streams) {
+            if ((int32_t) (millis() - stream.nextWriteTimeStamp) < 0) continue;
+            stream.entry.characteristic->setValue(generatePayload(stream));
+            const uint32_t writeTimeStamp = micros();
+            stream.entry.callback->executeCallback(stream.entry.characteristic, true);
+            m_dispatchLatencies.add(micros() - writeTimeStamp);
+            stream.nextWriteTimeStamp += stream.periodMs;
+            stream.step++;
+            report.writes++;
+        }
+        m_factory->updateControls();
+        vTaskDelay(1);
+    }
+    report.durationMs = millis() - startTimeStamp;
+    // The high rate values still waiting are saved to the load test namespace too, before it's switched back
+    m_factory->savePendingValues(true);
+    vTaskDelay(pdMS_TO_TICKS(500)); // Lets the last save tasks finish
+
+    for (WriteStream& stream : m_streams) stream.entry.callback->setSaveLatencyProbe(nullptr);
+    for (WriteStream& stream : m_streams) stream.entry.callback->setPreferencesId(PREFERENCES_ID);
+    Preferences preferences;
+    preferences.begin(LOAD_TEST_PREFERENCES_ID, false);
+    preferences.clear();
+    preferences.end();
+    report.writesPerSecond = report.writes * 1000 / (report.durationMs > 0 ? report.durationMs : 1);
+    report.dispatchP50Us = m_dispatchLatencies.getPercentile(50);
+    report.dispatchP90Us = m_dispatchLatencies.getPercentile(90);
+    report.dispatchP99Us = m_dispatchLatencies.getPercentile(99);
+    report.dispatchMaxUs = m_dispatchLatencies.getMax();
+    report.persisted = m_persistLatencies.getCount();
+    report.persistP50Us = m_persistLatencies.getPercentile(50);
+    report.persistP90Us = m_persistLatencies.getPercentile(90);
+    report.persistP99Us = m_persistLatencies.getPercentile(99);
+    report.persistMaxUs = m_persistLatencies.getMax();
+    report.freeHeapAfter = ESP.getFreeHeap();
+    report.minFreeHeap = ESP.getMinFreeHeap();
+    return report;
+}
+
+void SimulatedCentral::printReport(const LoadTestReport& report, Print& output) {
+    output.printf("Writes: %lu in %lu ms (%lu/s)\n", (unsigned long) report.writes, (unsigned long) report.durationMs, (unsigned long) report.writesPerSecond);
+    output.printf("Dispatch us: p50 %lu p90 %lu p99 %lu max %lu\n", (unsigned long) report.dispatchP50Us, (unsigned long) report.dispatchP90Us,
+        (unsigned long) report.dispatchP99Us, (unsigned long) report.dispatchMaxUs);
+    output.printf("Persist us: p50 %lu p90 %lu p99 %lu max %lu (%lu saved)\n", (unsigned long) report.persistP50Us, (unsigned long) report.persistP90Us,
+        (unsigned long) report.persistP99Us, (unsigned long) report.persistMaxUs, (unsigned long) report.persisted);
+    output.printf("Heap: %lu before, %lu after, %lu minimum\n", (unsigned long) report.freeHeapBefore, (unsigned long) report.freeHeapAfter,
+        (unsigned long) report.minFreeHeap);
+}
+
+FirmwareStreamReport SimulatedCentral::streamFirmware(OtaControl* control, const uint32_t imageSize, const uint16_t chunkSize) {
+    FirmwareStreamReport report = {};
+    const uint16_t payloadSize = std::max((uint16_t) 1, std::min(chunkSize, (uint16_t) OTA_MAX_CHUNK_SIZE));
+    auto imageByte = [](const uint32_t offset) -> uint8_t { return (offset * 31 + (offset >> 8)) & 0xFF; };
+    uint8_t message[3 + OTA_MAX_CHUNK_SIZE];
+
+    uint32_t imageCrc = 0;
+    for (uint32_t offset = 0; offset < imageSize; offset += payloadSize) {
+        const uint16_t length = std::min((uint32_t) payloadSize, imageSize - offset);
+        for (uint16_t index = 0; index < length; index++) message[index] = imageByte(offset + index);
+        imageCrc = updateCrc32(imageCrc, message, length);
+    }
+
+    const uint32_t acksBefore = control->getAcksCount();
+    const uint32_t startTimeStamp = micros();
+    message[0] = OTA_START;
+    encodeValue(imageSize, message + 1, 4);
+    encodeValue(imageCrc, message + 5, 4);
+    control->onMessage(message, 1 + 2 * sizeof(uint32_t));
+
+    // Sends a window, then goes on from the next sequence the device expects, like the app after each ack
+    while (control->getStatus() == OTA_READY || control->getStatus() == OTA_WINDOW_ACK || control->getStatus() == OTA_OUT_OF_SEQUENCE) {
+        const uint32_t windowStart = control->getReceivedBytes();
+        if (windowStart >= imageSize) break;
+        uint16_t sequence = control->getNextSequence();
+        for (uint16_t chunk = 0; chunk < control->getWindowChunks(); chunk++) {
+            const uint32_t offset = windowStart + chunk * payloadSize;
+            if (offset >= imageSize) break;
+            const uint16_t length = std::min((uint32_t) payloadSize, imageSize - offset);
+            message[0] = OTA_DATA;
+            encodeValue(sequence++, message + 1, 2);
+            for (uint16_t index = 0; index < length; index++) message[3 + index] = imageByte(offset + index);
+            control->onMessage(message, 3 + length);
+            report.chunks++;
+        }
+        if (control->getReceivedBytes() == windowStart) break;
+        m_factory->updateControls();
+    }
+    message[0] = OTA_END;
+    control->onMessage(message, 1);
+
+    report.durationUs = micros() - startTimeStamp;
+    report.bytes = control->getReceivedBytes();
+    report.bytesPerSecond = (uint64_t) report.bytes * 1000000 / (report.durationUs > 0 ? report.durationUs : 1);
+    report.resentChunks = report.chunks - (imageSize + payloadSize - 1) / payloadSize;
+    report.acks = control->getAcksCount() - acksBefore;
+    report.status = control->getStatus();
+    return report;
+}
+
+void SimulatedCentral::printReport(const FirmwareStreamReport& report, Print& output) {
+    output.printf("Firmware (no radio): %lu bytes in %lu us (%lu bytes/s), status %u\n", (unsigned long) report.bytes, (unsigned long) report.durationUs,
+        (unsigned long) report.bytesPerSecond, report.status);
+    output.printf("Chunks: %lu (%lu sent again), acks %lu\n", (unsigned long) report.chunks, (unsigned long) report.resentChunks,
+        (unsigned long) report.acks);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#if !defined(ESP_BLE_CONTROLS_NIMBLE) && !defined(ESP_BLE_CONTROLS_MOCK)
+
+// The custom GATTS handler is a plain function, it reaches the (only) transport through this pointer
+static BluedroidTransport* gattsTransport = nullptr;
+
+void BluedroidTransport::gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+    if (gattsTransport == nullptr || gattsTransport->m_listener == nullptr) return;
+    if (event == ESP_GATTS_CONF_EVT) gattsTransport->m_listener->onNotificationConfirmed(param->conf.handle, param->conf.status == ESP_GATT_OK);
+    if (event == ESP_GATTS_CONGEST_EVT) gattsTransport->m_listener->onCongestion(param->congest.congested);
+}
+
+BluedroidTransport::BluedroidTransport() {
+    m_listener = nullptr;
+    m_pServer = nullptr;
+    m_pService = nullptr;
+    m_pin = 0;
+}
+
+void BluedroidTransport::begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) {
+    m_listener = listener;
+    m_pin = passkey;
+    BLEDevice::init(deviceName);
+    gattsTransport = this;
+    BLEDevice::setCustomGattsHandler(gattsEventHandler);
+
+    if (m_pin != 0) {
+        BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);
+        BLESecurityCallbacks* secCallback = new SecurityCallback(
+            [&](bool isDeviceAuthorised, uint8_t failReason, const uint8_t* address) -> void { 
+                m_listener->onAuthentication(isDeviceAuthorised, failReason, address);
+            }
+        );
+        BLEDevice::setSecurityCallbacks(secCallback);
+    }
+
+    m_pServer = BLEDevice::createServer();
+    BLEServerCallbacks* serverCallback = new ServerCallback(
+        [&](bool isDeviceConnected, const uint8_t* address) -> void { 
+            // Bluedroid keeps one CCCD value for all the connections, the next peer starts unsubscribed
+            if (!isDeviceConnected) for (BLE2902* cccd : m_subscriptionCccds) cccd->setNotifications(false);
+            m_listener->onConnection(isDeviceConnected, address);
+        }
+    );
+    m_pServer->setCallbacks(serverCallback);
+    m_pService = m_pServer->createService(BLEUUID(SERVICE_UUID), SERVICE_HANDLES, 0);
+}
+
+BLECharacteristic* BluedroidTransport::createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) {
+    uint32_t stackProperties = 0;
+    if (properties & CHAR_READ) stackProperties = stackProperties | BLECharacteristic::PROPERTY_READ;
+    if (properties & CHAR_WRITE) stackProperties = stackProperties | BLECharacteristic::PROPERTY_WRITE;
+    if (properties & CHAR_WRITE_NR) stackProperties = stackProperties | BLECharacteristic::PROPERTY_WRITE_NR;
+    if (properties & CHAR_NOTIFY) stackProperties = stackProperties | BLECharacteristic::PROPERTY_NOTIFY;
+
+    BLECharacteristic* characteristic = m_pService->createCharacteristic(BLEUUID(uuid), stackProperties);
+    if (m_pin != 0) characteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED);
+
+    if (properties & CHAR_NOTIFY) {
+        BLE2902* cccd;
+        cccd = new BLE2902();
+        cccd->setNotifications((properties & CHAR_SUBSCRIBE) == 0);
+        characteristic->addDescriptor(cccd);
+        if (properties & CHAR_SUBSCRIBE) m_subscriptionCccds.push_back(cccd);
+    }
+
+    BLEDescriptor* cudd;
+    cudd = new BLEDescriptor((uint16_t)0x2901);
+    cudd->setValue(description);
+    characteristic->addDescriptor(cudd);
+    return characteristic;
+}
+
+void BluedroidTransport::start() {
+    m_pService->start();
+    startAdvertising();
+    if (m_pin != 0) setSecurity();
+}
+
+void BluedroidTransport::setSecurity() {
+    esp_ble_auth_req_t auth_req = ESP_LE_AUTH_REQ_SC_MITM_BOND;
+    esp_ble_io_cap_t iocap = ESP_IO_CAP_OUT;
+    uint8_t key_size = 16;
+    uint8_t init_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    uint8_t rsp_key = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    uint8_t auth_option = ESP_BLE_ONLY_ACCEPT_SPECIFIED_AUTH_DISABLE;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_STATIC_PASSKEY, &m_pin, sizeof(uint32_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(uint8_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &iocap, sizeof(uint8_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(uint8_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_ONLY_ACCEPT_SPECIFIED_SEC_AUTH, &auth_option, sizeof(uint8_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(uint8_t));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
+}
+
+void BluedroidTransport::startAdvertising() {
+    BLEAdvertisementData advData;
+    advData.setCompleteServices(BLEUUID(SERVICE_UUID));
+    BLEAdvertising* pAdvertising = BLEDevice::getAdvertising();
+    pAdvertising->setScanResponse(false);
+    pAdvertising->setMinPreferred(0x0);
+    pAdvertising->setScanResponseData(advData);
+    BLEDevice::startAdvertising();
+}
+
+void BluedroidTransport::disconnect() {
+    m_pServer->removePeerDevice(m_pServer->getConnId(), true);
+}
+
+void BluedroidTransport::encryptLink(const uint8_t* address) {
+    esp_bd_addr_t peerAddress;
+    memcpy(peerAddress, address, sizeof(esp_bd_addr_t));
+    esp_ble_set_encryption(peerAddress, ESP_BLE_SEC_ENCRYPT);
+}
+
+bool BluedroidTransport::isBonded(const uint8_t* address) {
+    int bondsCount = esp_ble_get_bond_device_num();
+    if (bondsCount <= 0) return false;
+    esp_ble_bond_dev_t bondedDevices[bondsCount];
+    esp_ble_get_bond_device_list(&bondsCount, bondedDevices);
+    for (int index = 0; index < bondsCount; index++) {
+        if (memcmp(bondedDevices[index].bd_addr, address, sizeof(esp_bd_addr_t)) == 0) return true;
+    }
+    return false;
+}
+
+void BluedroidTransport::removeBond(const uint8_t* address) {
+    esp_bd_addr_t bondAddress;
+    memcpy(bondAddress, address, sizeof(esp_bd_addr_t));
+    esp_ble_remove_bond_device(bondAddress);
+}
+
+bool BluedroidTransport::isSubscribed(BLECharacteristic* characteristic) {
+    BLE2902* cccd = (BLE2902*) characteristic->getDescriptorByUUID(BLEUUID((uint16_t) 0x2902));
+    return m_pServer->getConnectedCount() > 0 && cccd != nullptr && cccd->getNotifications();
+}
+
+void BluedroidTransport::removeAllBonds() {
+    int bondsCount = esp_ble_get_bond_device_num();
+    if (bondsCount <= 0) return;
+    esp_ble_bond_dev_t bondedDevices[bondsCount];
+    esp_ble_get_bond_device_list(&bondsCount, bondedDevices);
+    for (int index = 0; index < bondsCount; index++) esp_ble_remove_bond_device(bondedDevices[index].bd_addr);
+}
+
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+#if defined(ESP_BLE_CONTROLS_NIMBLE)
+
+const bool isSameAddress(NimBLEAddress bondAddress, const uint8_t* address) {
+    const uint8_t* nativeAddress = bondAddress.getNative();
+    for (size_t index = 0; index < sizeof(BleAddress); index++) {
+        if (nativeAddress[index] != address[sizeof(BleAddress) - 1 - index]) return false;
+    }
+    return true;
+}
+
+NimBleTransport::NimBleTransport() {
+    m_listener = nullptr;
+    m_pServer = nullptr;
+    m_pService = nullptr;
+    m_pin = 0;
+    m_connHandle = 0;
+}
+
+void NimBleTransport::begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) {
+    m_listener = listener;
+    m_pin = passkey;
+    NimBLEDevice::init(deviceName);
+    if (m_pin != 0) {
+        NimBLEDevice::setSecurityAuth(true, true, true);
+        NimBLEDevice::setSecurityPasskey(m_pin);
+        NimBLEDevice::setSecurityIOCap(BLE_HS_IO_DISPLAY_ONLY);
+    }
+    m_pServer = NimBLEDevice::createServer();
+    m_pServer->setCallbacks(this, false);
+    m_pServer->advertiseOnDisconnect(false);
+    m_pService = m_pServer->createService(SERVICE_UUID);
+}
+
+BLECharacteristic* NimBleTransport::createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) {
+    uint32_t stackProperties = 0;
+    if (properties & CHAR_READ) {
+        stackProperties = stackProperties | NIMBLE_PROPERTY::READ;
+        if (m_pin != 0) stackProperties = stackProperties | NIMBLE_PROPERTY::READ_ENC | NIMBLE_PROPERTY::READ_AUTHEN;
+    }
+    if (properties & (CHAR_WRITE | CHAR_WRITE_NR)) {
+        if (properties & CHAR_WRITE) stackProperties = stackProperties | NIMBLE_PROPERTY::WRITE;
+        if (properties & CHAR_WRITE_NR) stackProperties = stackProperties | NIMBLE_PROPERTY::WRITE_NR;
+        if (m_pin != 0) stackProperties = stackProperties | NIMBLE_PROPERTY::WRITE_ENC | NIMBLE_PROPERTY::WRITE_AUTHEN;
+    }
+    // The CCCD of a notifying characteristic is added by NimBLE
+    if (properties & CHAR_NOTIFY) stackProperties = stackProperties | NIMBLE_PROPERTY::NOTIFY;
+
+    NimBLECharacteristic* characteristic = m_pService->createCharacteristic(uuid.c_str(), stackProperties);
+    NimBLEDescriptor* cudd = characteristic->createDescriptor("2901", NIMBLE_PROPERTY::READ, std::max(description.length(), (size_t) 1));
+    cudd->setValue(description);
+    return characteristic;
+}
+
+void NimBleTransport::start() {
+    m_pService->start();
+    NimBLEAdvertising* pAdvertising = NimBLEDevice::getAdvertising();
+    pAdvertising->addServiceUUID(SERVICE_UUID);
+    pAdvertising->setScanResponse(false);
+    startAdvertising();
+}
+
+void NimBleTransport::startAdvertising() {
+    NimBLEDevice::startAdvertising();
+}
+
+void NimBleTransport::disconnect() {
+    m_pServer->disconnect(m_connHandle);
+}
+
+void NimBleTransport::encryptLink(const uint8_t* address) {
+    NimBLEDevice::startSecurity(m_connHandle);
+}
+
+bool NimBleTransport::isBonded(const uint8_t* address) {
+    for (int index = 0; index < NimBLEDevice::getNumBonds(); index++) {
+        if (isSameAddress(NimBLEDevice::getBondedAddress(index), address)) return true;
+    }
+    return false;
+}
+
+void NimBleTransport::removeBond(const uint8_t* address) {
+    for (int index = 0; index < NimBLEDevice::getNumBonds(); index++) {
+        NimBLEAddress bondAddress = NimBLEDevice::getBondedAddress(index);
+        if (isSameAddress(bondAddress, address)) {
+            NimBLEDevice::deleteBond(bondAddress);
+            return;
+        }
+    }
+}
+
+void NimBleTransport::removeAllBonds() {
+    NimBLEDevice::deleteAllBonds();
+}
+
+void NimBleTransport::onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) {
+    BleAddress address;
+    std::reverse_copy(desc->peer_id_addr.val, desc->peer_id_addr.val + sizeof(BleAddress), address);
+    m_connHandle = desc->conn_handle;
+    m_listener->onConnection(true, address);
+}
+
+void NimBleTransport::onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) {
+    m_listener->onConnection(false, nullptr);
+}
+
+void NimBleTransport::onAuthenticationComplete(ble_gap_conn_desc* desc) {
+    BleAddress address;
+    std::reverse_copy(desc->peer_id_addr.val, desc->peer_id_addr.val + sizeof(BleAddress), address);
+    // NimBLE doesn't report why the authentication failed. An encrypted link without MITM protection (Just Works) isn't
+    // authenticated by the passkey, the peer isn't authorised.
+    m_listener->onAuthentication(desc->sec_state.encrypted && desc->sec_state.authenticated, 0, address);
+}
+
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+MockTransport::MockTransport() {
+    m_listener = nullptr;
+    m_pin = 0;
+    m_notificationsCount = 0;
+    m_isConnected = false;
+}
+
+void MockTransport::begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) {
+    m_listener = listener;
+    m_pin = passkey;
+}
+
+BLECharacteristic* MockTransport::createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) {
+    // Each characteristic gets its own handle, like with a stack, so the confirmations find their characteristic and the
+    // recorded traffic can be replayed
+#if defined(ESP_BLE_CONTROLS_MOCK)
+    BLECharacteristic* characteristic = new BLECharacteristic(BLEUUID(uuid), m_characteristics.size() + 1);
+#else
+    BLECharacteristic* characteristic = new BLECharacteristic(BLEUUID(uuid));
+#endif
+    m_characteristics.push_back(characteristic);
+    return characteristic;
+}
+
+uint16_t MockTransport::getHandle(BLECharacteristic* characteristic) {
+    for (size_t index = 0; index < m_characteristics.size(); index++) {
+        if (m_characteristics[index] == characteristic) return index + 1;
+    }
+    return 0;
+}
+
+void MockTransport::notify(BLECharacteristic* characteristic) {
+    if (!m_isConnected) return;
+    m_notificationsCount++;
+    m_listener->onNotificationConfirmed(getHandle(characteristic), true);
+}
+
+static const BleAddress MOCK_PEER_ADDRESS = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+void MockTransport::simulateConnection(const bool isConnected, const bool shouldAuthenticate) {
+    if (isConnected == m_isConnected) return;
+    m_isConnected = isConnected;
+    m_listener->onConnection(isConnected, isConnected ? MOCK_PEER_ADDRESS : nullptr);
+    if (isConnected && shouldAuthenticate && m_pin != 0) simulateAuthentication(true);
+}
+
+void MockTransport::simulateAuthentication(const bool isSuccessful, const uint8_t failReason) {
+    if (m_isConnected) m_listener->onAuthentication(isSuccessful, failReason, MOCK_PEER_ADDRESS);
+}
+
+void MockTransport::simulateCongestion(const bool isCongested) {
+    m_listener->onCongestion(isCongested);
+}
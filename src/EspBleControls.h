@@ -1,22 +1,81 @@
 #ifndef EspBleControls_h
 #define EspBleControls_h
 
+#if defined(ESP_BLE_CONTROLS_NIMBLE)
+#include <NimBLEDevice.h> // Its compatibility macros map the BLE* class names used by the controls to the NimBLE classes
+#elif defined(ESP_BLE_CONTROLS_MOCK)
+#include "MockBle.h" // In memory characteristics without a Bluetooth stack, only the MockTransport is available
+#else
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#endif
 #include <Arduino.h>
+#include "ValueCodec.h"
 #include <ESP32Time.h>
+#include <sys/time.h>
 #include <bitset>
+#include <cstring>
+#include <type_traits>
+#include <string_view>
+#include <array>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
 #include <Preferences.h>
+#include <Update.h>
+#include <mbedtls/version.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/ecp.h>
+#include <esp_secure_boot.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #define SERVICE_UUID    "e5932b1e-c0de-da7a-7472-616e73666572" // SHOULD USE THIS SERVICE UUID OTHERWISE THE APP WILL FILTER OUT THE DEVICE
 #define NOTIFY_DELAY    1 // The delay that is needed after a device is connected to send notifications for the notifying controls
 #define PREFERENCES_ID  "control_values"
+#define LOAD_TEST_PREFERENCES_ID "load_test" // Throwaway namespace for the values saved by SimulatedCentral::run()
 #define DAY_MINUTES     1440
 #define DAY_HOURS       24
+#define DAY_SECONDS     86400
+#define WEEK_DAYS       7
+#define MONTH_DAYS      31
+#define YEAR_MONTHS     12
+
+#define PAIRING_TIMEOUT_SECONDS   30  // Time a connected device has to complete the authentication before it is disconnected
+#define READVERTISE_DELAY_MS      500 // Delay before advertising is restarted after a disconnection or a failed authentication
+#define PAIRING_EVENTS_QUEUE_SIZE 8
+#define MAX_BONDED_PEERS          4   // Bonded devices that can reconnect without pairing, the least recently used is forgotten when full
+#define BONDS_PREFERENCES_ID      "bonded_peers"
+#define TRAFFIC_PAYLOAD_SIZE      20  // Bytes of each write/notify payload kept by the traffic recorder, longer payloads are truncated
+#define TRAFFIC_PAGE_SIZE         512 // Maximum size of a traffic page read from the traffic dump characteristic
+#define LATENCY_SAMPLES_SIZE      512 // Latencies kept by the simulated central to compute the percentiles, the oldest are overwritten
+#define HISTORY_BYTES_PER_SAMPLE  3   // Average size of a delta encoded sample, the history keeps fewer samples if they are larger
+#define HISTORY_PERSIST_SAMPLES   6   // A persisted history is saved every few samples, to spare the flash
+#define HISTORY_PAGE_SIZE         512 // Maximum size of a history page read from the history characteristic
+#define HISTORY_DECODE_CHUNK      32  // Samples decoded in each critical section while a history page is written
+#define NOTIFICATIONS_IN_FLIGHT   4   // Notifications handed to the stack and not confirmed yet, the others wait in the queue
+#define NOTIFICATION_RETRIES      3   // Times a notification rejected by the stack is sent again before it is dropped
+#define NOTIFICATION_TIMEOUT_MS   1000 // Notifications not confirmed in this time are considered sent, so the queue never stalls
+#define SERVICE_HANDLES           127 // Attribute handles reserved for the service (Bluedroid), each control takes 3 or 4 of them
+#define OTA_WINDOW_CHUNKS         16  // Firmware chunks acknowledged at once, the app waits for the ack before sending the next window
+#define OTA_MAX_CHUNK_SIZE        509 // Largest firmware chunk: a 512 bytes write less the opcode and the sequence number
+#define OTA_RESTART_DELAY_MS      1000 // Delay between a successful update and the restart, so the last ack reaches the app
+#define WRITE_SEQUENCE_SIZE       3   // Optional trailer of high rate writes: a 0 byte followed by the uint16 sequence number
+#define SAVE_DEBOUNCE_MS          1000 // High rate values are saved once the writes stop for this long, instead of after each write
+#define XY_RELEASE_PERIODS        3   // Write periods without a write after which a held XY pad that returns to the centre is released
+#define XY_RELEASE_MIN_MS         250 // Shortest release time, so the gaps of a busy link don't release a held pad at high rates
+#define CLOCK_SYNC_SIZE           10  // Millisecond clock sync write: app epoch milliseconds (uint64) and the measured round trip (uint16)
+#define CLOCK_STEP_THRESHOLD_MS   2000 // Clock offsets up to this are slewed, larger ones are stepped
+#define CLOCK_SLEW_DIVIDER        64  // A VirtualClock is slewed by 1 ms every this many ms
+#define CLOCK_DRIFT_MIN_SECONDS   900 // Shortest time over which the drift is estimated, on shorter ones the link latency dominates
+#define CLOCK_DRIFT_PERIOD_MS     10000 // How often the estimated drift is corrected between the syncs
+#define CLOCK_MAX_DRIFT_PPM       500
 
 // The characteristic descriptor contains the label of the control
 // The UUID should describe the control type and parameters, following these rules: 
@@ -25,22 +84,39 @@
 // The last part, let's call it CID, helps the app identify the control type
 // The last byte represents the number of instances of that control
 
+// Released versions give count 01 to every instance of a control type, so two sliders share the UUID suffix and the saved value.
+// Defining ESP_BLE_CONTROLS_NUMBERED_INSTANCES numbers the instances of each type from 01. The first instance keeps its UUID,
+// the others get new UUIDs and saved value keys, so the app sees them as new controls and their values start from the initial ones.
+#if defined(ESP_BLE_CONTROLS_NUMBERED_INSTANCES)
+#define NUMBERED_INSTANCES     true
+#else
+#define NUMBERED_INSTANCES     false
+#endif
+
 #define CHAR_UUID_PREFIX       "e5932b1e"
 
 #define CLRPF_UUID_SUFFIX      "636c727066" // ID for a unique characteristic that is used to clear preferences and reset
-#define CLOCK_UUID_SUFFIX      "636c6f636b" // ID-updateInterval-0000-0000-CID+count
+#define CLOCK_UUID_SUFFIX      "636c6f636b" // ID-updateInterval-syncVersion-0000-CID+count -> syncVersion 1 accepts the millisecond sync
 #define INTRV_UUID_SUFFIX      "696e747276" // ID-divisions-updateInterval-0000-CID+count -> divisions multiple of 24, min 24, max 1440
 #define SWTCH_UUID_SUFFIX      "7377746368" // ID-0000-0000-0000-CID+count
 #define SLIDR_UUID_SUFFIX      "736c696472" // ID-minValue-maxValue-steps-CID+count -> min/max between -32767..32767
 #define STRNG_UUID_SUFFIX      "7374726e67" // ID-size-0000-0000-CID+count -> size between 1..512
 #define INTGR_UUID_SUFFIX      "696e746772" // ID-minValue-maxValue-0000-CID+count -> min/max between -32767..32767 if min/max 0 full 32bit int
 #define FLOAT_UUID_SUFFIX      "666c6f6174" // ID-minValue-maxValue-0000-CID+count -> min/max between -32767..32767 if min/max 0 full 32bit float
+#define DECML_UUID_SUFFIX      "6465636d6c" // ID-minValue-maxValue-digits-CID+count -> int32 scaled by 10^digits, min/max in whole units, digits 0..9
 #define ANGLE_UUID_SUFFIX      "616e676c65" // ID-isCompass-0000-0000-CID+count
 #define MOMNT_UUID_SUFFIX      "6d6f6d6e74" // ID-0000-0000-0000-CID+count
-#define COLOR_UUID_SUFFIX      "636f6c6f72" // ID-0000-0000-0000-CID+count
+#define COLOR_UUID_SUFFIX      "636f6c6f72" // ID-isRgbw-0000-0000-CID+count -> value is the hex string RRGGBB or RRGGBBWW
 #define DAYOM_UUID_SUFFIX      "6461796f6d" // ID-days-multi-0000-CID+count -> days of month (between 28-31), allow multiple choices
 #define WEEKD_UUID_SUFFIX      "7765656b64" // ID-multi-0000-0000-CID+count -> allow multiple choices
 #define MONTH_UUID_SUFFIX      "6d6f6e7468" // ID-multi-0000-0000-CID+count -> allow multiple choiced
+#define TRFIC_UUID_SUFFIX      "7472666963" // ID-capacity-0000-0000-CID+count -> write the first sequence number, read a page of records
+#define HISTR_UUID_SUFFIX      "6869737472" // ID-capacity-sampleSeconds-0000-CID+count -> write the first sequence number, read a page of samples
+#define TRANS_UUID_SUFFIX      "7472616e73" // ID-0000-0000-0000-CID+count -> write a batch of (CID+count, length, value) records
+#define TRANSACTION_ID_SIZE    6            // the CID+count part of the characteristic UUID, as bytes, that starts each transaction record
+#define FWOTA_UUID_SUFFIX      "66776f7461" // ID-windowChunks-0000-0000-CID+count -> write START/DATA/END/ABORT messages, the acks are notified
+#define PUSHB_UUID_SUFFIX      "7075736862" // ID-isNC-holdMillis-0000-CID+count -> one byte, 1 pressed 0 released, refreshed every holdMillis / 2 while held
+#define XYPAD_UUID_SUFFIX      "7879706164" // ID-maxX-maxY-rate-CID+count -> axes between -max..max, rate is the writes per second while held (1..100), negative if the pad returns to the centre
 
 enum UuidSection {
     PREFIX, PARAM1, PARAM2, PARAM3, SUFFIX, CHARID
@@ -50,83 +126,676 @@ enum CallbackType {
     NONE, INTEGER, FLOAT, STRING, VECTOR 
 };
 
+enum PairingState {
+    DISCONNECTED, AWAITING_AUTH, AUTHORISED, REJECTED
+};
+
+enum PairingEventType {
+    DEVICE_CONNECTED, DEVICE_DISCONNECTED, AUTH_SUCCEEDED, AUTH_FAILED
+};
+
+enum PairingFailure {
+    NO_FAILURE, AUTH_TIMEOUT, AUTH_REJECTED, LINK_LOST
+};
+
+enum ResetMode {
+    HARD_RESET, SOFT_RESET
+};
+
+enum CalendarType {
+    DAYS_OF_WEEK, DAYS_OF_MONTH, MONTHS_OF_YEAR
+};
+
+enum TrafficEventType {
+    WRITE_EVENT, NOTIFY_EVENT, CONNECT_EVENT, DISCONNECT_EVENT, AUTH_EVENT
+};
+
+enum Easing {
+    LINEAR, EASE_IN, EASE_OUT, EASE_IN_OUT
+};
+
+enum PendingReset {
+    NO_RESET, RESTORE_SAVED_VALUES, RESTORE_INITIAL_VALUES
+};
+
+enum OtaOpcode {
+    OTA_START = 1, OTA_DATA = 2, OTA_END = 3, OTA_ABORT = 4
+};
+
+enum OtaStatus {
+    OTA_IDLE, OTA_READY, OTA_WINDOW_ACK, OTA_OUT_OF_SEQUENCE, OTA_CRC_ERROR, OTA_SIZE_ERROR, OTA_WRITE_ERROR, OTA_DONE, OTA_SIGNATURE_ERROR
+};
+
+typedef uint8_t BleAddress[6]; // Most significant byte first, as it is displayed
+
+struct PairingEvent {
+    PairingEventType type;
+    uint8_t reason;
+    uint32_t timeStamp;
+    BleAddress address;
+};
+
+struct PairingStats {
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t failures;
+    uint32_t lastDurationMs;
+    PairingFailure lastFailure;
+    uint8_t lastFailReason; // The esp_ble_auth_cmpl_t fail_reason reported by the stack for the last AUTH_REJECTED failure
+    uint32_t bondedReconnections;
+    uint32_t lastReconnectionMs; // Time from connection to authorisation for the last bonded device that reconnected
+};
+
+struct NotificationStats {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t superseded; // Values replaced by a newer one before they were sent, only the latest value of a control is sent
+    uint32_t retries;
+    uint32_t dropped; // Notifications given up after NOTIFICATION_RETRIES or discarded when the device disconnected
+    uint32_t congestions;
+    uint16_t maxPending;
+};
+
+struct BondedPeer {
+    BleAddress address;
+    uint32_t lastUsed;
+};
+
+// -----------------------------------------------------> CLOCK SOURCE <------------------------------------------------------------------
+// The controls, schedules and timers read the time from the current clock source. SystemClock uses millis() and the RTC of the
+// ESP32, a VirtualClock only moves when it's advanced, so EspBleControlsFactory::simulate() can run days of schedules in a moment.
+// The pairing and notification timeouts, the traffic records and their replay, the OTA restart delay and the momentary watchdog
+// read it too, so a simulation that holds a VirtualClock must advance it for them. Only the debounced saves and the load test
+// keep using millis(), they wait for the flash and the Bluetooth stack.
+
+class ClockSource {
+public:
+    virtual ~ClockSource() {};
+    virtual uint32_t getMillis() = 0; // Milliseconds since the start, like millis()
+    virtual uint32_t getEpoch() = 0;
+    virtual uint16_t getEpochMillis() = 0; // Milliseconds elapsed in the current epoch second
+    virtual void setEpoch(const uint32_t epoch, const uint16_t epochMillis = 0) = 0;
+    //Moves the epoch by offsetMillis gradually, added to the slew still in progress, so the time never jumps.
+    virtual void slewEpoch(const int32_t offsetMillis) = 0;
+    //Milliseconds since 1970, read again if the second changed in between.
+    uint64_t getEpochTime();
+};
+
+class SystemClock : public ClockSource {
+public:
+    uint32_t getMillis() override { return millis(); };
+    uint32_t getEpoch() override { return espClock.getEpoch(); };
+    uint16_t getEpochMillis() override { return espClock.getMillis(); };
+    // ESP32Time takes the fraction of the second in microseconds
+    void setEpoch(const uint32_t epoch, const uint16_t epochMillis = 0) override { espClock.setTime(epoch, epochMillis * 1000); };
+    //Slews with adjtime(), the system clock runs slightly faster or slower until the offset is absorbed.
+    void slewEpoch(const int32_t offsetMillis) override;
+private:
+    ESP32Time espClock;
+};
+
+class VirtualClock : public ClockSource {
+public:
+    VirtualClock(const uint32_t epoch = 0) { m_millis = 0; m_slewMillis = 0; m_slewBudget = 0; setEpoch(epoch); };
+    uint32_t getMillis() override { return m_millis; };
+    uint32_t getEpoch() override { return m_epoch + (m_millis - m_epochSetMillis) / 1000; };
+    uint16_t getEpochMillis() override { return (m_millis - m_epochSetMillis) % 1000; };
+    void setEpoch(const uint32_t epoch, const uint16_t epochMillis = 0) override { 
+        m_epoch = epoch;
+        m_epochSetMillis = m_millis - epochMillis;
+        m_slewMillis = 0;
+    };
+    void slewEpoch(const int32_t offsetMillis) override { m_slewMillis += offsetMillis; };
+    //Moves the time forward, like millis() it wraps around after about 49 days. A slew moves the epoch by 1 ms every
+    //CLOCK_SLEW_DIVIDER ms.
+    void advance(const uint32_t milliseconds);
+private:
+    uint32_t m_millis;
+    uint32_t m_epoch;
+    uint32_t m_epochSetMillis; // m_millis when the epoch was set
+    int32_t m_slewMillis; // Offset still to be slewed
+    uint32_t m_slewBudget; // Milliseconds advanced that didn't slew a whole millisecond yet
+};
+
+//The clock source used by the library, the SystemClock unless another one was set. Set it before creating the controls.
+ClockSource* getClockSource();
+//Sets the clock source used by the library, nullptr restores the SystemClock.
+void setClockSource(ClockSource* clockSource);
+
+// -----------------------------------------------------> BOND TABLE CLASS <-----------------------------------------------------------------
+// Keeps the devices that completed pairing, so they can be authorised with the stored keys when they reconnect.
+// The table is bounded, when it is full the least recently used device is removed from the table and from the stack bonds.
+
+class BleTransport;
+
+class BondTable {
+public:
+    BondTable(const uint8_t capacity = MAX_BONDED_PEERS);
+    void setTransport(BleTransport* transport) { m_transport = transport; };
+    void load();
+    bool contains(const uint8_t* address);
+    void touch(const uint8_t* address);
+    void remove(const uint8_t* address);
+    //Removes all the bonds, except the one of keptAddress if it's not nullptr (ex. the peer connected now).
+    void clear(const uint8_t* keptAddress = nullptr);
+private:
+    void save();
+    std::vector<BondedPeer> m_peers;
+    BleTransport* m_transport;
+    uint8_t m_capacity;
+    uint32_t m_useCounter;
+};
+
+// -----------------------------------------------------> VALUE CODEC <---------------------------------------------------------------------
+// The decoding and encoding of the numeric values are in ValueCodec.h, it doesn't depend on the BLE stack so it's built on the host too.
+
+template <typename ValueType>
+void setCharacteristicValue(BLECharacteristic* characteristic, const ValueType value) {
+    uint8_t bytes[encodedSize<ValueType>()];
+    characteristic->setValue(bytes, encodeValue(value, bytes, sizeof(bytes)));
+}
+
+inline void setCharacteristicValue(BLECharacteristic* characteristic, std::string_view value) {
+    characteristic->setValue((uint8_t*) value.data(), value.length());
+}
+
+inline void setCharacteristicValue(BLECharacteristic* characteristic, const std::string& value) {
+    setCharacteristicValue(characteristic, std::string_view(value));
+}
+
+// Bluedroid gives access to the characteristic value buffer, NimBLE returns a copy taken under the attribute lock.
+// Both have data() and length(), so the value is read the same way with either stack (without a copy with Bluedroid).
+
+#if defined(ESP_BLE_CONTROLS_NIMBLE)
+typedef NimBLEAttValue CharacteristicValue;
+typedef int CharacteristicStatusCode;
+
+inline CharacteristicValue getCharacteristicValue(BLECharacteristic* characteristic) {
+    return characteristic->getValue();
+}
+#else
+struct CharacteristicValue {
+    const uint8_t* m_data;
+    size_t m_length;
+    const uint8_t* data() const { return m_data; };
+    size_t length() const { return m_length; };
+};
+typedef uint32_t CharacteristicStatusCode;
+
+inline CharacteristicValue getCharacteristicValue(BLECharacteristic* characteristic) {
+    return { characteristic->getData(), characteristic->getLength() };
+}
+#endif
+
+// -----------------------------------------------------> TRAFFIC RECORDER CLASS <---------------------------------------------------------
+// A ring buffer with the last writes, notifications, connections and authentications, to reproduce what happened in the field.
+// Records are numbered with a sequence that keeps growing, the oldest records are overwritten when the buffer is full.
+
+struct TrafficRecord {
+    uint32_t timeStamp;
+    uint16_t handle;   // Characteristic handle for writes and notifications, 0 for connection events
+    uint8_t type;      // TrafficEventType
+    uint8_t length;    // Length of the original payload, only the first TRAFFIC_PAYLOAD_SIZE bytes are kept
+    uint8_t payload[TRAFFIC_PAYLOAD_SIZE];
+};
+
+class TrafficRecorder {
+public:
+    TrafficRecorder(const uint16_t capacity, BleTransport* transport = nullptr);
+    void record(const TrafficEventType type, const uint16_t handle, const uint8_t* payload, const size_t length);
+    //Records the event with the handle the transport gives to the characteristic.
+    void recordCharacteristic(const TrafficEventType type, BLECharacteristic* characteristic, const uint8_t* payload, const size_t length);
+    bool get(const uint32_t sequence, TrafficRecord& record);
+    uint32_t getFirstSequence();
+    uint32_t getNextSequence() { return m_nextSequence; };
+    size_t writePage(uint32_t fromSequence, uint8_t* page, const size_t capacity);
+    //Adds the records of a page written by writePage() (ex. read from the dump characteristic), with their original time stamps,
+    //so the traffic of a device can be replayed on another one or on the host. Returns how many records were added.
+    uint16_t readPage(const uint8_t* page, const size_t length);
+    void dump(Print& output);
+    void clear();
+    //While paused nothing is recorded, ex. during a replay, so the replayed records aren't overwritten.
+    void setPaused(const bool isPaused) { m_isPaused = isPaused; };
+private:
+    void add(const TrafficRecord& record);
+    std::vector<TrafficRecord> m_records;
+    BleTransport* m_transport;
+    bool m_isPaused;
+    uint32_t m_nextSequence;
+    uint32_t m_count;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class TrafficDumpCallback : public BLECharacteristicCallbacks {
+public:
+    TrafficDumpCallback(TrafficRecorder* recorder, bool* isDeviceAuthorised);
+    void onWrite(BLECharacteristic* pChar) override;
+    void onRead(BLECharacteristic* pChar) override;
+private:
+    TrafficRecorder* m_recorder;
+    uint32_t m_cursor;
+    bool* m_pIsDeviceAuthorised;
+};
+
+// -----------------------------------------------------> HISTORY BUFFER CLASS <-----------------------------------------------------------
+// Ring buffer of the last samples of a value. Each sample is stored as the difference from the previous one: the time in sample
+// intervals and the value zigzag encoded, both as varints, so a slowly changing value takes 2 bytes per sample. Only the oldest
+// sample is kept as absolute values. Samples are numbered with a sequence that keeps growing, like the traffic records.
+
+class HistoryBuffer {
+public:
+    HistoryBuffer(const uint16_t capacity, const uint16_t sampleSeconds);
+    void add(const uint32_t epoch, const int32_t value);
+    uint32_t getFirstSequence() { return m_nextSequence - m_count; };
+    uint32_t getNextSequence() { return m_nextSequence; };
+    uint16_t getCount() { return m_count; };
+    size_t writePage(uint32_t fromSequence, uint8_t* page, const size_t capacity);
+    std::vector<uint8_t> serialize();
+    bool deserialize(const uint8_t* data, const size_t length);
+    void clear();
+private:
+    struct SampleState {
+        uint32_t sequence;
+        uint32_t epoch;
+        int32_t value;
+    };
+    struct Cursor {
+        SampleState state;
+        size_t position; // Where the record of the sample after state starts in m_bytes
+        uint32_t resets; // m_resets when the cursor was taken
+    };
+    void push(const uint8_t* bytes, const size_t length);
+    static size_t readDelta(const std::vector<uint8_t>& bytes, size_t position, uint32_t& intervals, int32_t& valueDelta);
+    void removeOldest();
+    bool isValid(const Cursor& cursor);
+    size_t advance(Cursor& cursor);
+    std::vector<uint8_t> m_bytes;
+    uint32_t m_resets; // Clears and loads, the records a cursor points to are gone after one of them
+    size_t m_start;
+    size_t m_used;
+    uint16_t m_capacity;
+    uint16_t m_sampleSeconds;
+    uint16_t m_count;
+    uint32_t m_nextSequence;
+    SampleState m_oldest;
+    SampleState m_newest;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class HistoryCallback : public BLECharacteristicCallbacks {
+public:
+    //The writes are recorded if the recorder the factory points to is enabled, also if it's enabled later.
+    HistoryCallback(HistoryBuffer* history, bool* isDeviceAuthorised, TrafficRecorder** recorder = nullptr);
+    void onWrite(BLECharacteristic* pChar) override;
+    void onRead(BLECharacteristic* pChar) override;
+private:
+    HistoryBuffer* m_history;
+    uint32_t m_cursor;
+    bool* m_pIsDeviceAuthorised;
+    TrafficRecorder** m_ppRecorder;
+};
+
+// -----------------------------------------------------> LATENCY SAMPLES CLASS <----------------------------------------------------------
+
+class LatencySamples {
+public:
+    LatencySamples(const uint16_t capacity = LATENCY_SAMPLES_SIZE);
+    void add(const uint32_t latencyMicros);
+    uint32_t getPercentile(const uint8_t percent);
+    uint32_t getCount() { return m_count; };
+    uint32_t getMax() { return m_max; };
+    void clear();
+private:
+    std::vector<uint32_t> m_samples;
+    uint32_t m_count;
+    uint32_t m_max;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
 // -----------------------------------------------------> CHARACTERISTIC CALLBACK CLASS <---------------------------------------------------
 // TODO : It would be nice to have the one generic constructor to create the callback
 
+class ControlNotifier;
+class BleTransport;
+
 class CharacteristicCallback : public BLECharacteristicCallbacks {
 public:
-    CharacteristicCallback(std::function<void(long)>, bool* isDeviceAuthorised);
+    CharacteristicCallback(std::function<void(int32_t)>, bool* isDeviceAuthorised);
     CharacteristicCallback(std::function<void(float)>, bool* isDeviceAuthorised);
-    CharacteristicCallback(std::function<void(std::string)>, bool* isDeviceAuthorised);
+    CharacteristicCallback(std::function<void(std::string_view)>, bool* isDeviceAuthorised);
     CharacteristicCallback(std::function<void(std::vector<char>)>, bool* isDeviceAuthorised);
 
     const CallbackType getValueType();
+    //Runs the callback with the value of the characteristic. A numeric value that is too short is not decoded,
+    //the characteristic gets back the last valid value instead.
     void executeCallback(BLECharacteristic* pChar, bool saveValues);
+    void keepValidValue(BLECharacteristic* pChar);
+    //Checks a value before it's written to the characteristic: numeric values must have their exact size and the validator must accept it.
+    bool isValidValue(const uint8_t* bytes, const size_t length);
 
     void onWrite(BLECharacteristic* pChar) override {
-        if (*m_pIsDeviceAuthorised) executeCallback(pChar, true);
+        if (m_recorder != nullptr) record(WRITE_EVENT, pChar);
+        if (!*m_pIsDeviceAuthorised) return;
+        if (m_isSequenced && !acceptSequence(pChar)) return;
+        executeCallback(pChar, true);
+    }
+
+    void onNotify(BLECharacteristic* pChar) override {
+        if (m_recorder != nullptr) record(NOTIFY_EVENT, pChar);
+    }
+
+    //Runs a recorded write again like onWrite(), the sequence trailer included, but doesn't save the value.
+    void replayWrite(BLECharacteristic* pChar) {
+        if (m_isSequenced && !acceptSequence(pChar)) return;
+        executeCallback(pChar, false);
     }
 
+    void onStatus(BLECharacteristic* pChar, Status status, CharacteristicStatusCode code) override;
+
+    void setRecorder(TrafficRecorder* recorder) { m_recorder = recorder; };
+    void setSaveLatencyProbe(LatencySamples* probe) { m_saveLatencyProbe = probe; };
+    //The values are saved in the PREFERENCES_ID namespace, the load test saves them elsewhere.
+    void setPreferencesId(const char* preferencesId) { m_preferencesId = preferencesId; };
+    void setNotifier(ControlNotifier* notifier) { m_notifier = notifier; };
+    // High rate controls accept writes without response, which can arrive out of order, so the app may append
+    // a sequence trailer to each write: older or repeated sequence numbers are dropped until the next connection
+    void setSequenced(const bool isSequenced) { m_isSequenced = isSequenced; };
+    //Values that are never saved (ex. a joystick position) don't start the task that saves them.
+    void setPersistent(const bool isPersistent) { m_isPersistent = isPersistent; };
+    //A value rejected by the validator isn't passed to the callback nor saved, the characteristic gets back the last valid value.
+    void setValidator(std::function<bool(std::string_view)> validator) { m_validator = validator; };
+    //The sequenced (high rate) values aren't saved by a task for each write: the last one is saved from the loop task,
+    //once the writes stopped for SAVE_DEBOUNCE_MS or right away if isForced. The value saved is the copy taken by the write.
+    void savePendingValue(BLECharacteristic* pChar, const bool isForced);
+    void cancelPendingSave();
+    void resetSequence() { m_hasSequence = false; };
+    uint32_t getStaleWrites() { return m_staleWrites; };
+    static void saveValue(Preferences& preferences, BLECharacteristic* pChar, const CallbackType type);
+    static void saveValue(Preferences& preferences, BLECharacteristic* pChar, const uint8_t* bytes, const size_t length, const CallbackType type);
+
 private: 
     struct SaveDataParams {
         BLECharacteristic* pChar;
         CallbackType type;
-    } m_saveDataParams;
+        uint32_t writeTimeStamp; // micros() when the write was received, to measure the persistence latency
+        LatencySamples* latencyProbe;
+        const char* preferencesId;
+    };
     static void saveValuesTask(void* params);
+    void record(const TrafficEventType type, BLECharacteristic* pChar);
+    bool acceptSequence(BLECharacteristic* pChar);
+    void restoreValidValue(BLECharacteristic* pChar);
     TaskHandle_t saveValuesTaskHandle = NULL;
-    std::function<void(long)> m_pIntFunc= nullptr;
+    std::function<void(int32_t)> m_pIntFunc= nullptr;
     std::function<void(float)> m_pFloatFunc = nullptr;
-    std::function<void(std::string)> m_pStringFunc = nullptr;
+    std::function<void(std::string_view)> m_pStringFunc = nullptr;
     std::function<void(std::vector<char>)> m_pVectFunc = nullptr;
+    std::function<bool(std::string_view)> m_validator = nullptr;
+    TrafficRecorder* m_recorder = nullptr;
+    LatencySamples* m_saveLatencyProbe = nullptr;
+    const char* m_preferencesId = PREFERENCES_ID;
+    ControlNotifier* m_notifier = nullptr;
     bool* m_pIsDeviceAuthorised;
+    bool m_isSequenced = false;
+    bool m_isPersistent = true;
+    bool m_hasSequence = false;
+    uint16_t m_lastSequence = 0;
+    uint32_t m_staleWrites = 0;
+    portMUX_TYPE m_saveLock = portMUX_INITIALIZER_UNLOCKED;
+    bool m_isSavePending = false;
+    uint32_t m_pendingSaveTimeStamp = 0; // millis() of the last write waiting to be saved
+    uint32_t m_pendingWriteTimeStamp = 0; // micros() of the same write, to measure the persistence latency
+    std::string m_pendingValue; // Copy of the same write, the loop task doesn't read the characteristic the Bluetooth task writes
+    std::string m_lastValue; // Last accepted value, restored in the characteristic when a stale write is dropped
+    std::string m_validValue; // Last numeric value that was decoded, restored in the characteristic when a write is too short
 };
 
 // -----------------------------------------------------> CONTOL OBSERVER CLASS <-----------------------------------------------------------
 
-class BLEControl {
+class PublisherObserver {
 public:
     virtual void update() = 0;
+};
+
+// Sends the control notifications through a bounded queue with a single slot for each characteristic. The slot only marks that
+// the characteristic has to be notified and the latest value is read when it is sent, so a value changed again before it was sent
+// is superseded, not queued. The queue is drained while the stack is not congested, as the sent notifications are confirmed,
+// and the notifications rejected by the stack are retried, so the app always ends up with the final values.
+// While the notifier is held (ex. while a transaction is applied) nothing is sent, so the app never sees the intermediate values.
+
+class ControlNotifier {
+public:
+    ControlNotifier();
+    void setTransport(BleTransport* transport);
+    void addCharacteristic(BLECharacteristic* characteristic);
+    void notify(BLECharacteristic* characteristic);
+    void hold();
+    void release();
+    void send();
+    void onStatus(BLECharacteristic* characteristic, BLECharacteristicCallbacks::Status status);
+    void onConfirmed(const uint16_t handle, const bool isSuccessful);
+    void onCongestion(const bool isCongested);
+    void clear();
+    NotificationStats getStats();
+private:
+    struct NotificationSlot {
+        BLECharacteristic* characteristic;
+        bool isPending;
+        uint8_t retries;
+    };
+    int16_t findSlot(BLECharacteristic* characteristic);
+    int16_t findSlot(const uint16_t handle);
+    void enqueue(const uint16_t slotIndex);
+    void retry(const int16_t slotIndex);
+    std::vector<NotificationSlot> m_slots;
+    std::vector<uint16_t> m_queue; // Ring of slot indexes, a slot is queued at most once so it never overflows
+    uint16_t m_queueHead;
+    uint16_t m_queueCount;
+    BleTransport* m_transport;
+    uint8_t m_holdCount;
+    uint8_t m_inFlight;
+    bool m_isCongested;
+    bool m_isSending;
+    bool m_confirmsSends;
+    uint32_t m_lastSendTimeStamp;
+    NotificationStats m_stats;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+class BLEControl : public PublisherObserver {
+public:
     virtual void setCharacteristic(BLECharacteristic* bleCharacteristic) = 0;
     virtual BLECharacteristic* getCharacteristic() = 0;
     virtual CharacteristicCallback* getCallback() = 0;
+    void setNotifier(ControlNotifier* notifier) { m_notifier = notifier; };
+protected:
+    void notifyValue(BLECharacteristic* bleCharacteristic) {
+        if (m_notifier != nullptr) m_notifier->notify(bleCharacteristic);
+        else bleCharacteristic->notify();
+    };
+    ControlNotifier* m_notifier = nullptr;
 };
 
 // -----------------------------------------------------> CONTROL PUBLISHER CLASS <-----------------------------------------------------------------
 
+// The value is passed around by reference, a string value is copied only once, when it's stored in the publisher.
+
 template <typename T>
 class ControlPublisher {
 private:
     T m_value;
-    std::vector<BLEControl*> observers;
-    std::function<void(T)> m_action;
-    BLEControl* m_sender;
+    std::vector<PublisherObserver*> observers;
+    std::function<void(const T&)> m_action;
+    PublisherObserver* m_sender;
     
 public:
-    void subscribe(BLEControl* observer) {
+    void subscribe(PublisherObserver* observer) {
         observers.push_back(observer);
         observer->update();
     }
 
-    T getValue() {
+    const T& getValue() {
         return m_value;
     }
 
-    void doOnSet(std::function<void(T)> action) {
+    void doOnSet(std::function<void(const T&)> action) {
         m_action = action;
     }
 
-    void setValue(T value, BLEControl* sender) {
-        if (value != m_value) {
+    //Reserves the storage for string values, so setting a value up to this length doesn't allocate memory
+    void reserve(const size_t capacity) {
+        if constexpr (std::is_same<T, std::string>::value) m_value.reserve(capacity);
+    }
+
+    template <typename ValueType>
+    void setValue(const ValueType& value, PublisherObserver* sender) {
+        if (!(m_value == value)) {
             m_value = value;
             m_sender = sender;
-            for (BLEControl* observer : observers) {
+            for (PublisherObserver* observer : observers) {
                 if(observer != m_sender) observer->update();
             }
-            if (m_action != nullptr) m_action(value);
+            if (m_action != nullptr) m_action(m_value);
         }
     }
 };
 
+// -----------------------------------------------------> DECIMAL <------------------------------------------------------------------------
+// Decimal values are kept as integers scaled by 10^fractionDigits (ex. 21.5 with 2 fraction digits is 2150),
+// so they can be used on microcontrollers without a FPU without any floating point math.
+
+#define MAX_FRACTION_DIGITS 9
+
+constexpr int32_t decimalScale(const uint8_t fractionDigits) {
+    int32_t scale = 1;
+    for (uint8_t digit = 0; digit < fractionDigits && digit < MAX_FRACTION_DIGITS; digit++) scale *= 10;
+    return scale;
+}
+
+//Writes the decimal value as text (ex. "-21.50") in the buffer, that should hold at least 13 characters. Returns the text length.
+size_t formatDecimal(const int32_t value, const uint8_t fractionDigits, char* text);
+
+// -----------------------------------------------------> COLOR <--------------------------------------------------------------------------
+
+struct RgbColor {
+    uint8_t red, green, blue, white;
+
+    constexpr uint32_t toPacked() const {
+        return ((uint32_t) white << 24) | ((uint32_t) red << 16) | ((uint32_t) green << 8) | blue; // 0xWWRRGGBB
+    }
+
+    static constexpr RgbColor fromPacked(const uint32_t packed) {
+        return { (uint8_t) (packed >> 16), (uint8_t) (packed >> 8), (uint8_t) packed, (uint8_t) (packed >> 24) };
+    }
+
+    constexpr bool operator==(const RgbColor& other) const { return toPacked() == other.toPacked(); }
+    constexpr bool operator!=(const RgbColor& other) const { return toPacked() != other.toPacked(); }
+};
+
+// Functions used only to compute the gamma tables at compile time, there is no floating point math at runtime
+
+constexpr double constexprLn(double value) {
+    double result = 0;
+    while (value < 0.5) { value *= 2; result -= 0.6931471805599453; }
+    const double z = (value - 1) / (value + 1);
+    double power = z;
+    for (int term = 1; term < 60; term += 2) {
+        result += 2 * power / term;
+        power *= z * z;
+    }
+    return result;
+}
+
+constexpr double constexprExp(double value) {
+    int halvings = 0;
+    while (value < -0.5) { value /= 2; halvings++; }
+    double result = 1, term = 1;
+    for (int index = 1; index < 30; index++) {
+        term *= value / index;
+        result += term;
+    }
+    for (; halvings > 0; halvings--) result *= result;
+    return result;
+}
+
+//Lookup table from an 8 bit color channel to a gamma corrected PWM duty cycle with OutputBits resolution.
+//The gamma is given in tenths (22 is a gamma of 2.2). Declare it constexpr so the table is computed by the compiler.
+template <uint16_t GammaTenths = 22, uint8_t OutputBits = 8>
+class GammaTable {
+public:
+    constexpr GammaTable() : m_values() {
+        const double maxOutput = (1UL << OutputBits) - 1;
+        for (size_t index = 1; index < m_values.size(); index++) {
+            m_values[index] = (uint16_t) (constexprExp(GammaTenths / 10.0 * constexprLn(index / 255.0)) * maxOutput + 0.5);
+        }
+    }
+
+    constexpr uint16_t operator[](const uint8_t value) const { return m_values[value]; }
+
+    //Duty cycle of the value dimmed to brightness (0..255), with integer math only
+    constexpr uint16_t scale(const uint8_t value, const uint8_t brightness) const {
+        return ((uint32_t) m_values[value] * brightness + 127) / 255;
+    }
+
+private:
+    std::array<uint16_t, 256> m_values;
+};
+
+// -----------------------------------------------------> XY POSITION <--------------------------------------------------------------------
+// The position of a XY pad travels as one int32, x in the low and y in the high 16 bits, so both axes arrive in the same write.
+
+struct XYPosition {
+    int16_t x, y;
+
+    constexpr uint32_t toPacked() const { return ((uint32_t) (uint16_t) y << 16) | (uint16_t) x; }
+    static constexpr XYPosition fromPacked(const uint32_t packed) { return { (int16_t) (packed & 0xFFFF), (int16_t) (packed >> 16) }; }
+
+    constexpr bool isCentered() const { return x == 0 && y == 0; }
+    constexpr bool operator==(const XYPosition& other) const { return x == other.x && y == other.y; }
+    constexpr bool operator!=(const XYPosition& other) const { return !(*this == other); }
+};
+
+// -----------------------------------------------------> TRANSITION ENGINE CLASS <--------------------------------------------------------
+// Fades outputs (ex. PWM channels) to the values of the publishers they are attached to, with fixed point math only.
+// The publishers keep the target value, so only the final value is notified and saved, the intermediate values go only to the outputs.
+
+#define TRANSITION_ONE  65536 // 1.0 in the 16.16 fixed point format used for the progress of the transitions
+
+class TransitionEngine {
+public:
+    TransitionEngine(const uint16_t tickMs);
+
+    //Every time the publisher value changes, the output is faded from its current value to the new one in durationMs.
+    void attach(ControlPublisher<int32_t>* publisher, const uint16_t durationMs, const Easing easing, std::function<void(int32_t)> output);
+    void attach(ControlPublisher<RgbColor>* publisher, const uint16_t durationMs, const Easing easing, std::function<void(const RgbColor&)> output);
+    void update();
+    bool isRunning();
+    static int32_t ease(const Easing easing, const int32_t progress);
+
+private:
+    class Channel : public PublisherObserver {
+    public:
+        Channel(const uint16_t durationMs, const Easing easing, const uint8_t componentsCount);
+        void update() override;
+        bool step(const uint32_t timeStamp);
+        bool isRunning() { return m_isRunning; };
+        std::function<void(int32_t* components)> readTarget;
+        std::function<void(const int32_t* components)> writeOutput;
+    private:
+        int32_t m_from[4], m_to[4], m_current[4];
+        uint8_t m_componentsCount;
+        uint16_t m_durationMs;
+        Easing m_easing;
+        uint32_t m_startTimeStamp;
+        bool m_isRunning;
+        bool m_hasValue;
+        portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED; // update() and step() run in different tasks
+    };
+    std::vector<Channel*> m_channels;
+    uint16_t m_tickMs;
+    uint32_t m_lastTickTimeStamp;
+};
+
 // -----------------------------------------------------> INTERVAL CONTROL CLASS <----------------------------------------------------------
 
 class IntervalControl : public BLEControl {
@@ -136,18 +805,83 @@ public:
     void setCharacteristic(BLECharacteristic* bleCharacteristic) override { m_bleCharacteristic = bleCharacteristic; };
     BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
     void update() override;
+    //1 if the current division of the day is on, 0 if it's off, -1 if the intervals aren't set.
+    int8_t getState();
+    const std::vector<char>& getIntervals() { return m_intervals; };
+    uint32_t getRevision() { return m_revision; };
 private:
-    ESP32Time espClock;
     BLECharacteristic* m_bleCharacteristic;
     std::vector<char> m_intervals;
     bool* m_isDeviceAuthorised;
     uint16_t m_checkDelaySeconds;
     uint32_t m_lastUpdateTimeStamp;
+    uint32_t m_revision;
     std::function<void(bool)> m_onIntervalToggle;
     std::function<void(std::vector<char>)> m_callback;
 };
 
+// ------------------------------------------------------> CALENDAR CONTROL CLASS <---------------------------------------------------------
+// Selection of days of the week (index 0 is Sunday), days of the month (index 0 is the 1st) or months (index 0 is January).
+// The value is a bit vector, first item in the most significant bit of the first byte, like the Interval control.
+
+class CalendarControl : public BLEControl {
+public:
+    CalendarControl(const CalendarType calendarType, const uint32_t initialSelection, bool* isDeviceAuthorised);
+    CharacteristicCallback* getCallback() override { return new CharacteristicCallback(m_callback, m_isDeviceAuthorised); };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override { m_bleCharacteristic = bleCharacteristic; };
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override {};
+    bool matches(const struct tm& date);
+    uint32_t getRevision() { return m_revision; };
+private:
+    BLECharacteristic* m_bleCharacteristic;
+    CalendarType m_calendarType;
+    std::vector<char> m_selection;
+    bool* m_isDeviceAuthorised;
+    uint32_t m_revision;
+    std::function<void(std::vector<char>)> m_callback;
+};
+
+// ------------------------------------------------------> SCHEDULE CLASS <-----------------------------------------------------------------
+// Combines Interval controls with the Calendar controls that enable them. The schedule is ON when any rule is ON, and a rule is ON
+// when all its calendars match the current date and its interval is ON. The rules that apply today are compiled into a sorted
+// list of transitions, rebuilt when the day changes or one of the controls is written, so a check is only a binary search.
+
+class ScheduleControl {
+public:
+    ScheduleControl(const uint16_t checkDelaySeconds, std::function<void(bool)> onScheduleToggle);
+    void addRule(IntervalControl* interval, std::vector<CalendarControl*> calendars);
+    void update();
+    bool getState(); // Whether the rules turn the schedule on now, without running onScheduleToggle
+    uint32_t getNextTransition(); // Epoch of the next state change, or of the next midnight if the state doesn't change today
+private:
+    struct ScheduleRule {
+        IntervalControl* interval;
+        std::vector<CalendarControl*> calendars;
+    };
+    struct Transition {
+        uint32_t daySecond;
+        bool isOn;
+    };
+    void compile(const uint32_t epoch);
+    uint32_t getRulesRevision();
+    std::vector<ScheduleRule> m_rules;
+    std::vector<Transition> m_transitions;
+    uint16_t m_checkDelaySeconds;
+    uint32_t m_lastUpdateTimeStamp;
+    uint32_t m_compiledDay;
+    uint32_t m_compiledRevision;
+    bool m_isCompiled;
+    int8_t m_lastState;
+    std::function<void(bool)> m_onScheduleToggle;
+};
+
 // ------------------------------------------------------> CLOCK CONTROL CLASS <------------------------------------------------------------
+// The app sets the time by writing the epoch (uint32), which steps the clock, or with a millisecond sync (little endian):
+//   epoch milliseconds when the write was sent (uint64), round trip of the previous write with response in milliseconds (uint16)
+// The time is compensated by half the round trip and offsets up to CLOCK_STEP_THRESHOLD_MS are slewed, so the intervals and
+// schedules never see the time jump. The offsets that build up between the syncs give the drift of the clock, which is then
+// corrected every CLOCK_DRIFT_PERIOD_MS until the next sync.
 
 class ClockControl : public BLEControl {
 public:
@@ -156,20 +890,38 @@ public:
     void setCharacteristic(BLECharacteristic* bleCharacteristic) override { m_bleCharacteristic = bleCharacteristic; };
     BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
     void update() override;
+    //Sets the clock to the reference time (epoch milliseconds), slewing it if the offset is small.
+    void synchronize(const uint64_t referenceMillis);
+    //Reference time less the clock time at the last sync, in milliseconds.
+    int32_t getLastOffset() { return m_lastOffset; };
+    //Estimated drift in parts per billion, positive if the clock runs slow. 0 until two syncs CLOCK_DRIFT_MIN_SECONDS apart.
+    int32_t getDriftPpb() { return m_driftPpb; };
+    uint32_t getSyncCount() { return m_syncCount; };
 private:
-    ESP32Time espClock;
+    void correctDrift();
     BLECharacteristic* m_bleCharacteristic;
     uint16_t m_notifyDelaySeconds;
     uint32_t m_lastUpdateTimeStamp;
     bool* m_isDeviceAuthorised;
-    std::function<void(int32_t)> m_onTimeSet, m_callback;
+    std::function<void(int32_t)> m_onTimeSet;
+    std::function<void(std::string_view)> m_callback;
+    int32_t m_lastOffset;
+    int32_t m_driftPpb;
+    int64_t m_driftOffsetMillis; // Offsets measured since the drift base, what the drift correction missed
+    int64_t m_driftCorrection; // Milliseconds times ppb not corrected yet, kept to not lose the fractions
+    uint32_t m_driftBaseTimeStamp;
+    uint32_t m_driftTimeStamp;
+    uint32_t m_syncCount;
+    bool m_hasDriftBase;
+    bool m_hasDrift;
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED; // The syncs come from the Bluetooth task, the drift is corrected in the loop
 };
 
 // ------------------------------------------------------> BOOLEAN CONTROL CLASS <----------------------------------------------------------
 
 class BooleanControl : public BLEControl {
 public:
-    BooleanControl(ControlPublisher<std::string>* publisher, bool* isDeviceAuthorised, std::function<void(std::string)> onChange);
+    BooleanControl(ControlPublisher<std::string>* publisher, bool* isDeviceAuthorised, std::function<void(const std::string&)> onChange);
     CharacteristicCallback* getCallback() override { return new CharacteristicCallback(m_callback, m_isDeviceAuthorised); };
     void setCharacteristic(BLECharacteristic* bleCharacteristic) override { 
         m_bleCharacteristic = bleCharacteristic;
@@ -180,10 +932,11 @@ public:
  private:
     BLECharacteristic* m_bleCharacteristic;
     ControlPublisher<std::string>* m_publisher;
-    std::string m_initialValue;
+    std::string m_value; // Holds the received value when there is no publisher
     uint32_t m_lastNotificationTimeStamp;
     bool* m_isDeviceAuthorised;
-    std::function<void(std::string)> m_onChange, m_callback;
+    std::function<void(const std::string&)> m_onChange;
+    std::function<void(std::string_view)> m_callback;
 };
 
 // ------------------------------------------------------> INT CONTROL CLASS <--------------------------------------------------------------
@@ -232,7 +985,7 @@ public:
 
 class StringControl : public BLEControl {
 public:
-    StringControl(ControlPublisher<std::string>* publisher, bool* isDeviceAuthorised, std::function<void(std::string)> onChange);
+    StringControl(const uint16_t maxLength, ControlPublisher<std::string>* publisher, bool* isDeviceAuthorised, std::function<void(const std::string&)> onChange);
     CharacteristicCallback* getCallback() override { return new CharacteristicCallback(m_callback, m_isDeviceAuthorised); };
     void setCharacteristic(BLECharacteristic* bleCharacteristic) override { 
         m_bleCharacteristic = bleCharacteristic;
@@ -243,20 +996,655 @@ public:
  private:
     BLECharacteristic* m_bleCharacteristic;
     ControlPublisher<std::string>* m_publisher;
+    std::string m_value; // Holds the received value when there is no publisher
+    uint32_t m_lastNotificationTimeStamp;
+    bool* m_isDeviceAuthorised;
+    std::function<void(const std::string&)> m_onChange;
+    std::function<void(std::string_view)> m_callback;
+};
+
+// ------------------------------------------------------> COLOR CONTROL CLASS <------------------------------------------------------------
+// The app sends the color as a hex string, it's decoded in place to a RgbColor so the callbacks get it without parsing or allocations.
+
+class ColorControl : public BLEControl {
+public:
+    ColorControl(const bool isRgbw, ControlPublisher<RgbColor>* publisher, bool* isDeviceAuthorised, std::function<void(const RgbColor&)> onChange);
+    CharacteristicCallback* getCallback() override {
+        CharacteristicCallback* callback = new CharacteristicCallback(m_callback, m_isDeviceAuthorised);
+        callback->setValidator([](std::string_view hexValue) { RgbColor color; return parseColor(hexValue, color); });
+        return callback;
+    };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override { 
+        m_bleCharacteristic = bleCharacteristic;
+        if (m_publisher != nullptr) m_publisher->subscribe(this); 
+    };
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override;
+    static bool parseColor(std::string_view hexValue, RgbColor& color);
+    static size_t formatColor(const RgbColor& color, const bool isRgbw, char* hexValue);
+ private:
+    BLECharacteristic* m_bleCharacteristic;
+    ControlPublisher<RgbColor>* m_publisher;
+    RgbColor m_value;
+    bool m_isRgbw;
+    uint32_t m_lastNotificationTimeStamp;
+    bool* m_isDeviceAuthorised;
+    std::function<void(const RgbColor&)> m_onChange;
+    std::function<void(std::string_view)> m_callback;
+};
+
+// ------------------------------------------------------> XY CONTROL CLASS <---------------------------------------------------------------
+
+class XYControl : public BLEControl {
+public:
+    XYControl(
+        const int16_t maxX,
+        const int16_t maxY,
+        const uint16_t releaseMillis,
+        ControlPublisher<XYPosition>* publisher,
+        bool* isDeviceAuthorised,
+        std::function<void(const XYPosition&)> onChange
+    );
+    CharacteristicCallback* getCallback() override { return new CharacteristicCallback(m_callback, m_isDeviceAuthorised); };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override { 
+        m_bleCharacteristic = bleCharacteristic;
+        if (m_publisher != nullptr) m_publisher->subscribe(this); 
+    };
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override;
+    //Centres a pad that returns to the centre if it's held but no write arrived for releaseMillis (the link dropped).
+    void checkRelease();
+    //The last position written by the app.
+    XYPosition getValue();
+ private:
+    void setPosition(const XYPosition& position);
+    BLECharacteristic* m_bleCharacteristic;
+    ControlPublisher<XYPosition>* m_publisher;
+    XYPosition m_value;
+    int16_t m_maxX, m_maxY;
+    uint16_t m_releaseMillis;
+    uint32_t m_lastWriteTimeStamp; // Written by the Bluetooth task, read by checkRelease() in the loop
+    SemaphoreHandle_t m_stateLock; // The writes and the watchdog run in different tasks, only one of them moves the pad at a time
+    bool* m_isDeviceAuthorised;
+    std::function<void(const XYPosition&)> m_onChange;
+    std::function<void(int32_t)> m_callback;
+    bool m_isHeld;
+};
+
+// ------------------------------------------------------> HISTORY CONTROL CLASS <----------------------------------------------------------
+
+class HistoryControl : public BLEControl {
+public:
+    HistoryControl(
+        const std::string preferencesKey,
+        const uint16_t capacity,
+        const uint16_t sampleSeconds,
+        ControlPublisher<int32_t>* publisher,
+        const bool shouldPersist,
+        bool* isDeviceAuthorised
+    );
+    CharacteristicCallback* getCallback() override { return nullptr; };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override;
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override;
+    void addSample(const int32_t value);
+    HistoryBuffer* getHistory() { return &m_history; };
+private:
+    static void saveHistoryTask(void* params);
+    BLECharacteristic* m_bleCharacteristic;
+    HistoryBuffer m_history;
+    ControlPublisher<int32_t>* m_publisher;
+    std::string m_preferencesKey;
+    uint16_t m_sampleSeconds;
+    uint32_t m_lastSampleTimeStamp;
+    bool m_hasSample;
+    bool m_shouldPersist;
+    bool* m_isDeviceAuthorised;
+};
+
+// ------------------------------------------------------> SENSOR CONTROL CLASS <----------------------------------------------------------
+// A read only value sampled on demand. The sampling function runs when the app reads the characteristic or, while the app is
+// subscribed, every notifySeconds. A sample younger than cacheSeconds is reused, so a closed app never wakes the sensor up.
+// The reads arrive on the Bluetooth task, a mutex keeps the sampling function from running twice at the same time.
+
+class ReadCallback : public BLECharacteristicCallbacks {
+public:
+    ReadCallback(std::function<void()> onRead, bool* isDeviceAuthorised);
+    void onRead(BLECharacteristic* pChar) override;
+private:
+    std::function<void()> m_onRead;
+    bool* m_pIsDeviceAuthorised;
+};
+
+template <typename ValueType>
+class SensorControl : public BLEControl {
+public:
+    SensorControl(const uint16_t notifySeconds, const uint16_t cacheSeconds, bool* isDeviceAuthorised, std::function<ValueType()> sample) {
+        m_bleCharacteristic = nullptr;
+        m_notifySeconds = notifySeconds;
+        m_cacheMillis = cacheSeconds * 1000UL;
+        m_isDeviceAuthorised = isDeviceAuthorised;
+        m_sample = sample;
+        m_value = ValueType();
+        m_sampleTimeStamp = 0;
+        m_lastNotificationTimeStamp = 0;
+        m_hasSample = false;
+        m_sampleLock = xSemaphoreCreateMutex();
+    };
+    CharacteristicCallback* getCallback() override { return nullptr; };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override {
+        m_bleCharacteristic = bleCharacteristic;
+        m_bleCharacteristic->setCallbacks(new ReadCallback([this]() { refresh(); }, m_isDeviceAuthorised));
+    };
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    //The factory tells the control whether a peer has subscribed to its notifications.
+    void setSubscriptionCheck(std::function<bool()> isSubscribed) { m_isSubscribed = isSubscribed; };
+    void update() override {
+        if (m_notifySeconds == 0 || !*m_isDeviceAuthorised || !m_isSubscribed || !m_isSubscribed()) return;
+        if (m_lastNotificationTimeStamp != 0 && getClockSource()->getMillis() - m_lastNotificationTimeStamp < m_notifySeconds * 1000UL) return;
+        refresh();
+        notifyValue(m_bleCharacteristic);
+        m_lastNotificationTimeStamp = getClockSource()->getMillis();
+    };
+    //The last sample, without running the sampling function.
+    ValueType getValue() { return m_value; };
+    //Drops the cached sample, the next read or notification runs the sampling function.
+    void invalidate() { m_hasSample = false; };
+private:
+    void refresh() {
+        xSemaphoreTake(m_sampleLock, portMAX_DELAY);
+        if (!m_hasSample || getClockSource()->getMillis() - m_sampleTimeStamp >= m_cacheMillis) {
+            m_value = m_sample();
+            m_sampleTimeStamp = getClockSource()->getMillis();
+            m_hasSample = true;
+            setCharacteristicValue(m_bleCharacteristic, m_value);
+        }
+        xSemaphoreGive(m_sampleLock);
+    };
+    BLECharacteristic* m_bleCharacteristic;
+    std::function<ValueType()> m_sample;
+    std::function<bool()> m_isSubscribed;
+    SemaphoreHandle_t m_sampleLock;
+    ValueType m_value;
+    uint32_t m_cacheMillis;
+    uint32_t m_sampleTimeStamp;
     uint32_t m_lastNotificationTimeStamp;
+    uint16_t m_notifySeconds;
+    bool m_hasSample;
     bool* m_isDeviceAuthorised;
-    std::function<void(std::string)> m_onChange, m_callback;
+};
+
+// -----------------------------------------------------> BLE TRANSPORT <-------------------------------------------------------------------
+// The factory reaches the Bluetooth stack only through a BleTransport and receives the stack events as a TransportListener.
+// BluedroidTransport uses the BLE library of arduino-esp32 (the default), NimBleTransport uses the lighter NimBLE-Arduino library
+// (build with ESP_BLE_CONTROLS_NIMBLE defined) and MockTransport keeps the characteristics in memory without starting the radio.
+
+enum CharacteristicProperty {
+    CHAR_READ = 1, CHAR_WRITE = 2, CHAR_NOTIFY = 4, CHAR_WRITE_NR = 8, // CHAR_WRITE_NR accepts writes without response
+    CHAR_SUBSCRIBE = 16 // With CHAR_NOTIFY, the notifications are off until the peer enables them (isSubscribed() tells when)
+};
+
+struct SimulationReport {
+    uint32_t steps;
+    std::vector<uint32_t> intervalTransitions; // State changes of each interval control, in creation order
+    std::vector<uint32_t> scheduleTransitions; // State changes of each schedule, in creation order
+};
+
+struct TransportStats {
+    uint32_t startupMicros; // Time spent initialising the stack, in BleTransport::begin()
+    uint32_t stackHeapBytes; // Heap taken by the stack initialisation
+    uint32_t freeHeapBytes; // Heap left after the service was started
+};
+
+class TransportListener {
+public:
+    virtual void onConnection(const bool isConnected, const uint8_t* address) = 0;
+    virtual void onAuthentication(const bool isSuccessful, const uint8_t failReason, const uint8_t* address) = 0;
+    virtual void onNotificationConfirmed(const uint16_t handle, const bool isSuccessful) = 0;
+    virtual void onCongestion(const bool isCongested) = 0;
+};
+
+class BleTransport {
+public:
+    virtual ~BleTransport() {};
+    virtual void begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) = 0;
+    virtual BLECharacteristic* createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) = 0;
+    virtual void start() = 0;
+    virtual void startAdvertising() = 0;
+    virtual void disconnect() = 0;
+    virtual void notify(BLECharacteristic* characteristic) = 0;
+    virtual bool confirmsNotifications() = 0; // True if every notification is confirmed with onNotificationConfirmed()
+    virtual void encryptLink(const uint8_t* address) = 0;
+    virtual bool isBonded(const uint8_t* address) = 0;
+    virtual void removeBond(const uint8_t* address) = 0;
+    virtual void removeAllBonds() = 0;
+    virtual bool isSubscribed(BLECharacteristic* characteristic) = 0; // True if a connected peer has enabled the notifications
+    //The attribute handle the stack reports the characteristic with (ex. in the notification confirmations). The stacks give
+    //the handles once the service is started, before that they are all the same.
+    virtual uint16_t getHandle(BLECharacteristic* characteristic) { return characteristic->getHandle(); };
+};
+
+// ------------------------------------------------------> OTA CONTROL CLASS <-------------------------------------------------------------
+// Firmware update streamed through the control service. The app writes, without response (little endian):
+//   START : opcode, image size (uint32), image CRC-32 (uint32)
+//   DATA  : opcode, sequence (uint16), up to OTA_MAX_CHUNK_SIZE bytes of the image
+//   END   : opcode, signature of the image (see PartitionSink), the image is checked and set as the boot partition
+//   ABORT : opcode
+// After every windowChunks chunks (and after each START/END/ABORT) the device notifies an ack: status (uint8), next expected
+// sequence (uint16), bytes written (uint32) and the CRC-32 of those bytes (uint32). A chunk out of sequence is dropped and acked
+// with OTA_OUT_OF_SEQUENCE, the app sends again from the next expected sequence. The chunks are written straight to the flash.
+// The CRC only catches transfer errors, an image is accepted only if the sink verifies its signature (OTA_SIGNATURE_ERROR if not).
+
+uint32_t updateCrc32(uint32_t crc, const uint8_t* data, const size_t length); // Start with 0, as zlib's crc32()
+
+class FirmwareSink {
+public:
+    virtual ~FirmwareSink() {};
+    virtual bool begin(const uint32_t imageSize) = 0;
+    virtual bool write(const uint8_t* data, const size_t length) = 0;
+    virtual bool verify(const uint8_t* signature, const size_t length) = 0; // Checks the signature sent with END, before end()
+    virtual bool end() = 0; // Validates the image and makes it the boot partition
+    virtual void abort() = 0;
+};
+
+// Writes the image to the next OTA partition with the Update library of arduino-esp32. With a public key (ECDSA P-256, PEM) the
+// signature sent with END must be the DER signature of the SHA-256 of the image. A key on another curve is refused. Without a key the image is accepted only if
+// secure boot is enabled, then the bootloader checks the signature of the app when the partition is set to boot.
+class PartitionSink : public FirmwareSink {
+public:
+    PartitionSink(const char* publicKeyPem = nullptr);
+    ~PartitionSink();
+    bool begin(const uint32_t imageSize) override;
+    bool write(const uint8_t* data, const size_t length) override;
+    bool verify(const uint8_t* signature, const size_t length) override;
+    bool end() override { return Update.end(); };
+    void abort() override { Update.abort(); };
+private:
+    const char* m_publicKeyPem;
+    mbedtls_md_context_t m_digest;
+};
+
+// Discards the image, to measure the protocol alone. Nothing boots from it, so no signature is needed.
+class NullSink : public FirmwareSink {
+public:
+    bool begin(const uint32_t imageSize) override { return true; };
+    bool write(const uint8_t* data, const size_t length) override { return true; };
+    bool verify(const uint8_t* signature, const size_t length) override { return true; };
+    bool end() override { return true; };
+    void abort() override {};
+};
+
+class WriteCallback : public BLECharacteristicCallbacks {
+public:
+    //The writes and notifications are recorded if the recorder the factory points to is enabled, also if it's enabled later.
+    //If shouldRecordWrite isn't nullptr only the writes it accepts are recorded.
+    WriteCallback(
+        std::function<void(const uint8_t*, size_t)> onWrite,
+        bool* isDeviceAuthorised,
+        TrafficRecorder** recorder = nullptr,
+        std::function<bool(const uint8_t*, size_t)> shouldRecordWrite = nullptr
+    );
+    void onWrite(BLECharacteristic* pChar) override;
+    void onNotify(BLECharacteristic* pChar) override;
+private:
+    std::function<void(const uint8_t*, size_t)> m_onWrite;
+    std::function<bool(const uint8_t*, size_t)> m_shouldRecordWrite;
+    bool* m_pIsDeviceAuthorised;
+    TrafficRecorder** m_ppRecorder;
+};
+
+class OtaControl : public BLEControl {
+public:
+    OtaControl(
+        FirmwareSink* sink,
+        const uint16_t windowChunks,
+        const bool restartWhenDone,
+        bool* isDeviceAuthorised,
+        std::function<void(OtaStatus)> onStatusChanged,
+        TrafficRecorder** recorder = nullptr
+    );
+    CharacteristicCallback* getCallback() override { return nullptr; };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override;
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override;
+    void onMessage(const uint8_t* data, const size_t length);
+    OtaStatus getStatus() { return m_status; };
+    uint16_t getNextSequence() { return m_nextSequence; };
+    uint16_t getWindowChunks() { return m_windowChunks; };
+    uint32_t getReceivedBytes() { return m_receivedBytes; };
+    uint32_t getAcksCount() { return m_acksCount; };
+private:
+    void start(const uint32_t imageSize, const uint32_t imageCrc);
+    void writeChunk(const uint16_t sequence, const uint8_t* data, const size_t length);
+    void finish(const uint8_t* signature, const size_t length);
+    void fail(const OtaStatus status);
+    void acknowledge(const OtaStatus status);
+    bool isTransferring() { return m_status == OTA_READY || m_status == OTA_WINDOW_ACK || m_status == OTA_OUT_OF_SEQUENCE; };
+    BLECharacteristic* m_bleCharacteristic;
+    FirmwareSink* m_sink;
+    std::function<void(OtaStatus)> m_onStatusChanged;
+    OtaStatus m_status;
+    uint32_t m_imageSize;
+    uint32_t m_imageCrc;
+    uint32_t m_receivedBytes;
+    uint32_t m_crc;
+    uint32_t m_acksCount;
+    uint32_t m_doneTimeStamp;
+    uint16_t m_nextSequence;
+    uint16_t m_windowChunks;
+    uint16_t m_chunksSinceAck;
+    bool m_restartWhenDone;
+    bool* m_isDeviceAuthorised;
+    TrafficRecorder** m_ppRecorder;
+};
+
+// ------------------------------------------------------> MOMENTARY CONTROL CLASS <--------------------------------------------------------
+// A push button with a one byte value, 1 pressed and 0 released. The write goes straight from the Bluetooth task to the callback,
+// without decoding a string, a publisher or a save task. While the button is held the app writes 1 again every holdMillis / 2,
+// so the button is released when the refreshes stop or the link drops and the output is never left latched.
+
+class MomentaryControl : public BLEControl {
+public:
+    MomentaryControl(
+        const bool isNC,
+        const uint16_t holdMillis,
+        bool* isDeviceAuthorised,
+        std::function<void(bool)> onChange,
+        TrafficRecorder** recorder = nullptr
+    );
+    CharacteristicCallback* getCallback() override { return nullptr; };
+    void setCharacteristic(BLECharacteristic* bleCharacteristic) override;
+    BLECharacteristic* getCharacteristic() override { return m_bleCharacteristic; };
+    void update() override {};
+    void onWrite(const uint8_t* data, const size_t length);
+    //Releases the button if no refresh arrived for holdMillis, called from updateControls().
+    void checkRelease();
+    //Releases the button at once, called when the link drops.
+    void release();
+    bool isPressed() { return m_isPressed; };
+    //micros() when the last press was received, to measure the delay until the output changed.
+    uint32_t getPressTimeStamp() { return m_pressTimeStamp; };
+    //Microseconds from receiving a write until the callback returned.
+    LatencySamples& getCallbackLatency() { return m_callbackLatency; };
+    //Times the button was released by the watchdog or by a dropped link instead of by the app.
+    uint32_t getForcedReleases() { return m_forcedReleases; };
+private:
+    bool forceRelease(const bool onlyIfExpired);
+    BLECharacteristic* m_bleCharacteristic;
+    std::function<void(bool)> m_onChange;
+    LatencySamples m_callbackLatency;
+    // The writes and the watchdog run in different tasks, the callbacks must keep their order. m_onChange runs with it held,
+    // on the Bluetooth task for the writes, so it must not block: a slow callback holds up the stack and the watchdog.
+    SemaphoreHandle_t m_stateLock;
+    TrafficRecorder** m_ppRecorder;
+    uint32_t m_pressTimeStamp;
+    uint32_t m_refreshTimeStamp;
+    uint32_t m_forcedReleases;
+    uint16_t m_holdMillis;
+    bool m_isNC;
+    bool m_isPressed;
+    bool* m_isDeviceAuthorised;
+};
+
+// -----------------------------------------------------> CONTROL TABLE <-----------------------------------------------------------------
+// Controls declared in a constexpr table. The compiler generates their UUIDs, with the same scheme as the create* methods, and
+// counts the attributes they need; EspBleControlsFactory::createControls() creates them in one pass and restores all the saved
+// values in a single Preferences session. The value controls can be declared, with plain functions (or lambdas without captures)
+// as callbacks; the other controls still have to be created with their create* methods. It isn't a static GATT attribute table:
+// the stack still creates each characteristic and its descriptors one by one, the table only saves the work around them.
+
+typedef std::array<char, 37> ControlUuid;
+
+struct ControlDeclaration {
+    const char* suffix;
+    const char* description;
+    int16_t params[3];
+    CallbackType valueType;
+    int32_t intValue;
+    float_t floatValue;
+    const char* stringValue;
+    ControlPublisher<int32_t>* intPublisher;
+    ControlPublisher<float_t>* floatPublisher;
+    ControlPublisher<std::string>* stringPublisher;
+    void (*onIntReceived)(int32_t);
+    void (*onFloatReceived)(float_t);
+    void (*onStringReceived)(const std::string&);
+
+    constexpr bool shouldNotify() const { return intPublisher != nullptr || floatPublisher != nullptr || stringPublisher != nullptr; };
+};
+
+constexpr ControlDeclaration declareIntValue(
+    const char* suffix, const char* description, const int16_t param1, const int16_t param2, const int16_t param3,
+    const int32_t initialValue, ControlPublisher<int32_t>* publisher, void (*onIntReceived)(int32_t)
+) {
+    return { suffix, description, { param1, param2, param3 }, INTEGER, initialValue, 0, "", publisher, nullptr, nullptr, onIntReceived, nullptr, nullptr };
+}
+
+constexpr ControlDeclaration declareStringValue(
+    const char* suffix, const char* description, const int16_t param1, const int16_t param2, const int16_t param3,
+    const char* initialValue, ControlPublisher<std::string>* publisher, void (*onStringReceived)(const std::string&)
+) {
+    return { suffix, description, { param1, param2, param3 }, STRING, 0, 0, initialValue, nullptr, nullptr, publisher, nullptr, nullptr, onStringReceived };
+}
+
+constexpr ControlDeclaration declareSwitchControl(
+    const char* description, const char* initialValue,
+    ControlPublisher<std::string>* publisher = nullptr, void (*onSwitchToggle)(const std::string&) = nullptr
+) {
+    return declareStringValue(SWTCH_UUID_SUFFIX, description, 0, 0, 0, initialValue, publisher, onSwitchToggle);
+}
+
+constexpr ControlDeclaration declareMomentaryControl(
+    const char* description, const char* initialValue, const bool isNC,
+    ControlPublisher<std::string>* publisher = nullptr, void (*onButtonPressed)(const std::string&) = nullptr
+) {
+    return declareStringValue(MOMNT_UUID_SUFFIX, description, isNC, 0, 0, initialValue, publisher, onButtonPressed);
+}
+
+constexpr ControlDeclaration declareSliderControl(
+    const char* description, const int16_t minValue, const int16_t maxValue, const uint16_t steps, const int32_t initialValue,
+    ControlPublisher<int32_t>* publisher = nullptr, void (*onSliderMoved)(int32_t) = nullptr
+) {
+    return declareIntValue(SLIDR_UUID_SUFFIX, description, minValue, maxValue, steps, initialValue, publisher, onSliderMoved);
+}
+
+constexpr ControlDeclaration declareIntControl(
+    const char* description, const int16_t minValue, const int16_t maxValue, const int32_t initialValue,
+    ControlPublisher<int32_t>* publisher = nullptr, void (*onIntReceived)(int32_t) = nullptr
+) {
+    return declareIntValue(INTGR_UUID_SUFFIX, description, minValue, maxValue, 0, initialValue, publisher, onIntReceived);
+}
+
+constexpr ControlDeclaration declareAngleControl(
+    const char* description, const int32_t initialValue, const bool isCompass,
+    ControlPublisher<int32_t>* publisher = nullptr, void (*onAngleChanged)(int32_t) = nullptr
+) {
+    return declareIntValue(ANGLE_UUID_SUFFIX, description, isCompass, 0, 0, initialValue, publisher, onAngleChanged);
+}
+
+constexpr ControlDeclaration declareFloatControl(
+    const char* description, const int16_t minValue, const int16_t maxValue, const float_t initialValue,
+    ControlPublisher<float_t>* publisher = nullptr, void (*onFloatReceived)(float_t) = nullptr
+) {
+    return {
+        FLOAT_UUID_SUFFIX, description, { minValue, maxValue, 0 }, FLOAT, 0, initialValue, "",
+        nullptr, publisher, nullptr, nullptr, onFloatReceived, nullptr
+    };
+}
+
+constexpr ControlDeclaration declareStringControl(
+    const char* description, const uint16_t maxLength, const char* initialValue,
+    ControlPublisher<std::string>* publisher = nullptr, void (*onTextReceived)(const std::string&) = nullptr
+) {
+    return declareStringValue(STRNG_UUID_SUFFIX, description, maxLength, 0, 0, initialValue, publisher, onTextReceived);
+}
+
+constexpr bool isSameSuffix(const char* suffix, const char* otherSuffix) {
+    while (*suffix != '\0' && *suffix == *otherSuffix) {
+        suffix++;
+        otherSuffix++;
+    }
+    return *suffix == *otherSuffix;
+}
+
+// Same text as EspBleControlsFactory::generateCharUuid() : ID-param1-param2-param3-CID+count, upper case hex digits
+constexpr ControlUuid generateControlUuid(const char* suffix, const int16_t (&params)[3], const uint8_t count) {
+    constexpr char digits[] = "0123456789ABCDEF";
+    ControlUuid uuid = {};
+    size_t position = 0;
+    for (const char* prefix = CHAR_UUID_PREFIX; *prefix != '\0'; prefix++) uuid[position++] = *prefix;
+    for (const int16_t param : params) {
+        uuid[position++] = '-';
+        for (int8_t shift = 12; shift >= 0; shift -= 4) uuid[position++] = digits[((uint16_t) param >> shift) & 0xF];
+    }
+    uuid[position++] = '-';
+    for (; *suffix != '\0'; suffix++) uuid[position++] = *suffix;
+    uuid[position++] = digits[count >> 4];
+    uuid[position++] = digits[count & 0xF];
+    uuid[position] = '\0';
+    return uuid;
+}
+
+template <size_t Count>
+class ControlTable {
+public:
+    constexpr ControlTable(const ControlDeclaration (&declarations)[Count]) : m_declarations(), m_uuids(), m_instances(), m_attributesCount(0) {
+        for (size_t index = 0; index < Count; index++) {
+            uint8_t instance = 1;
+            for (size_t previous = 0; NUMBERED_INSTANCES && previous < index; previous++) {
+                if (isSameSuffix(declarations[previous].suffix, declarations[index].suffix)) instance++;
+            }
+            m_declarations[index] = declarations[index];
+            m_uuids[index] = generateControlUuid(declarations[index].suffix, declarations[index].params, instance);
+            m_instances[index] = instance;
+            // Characteristic declaration, value and user description, plus the CCCD of the notifying controls
+            m_attributesCount += declarations[index].shouldNotify() ? 4 : 3;
+        }
+    };
+    constexpr size_t size() const { return Count; };
+    //Attribute handles the table takes in the service, ex. static_assert(table.getAttributesCount() < SERVICE_HANDLES - 10).
+    constexpr uint16_t getAttributesCount() const { return m_attributesCount; };
+    constexpr const ControlDeclaration* getDeclarations() const { return m_declarations.data(); };
+    constexpr const ControlUuid* getUuids() const { return m_uuids.data(); };
+    constexpr const uint8_t* getInstances() const { return m_instances.data(); };
+private:
+    std::array<ControlDeclaration, Count> m_declarations;
+    std::array<ControlUuid, Count> m_uuids;
+    std::array<uint8_t, Count> m_instances;
+    uint16_t m_attributesCount;
 };
 
 // ------------------------------------------------------> ESP BLE CONTROLS FACTORY CLASS <-------------------------------------------------
 
-class EspBleControlsFactory {
+struct ControlEntry {
+    BLECharacteristic* characteristic;
+    std::string uuid;
+    CharacteristicCallback* callback;
+    bool shouldNotify;
+    std::function<void()> resetValue;
+};
+
+class EspBleControlsFactory : public TransportListener {
 public:
-    EspBleControlsFactory(const std::string deviceName, const uint32_t passkey = 0);
+    //If transport is nullptr the stack selected at build time is used (Bluedroid, or NimBLE if ESP_BLE_CONTROLS_NIMBLE is defined).
+    EspBleControlsFactory(const std::string deviceName, const uint32_t passkey = 0, BleTransport* transport = nullptr);
     void startService();
     void updateControls();
+    //Saves the high rate values that are waiting for their writes to stop, updateControls() saves them SAVE_DEBOUNCE_MS after
+    //the last write. Pass true to save them now, ex. before a restart.
+    void savePendingValues(const bool isForced);
+    //Advances the clock by stepMs until durationMs of virtual time have passed, as fast as the board (or the host) can, and counts
+    //the state changes of the interval controls and the schedules. Only their state is evaluated: the toggle callbacks don't run,
+    //nothing is saved or notified and the other controls are left alone, so the outputs don't move during the simulation.
+    //Set the clock as the clock source before creating the controls, ex. a week of schedules in 10 second steps:
+    //simulate(&clock, 7 * DAY_SECONDS * 1000UL, 10000). The shortest division of the day is a minute, so with a step of
+    //at most 60000 ms no transition is missed.
+    SimulationReport simulate(VirtualClock* clock, const uint32_t durationMs, const uint32_t stepMs);
+
+    //The time and the heap taken by the stack initialisation and the heap left after startService(), to compare the transports.
+    TransportStats getTransportStats() { return m_transportStats; };
+
+    void onConnection(const bool isConnected, const uint8_t* address) override;
+    void onAuthentication(const bool isSuccessful, const uint8_t failReason, const uint8_t* address) override;
+    void onNotificationConfirmed(const uint16_t handle, const bool isSuccessful) override;
+    void onCongestion(const bool isCongested) override;
+
+    //Sets how long a connected device has to authenticate before it is dropped and how long to wait before advertising again.
+    //The pairing flow is processed in updateControls(), so none of the Bluetooth stack callbacks are blocked.
+    void setPairingTimeouts(const uint16_t authTimeoutSeconds, const uint16_t readvertiseDelayMs);
+    PairingState getPairingState() { return m_pairingState; };
+    PairingStats getPairingStats() { return m_pairingStats; };
+
+    //With HARD_RESET (the default) the "Clear values" control restarts the microcontroller.
+    //With SOFT_RESET the controls are restored to their initial values (or to the saved ones if the values are not cleared),
+    //their callbacks are executed again and the connection is kept. The saved values are cleared in the background.
+    void setResetMode(const ResetMode resetMode) { m_resetMode = resetMode; };
+
+    //Records the last capacity writes, notifications and connection events in RAM. Call it before startService().
+    //The writes to the low latency momentary, OTA and history controls are recorded too, but replayTraffic() doesn't replay them.
+    //If exposeCharacteristic is true a characteristic is added to read the records in pages: write the sequence number
+    //of the first record needed (uint32) and read a page with as many records as will fit.
+    void enableTrafficRecorder(const uint16_t capacity, const bool exposeCharacteristic);
+    TrafficRecorder* getTrafficRecorder() { return m_trafficRecorder; };
+
+    //A chart of the last capacity samples of the publisher value, one every sampleSeconds (ex. 288 samples every 300 seconds for
+    //the last 24 hours). The samples are delta encoded in RAM and, if shouldPersist is true, saved every HISTORY_PERSIST_SAMPLES
+    //samples and restored at startup. With a nullptr publisher the samples are added with HistoryControl::addSample().
+    //The app writes the sequence number of the first sample it needs (0 for all of them) and reads a page of samples:
+    //first sequence (uint32), its epoch (uint32) and value (int32), sample seconds (uint16), samples count (uint16),
+    //then for each of the next samples the varint of the elapsed intervals and the zigzag varint of the value difference.
+    HistoryControl* createHistoryControl(
+        const std::string description,
+        const uint16_t capacity,
+        const uint16_t sampleSeconds,
+        ControlPublisher<int32_t>* publisher,
+        const bool shouldPersist
+    );
+
+    //Creates the controls declared in a ControlTable, in the table order, ex.
+    //  constexpr ControlDeclaration declarations[] = { declareSwitchControl("Light", "0", nullptr, onLight), declareSliderControl(...) };
+    //  constexpr ControlTable<std::size(declarations)> table(declarations);
+    //  std::vector<BLEControl*> controls = factory->createControls(table);
+    //Call it before the create* methods of the same control types, or those controls will get their UUIDs at runtime.
+    template <size_t Count>
+    std::vector<BLEControl*> createControls(const ControlTable<Count>& table) {
+        return createDeclaredControls(table.getDeclarations(), table.getUuids(), table.getInstances(), Count);
+    };
+
+    //A firmware update control, see the OTA CONTROL CLASS section for the protocol. The image goes to the sink, a PartitionSink
+    //without a key (so secure boot must be enabled) if it's nullptr. The control is refused without a pin, the link must be
+    //encrypted. If restartWhenDone is true the device restarts on the new firmware once it's checked, otherwise restart it when
+    //the application is ready, ex. after getStatus() returns OTA_DONE. onStatusChanged is called from the Bluetooth task.
+    OtaControl* createOtaControl(
+        const std::string description,
+        FirmwareSink* sink = nullptr,
+        const bool restartWhenDone = false,
+        std::function<void(OtaStatus)> onStatusChanged = nullptr
+    );
+
+    //A write only control to change several controls at once. The app writes a batch of records, each one is the CID+count
+    //of the control (the last 6 bytes of its UUID), the value length (uint8) and the value, encoded as for the control itself.
+    //The batch is applied only if all the records are valid: all the callbacks run, then the changed controls are notified
+    //once and all the values are saved together. Only one instance can be created. A record is invalid if its ID matches more
+    //than one control, as two instances of a type do unless ESP_BLE_CONTROLS_NUMBERED_INSTANCES is defined.
+    void createTransactionControl(const std::string description);
+
+    //The notifications are sent through a queue that keeps only the latest value of each control and waits when the link is
+    //congested. The counters show how many values were superseded, retried or dropped.
+    NotificationStats getNotificationStats() { return m_notifier.getStats(); };
+
+    //Replays the recorded writes against the controls, from updateControls(). With speedFactor 1 the original timing is kept,
+    //with a bigger value the replay is that many times faster and with 0 all the writes are replayed as fast as possible.
+    //The writes longer than TRAFFIC_PAYLOAD_SIZE were truncated so they are skipped, and the replayed values are not saved.
+    //The recorder is paused until the replay ends. The sequence numbers of the high rate writes are checked as they were
+    //recorded, from a fresh start, and start again from scratch once the replay is done.
+    void replayTraffic(const uint16_t speedFactor);
+    bool isReplayingTraffic() { return m_replaySequence != m_replayEndSequence; };
+
+    const std::vector<ControlEntry>& getControlEntries() { return m_controlEntries; };
 
-    //A control that displays the microcontroller RTC value. Data is sent as long, received as long (unix epoch time).
+    //A control that displays the microcontroller RTC value. Data is sent as long, received as long (unix epoch time) or as a
+    //millisecond sync, see the CLOCK CONTROL CLASS section.
     //It can have only one instance, and it's reccomended to have a method to set the RTC of the microcontroller onValueReceived.
     //If onTimeSet function is nullptr then the value will be read only.
     ClockControl* createClockControl(
@@ -276,13 +1664,32 @@ public:
         std::function<void(bool)> onIntervalToggle
     );
 
+    //Selectors for the days of the week, days of the month and months of the year, to be used in a Schedule.
+    //The bit N of initialSelection selects the day/month with index N (Sunday, the 1st and January have index 0).
+    //If allowMultiple is false the app will allow only one day/month to be selected.
+    CalendarControl* createWeekDaysControl(const std::string description, const bool allowMultiple, const uint32_t initialSelection);
+    CalendarControl* createMonthDaysControl(const std::string description, const bool allowMultiple, const uint32_t initialSelection);
+    CalendarControl* createMonthsControl(const std::string description, const bool allowMultiple, const uint32_t initialSelection);
+
+    //A schedule that executes onScheduleToggle when the combined state of its rules changes. Add the rules with addRule(),
+    //each one an Interval control (created with checkDelaySeconds 0) and the Calendar controls that must match the current date.
+    //Example: weekdays 6:30-8:00 and weekends 9:00-11:00 are two rules, each with its own Interval and Week days controls.
+    ScheduleControl* createScheduleControl(
+        const uint16_t checkDelaySeconds,
+        std::function<void(bool)> onScheduleToggle
+    );
+
+    //A transition engine stepped every tickMs from updateControls(). Attach publishers and outputs to it to fade the outputs
+    //to the new values instead of jumping, ex. engine->attach(&brightness, 1000, EASE_IN_OUT, [](int32_t duty) { analogWrite(PIN, duty); });
+    TransitionEngine* createTransitionEngine(const uint16_t tickMs);
+
     //A switch where data is sent and received as string with the values "ON"/"OFF"
     //If onSwitchToggle function is nullptr then the value will be read only.
     BooleanControl* createSwitchControl(
         const std::string description,
         const std::string initialValue,
         ControlPublisher<std::string>* publisher,
-        std::function<void(std::string)> onSwitchToggle
+        std::function<void(const std::string&)> onSwitchToggle
     );
     
     //A momentary button, sends "ON" if NO or "OFF" if NC when pressed and "OFF" if NO and "ON" if NC when released.
@@ -293,7 +1700,18 @@ public:
         const std::string initialValue,
         bool isNC, 
         ControlPublisher<std::string>* publisher,
-        std::function<void(std::string)> onButtonPressed
+        std::function<void(const std::string&)> onButtonPressed
+    );
+
+    //A low latency momentary button with a one byte value. onButtonChanged receives true when the output should be on: when it's
+    //pressed if NO, when it's released if NC. It's called from the Bluetooth task (from the loop task when the button is released
+    //by the watchdog) with the state of the button locked, so it should only set the output and must never block or wait.
+    //The button is released when the link drops or, if holdMillis is not 0, when the app stops refreshing the press for holdMillis.
+    MomentaryControl* createMomentaryControl(
+        const std::string description,
+        const bool isNC,
+        const uint16_t holdMillis,
+        std::function<void(bool)> onButtonChanged
     );
     
     //Will display a text field with an integer value. If the minimum and maximum values are set to 0 the value will be unconstrained (32 bits).
@@ -331,6 +1749,22 @@ public:
         std::function<void(int32_t)> onAngleChanged
     );
     
+    //Will display a text field with a decimal value, received and sent as an integer scaled by 10^fractionDigits (ex. 2150 is 21.50
+    //with 2 fraction digits), so the value never goes through floating point math. The minimum and maximum values are in whole units.
+    //fractionDigits is at most MAX_FRACTION_DIGITS, and it's lowered until the limits scaled by 10^fractionDigits fit in 32 bits
+    //(ex. at most 5 fraction digits with a maximum of 20000).
+    //If the minimum and maximum values are set to 0 the value will be unconstrained (32 bits).
+    //If onValueReceived function is nullptr then the value will be read only.
+    IntControl* createDecimalControl(
+        const std::string description,
+        const short minValue,
+        const short maxValue,
+        const uint8_t fractionDigits,
+        const int32_t initialValue,
+        ControlPublisher<int32_t>* publisher,
+        std::function<void(int32_t)> onDecimalReceived
+    );
+
     //Will display a text field with a float value. The minimum and maximum values are integers but will be displayed as floats.
     //If the minimum and maximum values are set to 0 the value will be unconstrained (32 bits).
     //If onValueReceived function is nullptr then the value will be read only.
@@ -343,6 +1777,24 @@ public:
         std::function<void(float_t)> onFloatReceived
     );
     
+    //Will display a read only integer value that is sampled only when it's needed: when the app reads it or, while the app is
+    //subscribed, every notifySeconds (0 to never notify). A sample younger than cacheSeconds is reused instead of running sample again.
+    //sample may run on the Bluetooth task, it should return quickly.
+    SensorControl<int32_t>* createIntSensorControl(
+        const std::string description,
+        const uint16_t notifySeconds,
+        const uint16_t cacheSeconds,
+        std::function<int32_t()> sample
+    );
+
+    //Same as createIntSensorControl but the value is displayed as a float.
+    SensorControl<float_t>* createFloatSensorControl(
+        const std::string description,
+        const uint16_t notifySeconds,
+        const uint16_t cacheSeconds,
+        std::function<float_t()> sample
+    );
+
     //Will display a text field where text length can be constrained between 0 and 512 characters.
     //If the maxLength is left 0, the maxLength will be set to the length of the inital value.
     //If onValueReceived function is nullptr then the value will be read only.
@@ -351,11 +1803,22 @@ public:
         const uint16_t maxLength,
         const std::string initialValue,
         ControlPublisher<std::string>* publisher,
-        std::function<void(std::string)> onTextReceived
+        std::function<void(const std::string&)> onTextReceived
     );
     
-    //A control to set a color in RGB format. Sends and receives a string representing the hexadecimal value of the color.
+    //A control to set a color in RGB (or RGBW if isRgbw is true) format. The app sends and receives the hexadecimal value of the color,
+    //the callback receives it decoded as a RgbColor. Use a GammaTable to convert the channels to PWM duty cycles.
     //If onValueReceived function is nullptr then the value will be read only.
+    ColorControl* createColorControl(
+        const std::string description,
+        const bool isRgbw,
+        const RgbColor initialValue,
+        ControlPublisher<RgbColor>* publisher,
+        std::function<void(const RgbColor&)> onColorChanged
+    );
+
+    //A control to set a color in RGB format. Sends and receives a string representing the hexadecimal value of the color.
+    //If onValueReceived function is nullptr then the value will be read only. The values that aren't valid colors are ignored.
     StringControl* createColorControl(
         const std::string description,
         const std::string initialValue,
@@ -363,57 +1826,184 @@ public:
         std::function<void(std::string)> onColorChanged
     );
 
+    //A two axes pad (joystick) that sends x and y in one write, so they always arrive together. The axes go from -maxX..maxX
+    //and -maxY..maxY (1..32767) with 0, 0 in the centre. While it's held the app writes the position ratePerSecond times (1..100),
+    //without response. If returnsToCenter the pad springs back to 0, 0 when released, and the device centres it too when no write
+    //arrives for XY_RELEASE_PERIODS periods, and at least XY_RELEASE_MIN_MS (the link dropped). The position isn't saved.
+    //onPadMoved runs on the Bluetooth task, or on the loop task when the device centres the pad, never both at once.
+    XYControl* createXYControl(
+        const std::string description,
+        const int16_t maxX,
+        const int16_t maxY,
+        const uint8_t ratePerSecond,
+        const bool returnsToCenter,
+        ControlPublisher<XYPosition>* publisher,
+        std::function<void(const XYPosition&)> onPadMoved
+    );
+
 private:
     template <typename ValueType> BLECharacteristic* createCharacteristic(
         const std::string uuid,
         const std::string description,
         ValueType initialValue,
         const boolean shouldNotify,
-        CharacteristicCallback* callback
+        CharacteristicCallback* callback,
+        const boolean isHighRate = false
+    );
+    template <typename ValueType> SensorControl<ValueType>* createSensorControl(
+        const std::string uuid,
+        const std::string description,
+        const uint16_t notifySeconds,
+        const uint16_t cacheSeconds,
+        std::function<ValueType()> sample
+    );
+    std::vector<BLEControl*> createDeclaredControls(
+        const ControlDeclaration* declarations,
+        const ControlUuid* uuids,
+        const uint8_t* instances,
+        const size_t count
     );
-    void setBleSecurity();
-    void startAdvertising();
     void notifyOnConnection();
+    void postPairingEvent(PairingEventType type, uint8_t reason, const uint8_t* address);
+    void processPairingEvents();
+    void onPairingFailed(PairingFailure failure, uint8_t reason, uint32_t timeStamp);
     void createClearPrefsAndResetControl();
     void restoreValue(BLECharacteristic* characteristic, const std::string uuid, CharacteristicCallback* callback);
+    void softReset(const PendingReset pendingReset);
+    void replayNextWrites();
+    void resetSequences();
+    void applyTransaction(std::string_view batch);
+    ControlEntry* findControlEntry(const uint8_t* controlId);
+    static void saveTransactionTask(void* params);
+    CalendarControl* createCalendarControl(const std::string uuid, const std::string description, const CalendarType calendarType, const uint32_t initialSelection);
+    static void clearPreferencesTask(void* params);
+    std::vector<ControlEntry> m_controlEntries;
+    ControlNotifier m_notifier;
+    ResetMode m_resetMode;
+    PendingReset m_pendingReset;
+    TrafficRecorder* m_trafficRecorder;
+    uint16_t m_replaySpeedFactor;
+    uint32_t m_replaySequence;
+    uint32_t m_replayEndSequence;
+    uint32_t m_replayStartTimeStamp;
+    uint32_t m_replayFirstRecordTimeStamp;
     const std::string generateCharUuid(const std::string suffix, const int16_t val1, const int16_t val2, const int16_t val3);
     const uint16_t getCharCounterIndex(const std::string charId);
     const boolean doesCharCounterExists(const std::string charId);
     std::map<std::string, uint16_t> m_charsCounter;
     std::vector<BLEControl*> m_selfUpdatingControls, m_notifyingControls;
+    std::vector<ScheduleControl*> m_schedules;
+    std::vector<IntervalControl*> m_intervalControls;
+    std::vector<TransitionEngine*> m_transitionEngines;
+    std::vector<XYControl*> m_releasingPads;
+    std::vector<MomentaryControl*> m_momentaryControls;
     uint32_t m_pin;
     uint32_t m_deviceConnectionTimeStamp;
     bool m_isDeviceAuthorised;
     bool m_isDeviceConnected;
     bool m_shouldNotifyDevice;
-    BLEServer* m_pServer;
-    BLEService* m_pService;
+    bool m_shouldAdvertise;
+    uint16_t m_authTimeoutSeconds;
+    uint16_t m_readvertiseDelayMs;
+    uint32_t m_pairingTimeStamp;
+    uint32_t m_disconnectionTimeStamp;
+    PairingState m_pairingState;
+    PairingStats m_pairingStats;
+    QueueHandle_t m_pairingEvents;
+    BondTable m_bondTable;
+    BleAddress m_peerAddress;
+    bool m_isBondedPeer;
+    BleTransport* m_transport;
+    TransportStats m_transportStats;
+    Preferences m_batchPreferences; // Open while createControls() restores the saved values
+    bool m_isCreatingBatch;
+};
+
+// -----------------------------------------------------> SIMULATED CENTRAL CLASS <--------------------------------------------------------
+// Load test that runs on the microcontroller: it writes to the controls at the configured rates through the same path as the
+// Bluetooth stack (callback, publisher fan-out, notifications, persistence) and reports the latencies, throughput and heap use.
+// Keep a phone connected and subscribed during the test to include the cost of the real notifications.
+// On the board the BLE stack and the flash are the real ones, the load_test of test/host runs it on the MockTransport. The values
+// are saved to the LOAD_TEST_PREFERENCES_ID namespace, which is cleared after the run, so the saved values of the controls are kept.
+
+struct LoadTestReport {
+    uint32_t durationMs;
+    uint32_t writes;
+    uint32_t writesPerSecond;
+    uint32_t dispatchP50Us, dispatchP90Us, dispatchP99Us, dispatchMaxUs; // Write received until callbacks and notifications are done
+    uint32_t persisted;
+    uint32_t persistP50Us, persistP90Us, persistP99Us, persistMaxUs;     // Write received until the value is saved
+    uint32_t freeHeapBefore, freeHeapAfter, minFreeHeap;
+};
+
+struct FirmwareStreamReport {
+    uint32_t durationUs;
+    uint32_t bytes;
+    uint32_t bytesPerSecond; // Bytes the device processes per second, not the rate over the air
+    uint32_t chunks; // Chunks written, with the ones sent again
+    uint32_t resentChunks;
+    uint32_t acks;
+    OtaStatus status; // OTA_DONE if the image was accepted
 };
 
-// -----------------------------------------------------> SERVER CALLBACK <----------------------------------------------------------------
+class SimulatedCentral {
+public:
+    SimulatedCentral(EspBleControlsFactory* factory);
+
+    //Writes to the instance (1, 2, ...) of the control type identified by the UUID suffix (ex. SLIDR_UUID_SUFFIX) ratePerSecond times.
+    //Without ESP_BLE_CONTROLS_NUMBERED_INSTANCES all the instances have count 1, so only instance 1 is found.
+    //If payloadGenerator is nullptr the values are generated from the control type and parameters.
+    bool addWrites(
+        const std::string controlSuffix,
+        const uint16_t instance,
+        const uint16_t ratePerSecond,
+        std::function<std::string(uint32_t)> payloadGenerator = nullptr
+    );
+    LoadTestReport run(const uint32_t durationMs);
+    static void printReport(const LoadTestReport& report, Print& output);
+    //Protocol and CPU benchmark: streams a generated image of imageSize bytes in chunks of chunkSize to the control, a window at a
+    //time like the app, and measures the time the device spends on it. The chunks are handed to the control without the radio,
+    //so it isn't the throughput over the air. With a NullSink only the protocol is measured, with a PartitionSink the flash
+    //writes are included (the generated image isn't signed, so it ends with OTA_SIGNATURE_ERROR).
+    FirmwareStreamReport streamFirmware(OtaControl* control, const uint32_t imageSize, const uint16_t chunkSize);
+    static void printReport(const FirmwareStreamReport& report, Print& output);
+private:
+    struct WriteStream {
+        ControlEntry entry;
+        uint16_t periodMs;
+        uint32_t nextWriteTimeStamp;
+        uint32_t step;
+        std::function<std::string(uint32_t)> payloadGenerator;
+    };
+    std::string generatePayload(WriteStream& stream);
+    EspBleControlsFactory* m_factory;
+    std::vector<WriteStream> m_streams;
+    LatencySamples m_dispatchLatencies, m_persistLatencies;
+};
+
+// -----------------------------------------------------> BLUEDROID TRANSPORT <-------------------------------------------------------------
+// The stack callbacks only report the events, the pairing state machine runs in EspBleControlsFactory::updateControls()
+
+#if !defined(ESP_BLE_CONTROLS_NIMBLE) && !defined(ESP_BLE_CONTROLS_MOCK)
 
 class ServerCallback : public BLEServerCallbacks {
-    void onConnect(BLEServer* pServer) {
-        m_onDeviceConnection(true);
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        m_onDeviceConnection(true, param->connect.remote_bda);
     };
 
     void onDisconnect(BLEServer* pServer) {
-        m_onDeviceConnection(false);
-        vTaskDelay(500);
-        BLEDevice::startAdvertising();
+        m_onDeviceConnection(false, nullptr);
     }
 
 public:
-    ServerCallback(std::function<void(bool)> onDeviceConnection){
+    ServerCallback(std::function<void(bool, const uint8_t*)> onDeviceConnection){
        m_onDeviceConnection = onDeviceConnection;
     };
 
 private:
-    std::function<void(bool)> m_onDeviceConnection;
+    std::function<void(bool, const uint8_t*)> m_onDeviceConnection;
 };
 
-// -----------------------------------------------------> SECURITY CALLBACK <---------------------------------------------------------------
-
 class SecurityCallback : public BLESecurityCallbacks {
     uint32_t onPassKeyRequest() {
         return 0;
@@ -422,7 +2012,6 @@ class SecurityCallback : public BLESecurityCallbacks {
     void onPassKeyNotify(uint32_t pass_key) {}
 
     bool onConfirmPIN(uint32_t pass_key) {
-        vTaskDelay(5000);
         return true;
     }
 
@@ -431,22 +2020,118 @@ class SecurityCallback : public BLESecurityCallbacks {
     }
 
     void onAuthenticationComplete(esp_ble_auth_cmpl_t cmpl) {
-        if (cmpl.success) {
-            m_onDeviceAuthentication(true);
-        } else {
-            m_onDeviceAuthentication(false);
-            vTaskDelay(500);
-            BLEDevice::startAdvertising();
-        }
+        m_onDeviceAuthentication(cmpl.success, cmpl.fail_reason, cmpl.bd_addr);
     };
 
 public:
-    SecurityCallback(std::function<void(bool)> onDeviceAuthentication){
+    SecurityCallback(std::function<void(bool, uint8_t, const uint8_t*)> onDeviceAuthentication){
         m_onDeviceAuthentication = onDeviceAuthentication;
     };
 
 private:
-    std::function<void(bool)> m_onDeviceAuthentication;
+    std::function<void(bool, uint8_t, const uint8_t*)> m_onDeviceAuthentication;
+};
+
+class BluedroidTransport : public BleTransport {
+public:
+    BluedroidTransport();
+    void begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) override;
+    BLECharacteristic* createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) override;
+    void start() override;
+    void startAdvertising() override;
+    void disconnect() override;
+    void notify(BLECharacteristic* characteristic) override { characteristic->notify(); };
+    bool confirmsNotifications() override { return true; };
+    void encryptLink(const uint8_t* address) override;
+    bool isBonded(const uint8_t* address) override;
+    void removeBond(const uint8_t* address) override;
+    void removeAllBonds() override;
+    bool isSubscribed(BLECharacteristic* characteristic) override;
+private:
+    static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param);
+    void setSecurity();
+    TransportListener* m_listener;
+    BLEServer* m_pServer;
+    BLEService* m_pService;
+    std::vector<BLE2902*> m_subscriptionCccds; // The CCCDs of the CHAR_SUBSCRIBE characteristics, cleared at each disconnection
+    uint32_t m_pin;
+};
+
+#endif
+
+// -----------------------------------------------------> NIMBLE TRANSPORT <---------------------------------------------------------------
+// NimBLE reports the peer addresses least significant byte first, they are reversed to match the Bluedroid order.
+// It doesn't confirm the notifications nor report the congestion, a notification it can't buffer fails and is retried.
+
+#if defined(ESP_BLE_CONTROLS_NIMBLE)
+
+class NimBleTransport : public BleTransport, public NimBLEServerCallbacks {
+public:
+    NimBleTransport();
+    void begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) override;
+    BLECharacteristic* createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) override;
+    void start() override;
+    void startAdvertising() override;
+    void disconnect() override;
+    void notify(BLECharacteristic* characteristic) override { characteristic->notify(); };
+    bool confirmsNotifications() override { return false; };
+    void encryptLink(const uint8_t* address) override;
+    bool isBonded(const uint8_t* address) override;
+    void removeBond(const uint8_t* address) override;
+    void removeAllBonds() override;
+    bool isSubscribed(BLECharacteristic* characteristic) override { return characteristic->getSubscribedCount() > 0; };
+
+    void onConnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
+    void onDisconnect(NimBLEServer* pServer, ble_gap_conn_desc* desc) override;
+    void onAuthenticationComplete(ble_gap_conn_desc* desc) override;
+    uint32_t onPassKeyRequest() override { return m_pin; };
+    bool onConfirmPIN(uint32_t pass_key) override { return true; };
+private:
+    TransportListener* m_listener;
+    NimBLEServer* m_pServer;
+    NimBLEService* m_pService;
+    uint32_t m_pin;
+    uint16_t m_connHandle;
+};
+
+#endif
+
+// -----------------------------------------------------> MOCK TRANSPORT <-----------------------------------------------------------------
+// Keeps the characteristics in memory and never starts the radio, so the controls can be exercised (ex. with the SimulatedCentral)
+// on a board without a phone. The connection and the congestion are simulated, the notifications sent to a connected peer are
+// counted and confirmed at once, without a peer they are neither sent nor confirmed (the notifier gives them up after its timeout).
+// With ESP_BLE_CONTROLS_MOCK defined the characteristics are the ones of MockBle.h and no Bluetooth stack is built at all,
+// otherwise they are the characteristics of the selected stack, created outside of any service: the stack never gives them
+// a handle, the transport numbers them itself.
+
+class MockTransport : public BleTransport {
+public:
+    MockTransport();
+    void begin(const std::string deviceName, const uint32_t passkey, TransportListener* listener) override;
+    BLECharacteristic* createCharacteristic(const std::string uuid, const uint8_t properties, const std::string description) override;
+    void start() override {};
+    void startAdvertising() override {};
+    void disconnect() override { simulateConnection(false); };
+    void notify(BLECharacteristic* characteristic) override;
+    bool confirmsNotifications() override { return true; };
+    void encryptLink(const uint8_t* address) override {};
+    bool isBonded(const uint8_t* address) override { return false; };
+    void removeBond(const uint8_t* address) override {};
+    void removeAllBonds() override {};
+    bool isSubscribed(BLECharacteristic* characteristic) override { return m_isConnected; };
+    uint16_t getHandle(BLECharacteristic* characteristic) override;
+    //Connects (and authenticates, if a passkey is set and shouldAuthenticate is true) or disconnects the simulated peer.
+    void simulateConnection(const bool isConnected, const bool shouldAuthenticate = true);
+    //Ends the pairing of the connected peer like the stack does, ex. a rejected or late pairing after simulateConnection(true, false).
+    void simulateAuthentication(const bool isSuccessful, const uint8_t failReason = 0);
+    void simulateCongestion(const bool isCongested);
+    uint32_t getNotificationsCount() { return m_notificationsCount; };
+private:
+    TransportListener* m_listener;
+    uint32_t m_pin;
+    uint32_t m_notificationsCount;
+    std::vector<BLECharacteristic*> m_characteristics; // A characteristic's handle is its position + 1
+    bool m_isConnected;
 };
 
 #endif
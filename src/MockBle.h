@@ -0,0 +1,67 @@
+#ifndef MockBle_h
+#define MockBle_h
+
+// -----------------------------------------------------> MOCK BLE CLASSES <----------------------------------------------------------------
+// Stand-ins for the few BLE classes used by the controls, built instead of a Bluetooth stack when ESP_BLE_CONTROLS_MOCK is defined.
+// The characteristic only keeps its value in memory, so with MockTransport the controls run without Bluedroid or NimBLE
+// (ex. on a board without the Bluetooth stack compiled in, to measure the controls alone).
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+class BLECharacteristic;
+
+class BLEUUID {
+public:
+    BLEUUID() {};
+    BLEUUID(const std::string uuid) { m_uuid = uuid; };
+    std::string toString() const { return m_uuid; };
+private:
+    std::string m_uuid;
+};
+
+class BLECharacteristicCallbacks {
+public:
+    typedef enum { SUCCESS_NOTIFY, ERROR_NOTIFY_DISABLED, ERROR_GATT, ERROR_NO_CLIENT } Status;
+    virtual ~BLECharacteristicCallbacks() {};
+    virtual void onRead(BLECharacteristic* pChar) {};
+    virtual void onWrite(BLECharacteristic* pChar) {};
+    virtual void onNotify(BLECharacteristic* pChar) {};
+    virtual void onStatus(BLECharacteristic* pChar, Status status, uint32_t code) {};
+};
+
+class BLECharacteristic {
+public:
+    BLECharacteristic(const BLEUUID uuid, const uint16_t handle) { m_uuid = uuid; m_handle = handle; };
+    void setValue(const uint8_t* data, const size_t length) { m_value.assign((const char*) data, length); };
+    void setValue(const std::string& value) { m_value = value; };
+    std::string getValue() { return m_value; };
+    uint8_t* getData() { return (uint8_t*) m_value.data(); };
+    size_t getLength() { return m_value.length(); };
+    BLEUUID getUUID() { return m_uuid; };
+    uint16_t getHandle() { return m_handle; };
+    void setCallbacks(BLECharacteristicCallbacks* callbacks) { m_callbacks = callbacks; };
+    BLECharacteristicCallbacks* getCallbacks() { return m_callbacks; };
+    void notify() {
+        if (m_callbacks == nullptr) return;
+        m_callbacks->onNotify(this);
+        m_callbacks->onStatus(this, BLECharacteristicCallbacks::SUCCESS_NOTIFY, 0);
+    };
+    //Does what the stack does when a central writes or reads the characteristic.
+    void simulateWrite(const uint8_t* data, const size_t length) {
+        setValue(data, length);
+        if (m_callbacks != nullptr) m_callbacks->onWrite(this);
+    };
+    std::string simulateRead() {
+        if (m_callbacks != nullptr) m_callbacks->onRead(this);
+        return m_value;
+    };
+private:
+    BLEUUID m_uuid;
+    uint16_t m_handle;
+    std::string m_value;
+    BLECharacteristicCallbacks* m_callbacks = nullptr;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef ValueCodec_h
+#define ValueCodec_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// All numeric values are sent little endian. The bytes are copied with memcpy and swapped only when the requested byte order
+// differs from the one of the microcontroller. Decoding checks the payload length and leaves the value untouched if it's too short.
+// It only uses the standard library, so it can be built and tested on the host (see test/host).
+
+constexpr bool IS_LITTLE_ENDIAN_HOST = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+template <size_t Size> struct CodecWord {};
+template <> struct CodecWord<1> { typedef uint8_t Type; static constexpr Type swap(Type word) { return word; } };
+template <> struct CodecWord<2> { typedef uint16_t Type; static constexpr Type swap(Type word) { return __builtin_bswap16(word); } };
+template <> struct CodecWord<4> { typedef uint32_t Type; static constexpr Type swap(Type word) { return __builtin_bswap32(word); } };
+template <> struct CodecWord<8> { typedef uint64_t Type; static constexpr Type swap(Type word) { return __builtin_bswap64(word); } };
+
+template <typename ValueType>
+constexpr size_t encodedSize() {
+    static_assert(std::is_arithmetic<ValueType>::value, "Only arithmetic values have a fixed encoded size");
+    return sizeof(ValueType);
+}
+
+template <typename ValueType>
+bool decodeValue(const uint8_t* bytes, const size_t length, ValueType& value, const bool bigEndian = false) {
+    typedef CodecWord<encodedSize<ValueType>()> Word;
+    if (bytes == nullptr || length < sizeof(ValueType)) return false;
+    typename Word::Type word;
+    memcpy(&word, bytes, sizeof(ValueType));
+    if (bigEndian == IS_LITTLE_ENDIAN_HOST) word = Word::swap(word);
+    memcpy(&value, &word, sizeof(ValueType));
+    return true;
+}
+
+template <typename ValueType>
+size_t encodeValue(const ValueType value, uint8_t* bytes, const size_t capacity, const bool bigEndian = false) {
+    typedef CodecWord<encodedSize<ValueType>()> Word;
+    if (bytes == nullptr || capacity < sizeof(ValueType)) return 0;
+    typename Word::Type word;
+    memcpy(&word, &value, sizeof(ValueType));
+    if (bigEndian == IS_LITTLE_ENDIAN_HOST) word = Word::swap(word);
+    memcpy(bytes, &word, sizeof(ValueType));
+    return sizeof(ValueType);
+}
+
+#endif
@@ -12,13 +12,14 @@ DS3232RTC externalRTC;
 EspBleControlsFactory* controlsFactory;
 ControlPublisher<std::string> isLightOn;
 ControlPublisher<int32_t> intValue;
-std::string color = "FFFFFF";
+RgbColor color = { 0xFF, 0xFF, 0xFF, 0 };
+constexpr GammaTable<> lightGamma;
 
 void toggleLight() {
   if (isLightOn.getValue() == "ON") {
-    analogWrite(LIGHT_RED_PIN, stoi(color.substr(0,2), 0, 16)); 
-    analogWrite(LIGHT_GREEN_PIN, stoi(color.substr(2,2), 0, 16));
-    analogWrite(LIGHT_BLUE_PIN, stoi(color.substr(4,2), 0, 16)); 
+    analogWrite(LIGHT_RED_PIN, lightGamma[color.red]); 
+    analogWrite(LIGHT_GREEN_PIN, lightGamma[color.green]);
+    analogWrite(LIGHT_BLUE_PIN, lightGamma[color.blue]); 
   } else {
     analogWrite(LIGHT_RED_PIN, 0);
     analogWrite(LIGHT_GREEN_PIN, 0);
@@ -42,7 +43,7 @@ void setup() {
   controlsFactory->createIntervalControl("Lights on Timer", 5, 5, [](bool isOn) -> void { isLightOn.setValue((isOn) ? "ON" : "OFF", nullptr); });
   controlsFactory->createSwitchControl("Light Switch", "OFF", &isLightOn, [](std::string value) -> void { });
   controlsFactory->createMomentaryControl("Momentary Light Switch", "OFF", false, &isLightOn, [](std::string value) -> void { });
-  controlsFactory->createColorControl("Light Color", "FF0000", nullptr, [](std::string value) -> void { color = value; toggleLight(); });
+  controlsFactory->createColorControl("Light Color", false, { 0xFF, 0, 0, 0 }, nullptr, [](const RgbColor& value) -> void { color = value; toggleLight(); });
   controlsFactory->createSliderControl("Integer Slider", -255, 255, 32, 0, &intValue, [](int32_t value) -> void { });
   controlsFactory->createIntControl("Integer Input", -512, 512, 0, &intValue, [](int32_t value) -> void { });
   controlsFactory->createFloatControl("Float Input", -255, 255, 123.45, nullptr, [](float_t value) -> void { });
@@ -50,6 +51,12 @@ void setup() {
   controlsFactory->createAngleControl("Angle Adjustment", 55, false, nullptr, [](uint32_t value) -> void { });
 
   controlsFactory->startService();
+
+  // Build the esp32-c3, esp32-c3-nimble and esp32-c3-mock environments to compare what the stacks take on this board
+  const TransportStats stats = controlsFactory->getTransportStats();
+  Serial.begin(115200);
+  Serial.printf("Stack startup %lu us, stack heap %lu bytes, free heap %lu bytes\n", (unsigned long) stats.startupMicros,
+    (unsigned long) stats.stackHeapBytes, (unsigned long) stats.freeHeapBytes);
 }
 
 void loop() {
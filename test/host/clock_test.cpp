@@ -0,0 +1,128 @@
+// Host test of the ClockControl on a VirtualClock: the millisecond sync slews the small offsets and steps the large ones, the
+// writes of another size are refused, the offsets between the syncs give the drift and the loop corrects it until the next sync.
+// The SystemClock isn't used, its slew calls adjtime() on the host clock.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+
+#define START_EPOCH         1700000000UL
+#define DRIFT_PPM           100
+#define DRIFT_SECONDS       1000
+#define CORRECTION_STEP_MS  1000
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+static void writeSync(ClockControl* clockControl, const uint64_t appMillis, const uint16_t roundTripMillis) {
+    uint8_t message[CLOCK_SYNC_SIZE];
+    for (size_t index = 0; index < sizeof(uint64_t); index++) message[index] = appMillis >> (8 * index);
+    message[8] = roundTripMillis;
+    message[9] = roundTripMillis >> 8;
+    clockControl->getCharacteristic()->simulateWrite(message, sizeof(message));
+}
+
+static uint32_t getCharacteristicEpoch(ClockControl* clockControl) {
+    uint32_t epoch = 0;
+    decodeValue(clockControl->getCharacteristic()->getData(), clockControl->getCharacteristic()->getLength(), epoch);
+    return epoch;
+}
+
+// Advances the clock in steps, running the loop of the control in between like the sketch does
+static void runLoop(VirtualClock& clock, ClockControl* clockControl, const uint32_t milliseconds) {
+    for (uint32_t elapsed = 0; elapsed < milliseconds; elapsed += CORRECTION_STEP_MS) {
+        clock.advance(CORRECTION_STEP_MS);
+        clockControl->update();
+    }
+}
+
+// -----------------------------------------------------> SYNC <----------------------------------------------------------------------------
+
+static void testSync(VirtualClock& clock, ClockControl* clockControl) {
+    // Half the round trip is added, 500 + 100 ms is under the step threshold so it's slewed
+    const uint64_t start = clock.getEpochTime();
+    writeSync(clockControl, start + 500, 200);
+    check(clockControl->getLastOffset() == 600, "the offset includes half the round trip");
+    check(clock.getEpochTime() == start, "a small offset doesn't step the clock");
+    check(getCharacteristicEpoch(clockControl) == clock.getEpoch(), "the characteristic shows the time after the sync");
+    clock.advance(600 * CLOCK_SLEW_DIVIDER);
+    check(clock.getEpochTime() == start + 600 + 600 * CLOCK_SLEW_DIVIDER, "the offset is slewed away");
+
+    const uint64_t stepped = clock.getEpochTime() + 10000;
+    writeSync(clockControl, stepped, 0);
+    check(clockControl->getLastOffset() == 10000, "the large offset is measured");
+    check(clock.getEpochTime() == stepped, "a large offset steps the clock");
+    check(getCharacteristicEpoch(clockControl) == stepped / 1000, "the characteristic shows the stepped time");
+}
+
+// -----------------------------------------------------> WRITE SIZES <---------------------------------------------------------------------
+
+static void testWriteSizes(VirtualClock& clock, ClockControl* clockControl) {
+    const uint32_t syncCount = clockControl->getSyncCount();
+    const uint64_t before = clock.getEpochTime();
+    const uint8_t partial[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    clockControl->getCharacteristic()->simulateWrite(partial, sizeof(partial));
+    const uint8_t longer[CLOCK_SYNC_SIZE + 1] = { 0 };
+    clockControl->getCharacteristic()->simulateWrite(longer, sizeof(longer));
+    check(clock.getEpochTime() == before && clockControl->getSyncCount() == syncCount, "the writes of other sizes are refused");
+
+    const uint32_t epoch = START_EPOCH + 3600;
+    const uint8_t message[4] = { (uint8_t) epoch, (uint8_t) (epoch >> 8), (uint8_t) (epoch >> 16), (uint8_t) (epoch >> 24) };
+    clockControl->getCharacteristic()->simulateWrite(message, sizeof(message));
+    check(clock.getEpoch() == epoch, "the epoch write steps the clock");
+    check(getCharacteristicEpoch(clockControl) == epoch, "the characteristic shows the written epoch");
+}
+
+// -----------------------------------------------------> DRIFT <---------------------------------------------------------------------------
+
+static void testDrift(VirtualClock& clock, ClockControl* clockControl) {
+    // The reference runs DRIFT_PPM faster than the clock, the step starts the drift measure again
+    uint64_t reference = clock.getEpochTime() + 5000;
+    writeSync(clockControl, reference, 0);
+    clock.advance(DRIFT_SECONDS * 1000);
+    reference += DRIFT_SECONDS * 1000 + DRIFT_SECONDS * DRIFT_PPM / 1000;
+    writeSync(clockControl, reference, 0);
+    check(clockControl->getLastOffset() == DRIFT_SECONDS * DRIFT_PPM / 1000, "the offset after the drift is measured");
+    check(clockControl->getDriftPpb() == DRIFT_PPM * 1000, "the drift is estimated from the offset");
+
+    // The loop slews the offset of the sync and then the drift, so the clock follows the reference
+    runLoop(clock, clockControl, DRIFT_SECONDS * 1000);
+    reference += DRIFT_SECONDS * 1000 + DRIFT_SECONDS * DRIFT_PPM / 1000;
+    const int64_t error = (int64_t) (reference - clock.getEpochTime());
+    check(error >= -1 && error <= 1, "the drift is corrected between the syncs");
+
+    // A second estimate with no offset left keeps the drift
+    writeSync(clockControl, reference, 0);
+    const int32_t driftError = clockControl->getDriftPpb() - DRIFT_PPM * 1000;
+    check(driftError >= -1000 && driftError <= 1000, "a drift that was corrected is kept");
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    VirtualClock clock(START_EPOCH);
+    setClockSource(&clock);
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    ClockControl* clockControl = controls->createClockControl("Clock", START_EPOCH, 0, [](uint32_t) {});
+    controls->startService();
+    transport->simulateConnection(true);
+    controls->updateControls();
+
+    testSync(clock, clockControl);
+    testWriteSizes(clock, clockControl);
+    testDrift(clock, clockControl);
+    setClockSource(nullptr);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Clock test passed\n");
+    return 0;
+}
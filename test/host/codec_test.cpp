@@ -0,0 +1,181 @@
+// Host test of the value codec: a fuzz loop that checks decodeValue/encodeValue against a byte by byte reference,
+// and a benchmark against the decoding that was used before (bytesToIntegerType and bytesToFloat).
+// Build and run it with "make" in this folder, it only needs g++.
+
+#include "ValueCodec.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+// -----------------------------------------------------> PREVIOUS DECODING <---------------------------------------------------------------
+// Copied as they were. The little endian loop of bytesToIntegerType reads one byte past the value (the buffers have a spare byte)
+// and shifts signed values out of range, so the undefined behavior sanitizer is turned off for it.
+
+#pragma GCC diagnostic ignored "-Wignored-qualifiers"
+
+template <typename IntegerType>
+__attribute__((no_sanitize_undefined))
+const IntegerType bytesToIntegerType(uint8_t* bytes, bool big_endian = false) {
+    IntegerType result = 0;
+    if (!big_endian)
+        for (int n = sizeof(result); n >= 0; n--)
+            result = (result << 8) + bytes[n];
+    else
+        for (unsigned n = 0; n < sizeof(result); n++)
+            result = (result << 8) + bytes[n];
+    return result;
+}
+
+const float bytesToFloat(uint8_t* bytes, bool big_endian = false) {
+    float result = 0;
+    uint8_t* floatPointer = (uint8_t*)&result;
+    if (!big_endian) {
+        floatPointer[3] = bytes[3];
+        floatPointer[2] = bytes[2];
+        floatPointer[1] = bytes[1];
+        floatPointer[0] = bytes[0];
+    } else {
+        floatPointer[3] = bytes[0];
+        floatPointer[2] = bytes[1];
+        floatPointer[1] = bytes[2];
+        floatPointer[0] = bytes[3];
+    }
+    return result;
+}
+
+// -----------------------------------------------------> FUZZ LOOP <-----------------------------------------------------------------------
+
+#define FUZZ_ITERATIONS     200000
+#define BENCHMARK_VALUES    4096
+#define BENCHMARK_ROUNDS    2000
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message, const uint32_t iteration) {
+    if (condition) return;
+    if (failures++ < 10) printf("FAIL %s (iteration %u)\n", message, iteration);
+}
+
+template <typename ValueType>
+static ValueType referenceDecode(const uint8_t* bytes, const bool bigEndian) {
+    uint64_t word = 0;
+    for (size_t index = 0; index < sizeof(ValueType); index++) {
+        const uint64_t byte = bytes[bigEndian ? sizeof(ValueType) - 1 - index : index];
+        word |= byte << (8 * index);
+    }
+    ValueType value;
+    memcpy(&value, &word, sizeof(ValueType));
+    return value;
+}
+
+template <typename ValueType>
+static void fuzzType(std::mt19937& random, const uint32_t iteration) {
+    uint8_t bytes[16];
+    for (uint8_t& byte : bytes) byte = random();
+    const size_t length = random() % (sizeof(ValueType) * 2 + 1);
+    const bool bigEndian = random() & 1;
+
+    ValueType value;
+    memset(&value, 0x5A, sizeof(ValueType));
+    ValueType untouched = value;
+    const bool decoded = decodeValue(bytes, length, value, bigEndian);
+    check(decoded == (length >= sizeof(ValueType)), "decode accepts only complete values", iteration);
+    if (!decoded) {
+        check(memcmp(&value, &untouched, sizeof(ValueType)) == 0, "a short value is left untouched", iteration);
+        check(!decodeValue<ValueType>(nullptr, length, value, bigEndian), "a null buffer is rejected", iteration);
+        return;
+    }
+    const ValueType expected = referenceDecode<ValueType>(bytes, bigEndian);
+    check(memcmp(&value, &expected, sizeof(ValueType)) == 0, "decode matches the reference", iteration);
+
+    uint8_t encoded[16];
+    const size_t capacity = random() % (sizeof(ValueType) * 2 + 1);
+    const size_t encodedLength = encodeValue(value, encoded, capacity, bigEndian);
+    check(encodedLength == (capacity >= sizeof(ValueType) ? sizeof(ValueType) : 0), "encode needs the full capacity", iteration);
+    if (encodedLength != 0) check(memcmp(encoded, bytes, sizeof(ValueType)) == 0, "encode is the inverse of decode", iteration);
+}
+
+static void fuzz() {
+    std::mt19937 random(20240229);
+    for (uint32_t iteration = 0; iteration < FUZZ_ITERATIONS; iteration++) {
+        switch (iteration % 7) {
+            case 0: fuzzType<uint8_t>(random, iteration); break;
+            case 1: fuzzType<int16_t>(random, iteration); break;
+            case 2: fuzzType<uint16_t>(random, iteration); break;
+            case 3: fuzzType<int32_t>(random, iteration); break;
+            case 4: fuzzType<float>(random, iteration); break;
+            case 5: fuzzType<int64_t>(random, iteration); break;
+            case 6: fuzzType<double>(random, iteration); break;
+        }
+    }
+    // The values the controls send must decode like the previous decoding did
+    std::mt19937 values(7);
+    for (uint32_t iteration = 0; iteration < FUZZ_ITERATIONS; iteration++) {
+        uint8_t bytes[sizeof(int32_t) + 1] = {};
+        for (size_t index = 0; index < sizeof(int32_t); index++) bytes[index] = values();
+        int32_t intValue = 0;
+        float floatValue = 0;
+        decodeValue(bytes, sizeof(int32_t), intValue);
+        decodeValue(bytes, sizeof(float), floatValue);
+        check(intValue == bytesToIntegerType<int32_t>(bytes), "int32 matches bytesToIntegerType", iteration);
+        const float previous = bytesToFloat(bytes);
+        check(memcmp(&floatValue, &previous, sizeof(float)) == 0, "float matches bytesToFloat", iteration);
+    }
+}
+
+// -----------------------------------------------------> BENCHMARK <-----------------------------------------------------------------------
+
+template <typename Function>
+static double nanosecondsPerValue(Function decode) {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < BENCHMARK_ROUNDS; round++) decode();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ((double) BENCHMARK_ROUNDS * BENCHMARK_VALUES);
+}
+
+static void benchmark() {
+    static uint8_t buffer[BENCHMARK_VALUES * sizeof(int32_t) + 1];
+    std::mt19937 random(1);
+    for (uint8_t& byte : buffer) byte = random();
+    volatile int64_t sink = 0;
+    volatile float floatSink = 0;
+
+    const double previousInt = nanosecondsPerValue([&]() {
+        int64_t sum = 0;
+        for (size_t index = 0; index < BENCHMARK_VALUES; index++) sum += bytesToIntegerType<int32_t>(buffer + index * sizeof(int32_t));
+        sink = sink + sum;
+    });
+    const double codecInt = nanosecondsPerValue([&]() {
+        int64_t sum = 0;
+        int32_t value = 0;
+        for (size_t index = 0; index < BENCHMARK_VALUES; index++) {
+            decodeValue(buffer + index * sizeof(int32_t), sizeof(int32_t), value);
+            sum += value;
+        }
+        sink = sink + sum;
+    });
+    const double previousFloat = nanosecondsPerValue([&]() {
+        float sum = 0;
+        for (size_t index = 0; index < BENCHMARK_VALUES; index++) sum += bytesToFloat(buffer + index * sizeof(float));
+        floatSink = floatSink + sum;
+    });
+    const double codecFloat = nanosecondsPerValue([&]() {
+        float sum = 0;
+        float value = 0;
+        for (size_t index = 0; index < BENCHMARK_VALUES; index++) {
+            decodeValue(buffer + index * sizeof(float), sizeof(float), value);
+            sum += value;
+        }
+        floatSink = floatSink + sum;
+    });
+    printf("int32: bytesToIntegerType %.2f ns, decodeValue %.2f ns\n", previousInt, codecInt);
+    printf("float: bytesToFloat %.2f ns, decodeValue %.2f ns\n", previousFloat, codecFloat);
+}
+
+int main() {
+    fuzz();
+    printf("fuzz: %u iterations, %u failures\n", FUZZ_ITERATIONS * 2, failures);
+    benchmark();
+    return failures == 0 ? 0 : 1;
+}
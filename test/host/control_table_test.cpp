@@ -0,0 +1,100 @@
+// Host test of the ControlTable: the controls created from a constexpr table get the UUIDs the create methods give them, and
+// createControls() opens the Preferences once for the whole table instead of once for each control. It prints the time both
+// ways take on the host, with the MockTransport and the in-memory Preferences, so they are host numbers, not board ones.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+
+#define TABLE_ROUNDS    4   // Each round declares one control of each type, they must fit in SERVICE_HANDLES
+#define TIMED_RUNS      200
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+static void onText(const std::string&) {}
+static void onInt(int32_t) {}
+static void onFloat(float_t) {}
+
+#define DECLARED_ROUND \
+    declareSwitchControl("Light", "OFF", nullptr, onText), \
+    declareMomentaryControl("Bell", "OFF", false, nullptr, onText), \
+    declareSliderControl("Level", 0, 100, 1, 50, nullptr, onInt), \
+    declareIntControl("Count", 0, 1000, 0, nullptr, onInt), \
+    declareAngleControl("Heading", 0, true, nullptr, onInt), \
+    declareFloatControl("Setpoint", 0, 50, 21.5f, nullptr, onFloat)
+
+constexpr ControlDeclaration declarations[] = { DECLARED_ROUND, DECLARED_ROUND, DECLARED_ROUND, DECLARED_ROUND };
+constexpr ControlTable<std::size(declarations)> table(declarations);
+static_assert(std::size(declarations) == TABLE_ROUNDS * 6, "a round declares one control of each type");
+static_assert(table.getAttributesCount() < SERVICE_HANDLES - 10, "the table fits in the service");
+
+// -----------------------------------------------------> CREATION <------------------------------------------------------------------------
+
+static EspBleControlsFactory* createWithTable() {
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 0, new MockTransport());
+    controls->createControls(table);
+    return controls;
+}
+
+static EspBleControlsFactory* createOneByOne() {
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 0, new MockTransport());
+    for (uint8_t round = 0; round < TABLE_ROUNDS; round++) {
+        controls->createSwitchControl("Light", "OFF", nullptr, onText);
+        controls->createMomentaryControl("Bell", "OFF", false, nullptr, onText);
+        controls->createSliderControl("Level", 0, 100, 1, 50, nullptr, onInt);
+        controls->createIntControl("Count", 0, 1000, 0, nullptr, onInt);
+        controls->createAngleControl("Heading", 0, true, nullptr, onInt);
+        controls->createFloatControl("Setpoint", 0, 50, 21.5f, nullptr, onFloat);
+    }
+    return controls;
+}
+
+static uint32_t countBegins(EspBleControlsFactory* (*create)()) {
+    const uint32_t beginsBefore = hostPreferencesStats.begins;
+    create();
+    return hostPreferencesStats.begins - beginsBefore;
+}
+
+static uint32_t timeCreation(EspBleControlsFactory* (*create)()) {
+    const uint32_t startTimeStamp = micros();
+    for (uint16_t run = 0; run < TIMED_RUNS; run++) create();
+    return (micros() - startTimeStamp) / TIMED_RUNS;
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    const std::vector<ControlEntry>& tableEntries = createWithTable()->getControlEntries();
+    const std::vector<ControlEntry>& createdEntries = createOneByOne()->getControlEntries();
+    check(tableEntries.size() == std::size(declarations), "every declared control is created");
+    bool areUuidsEqual = tableEntries.size() == createdEntries.size();
+    for (size_t index = 0; areUuidsEqual && index < tableEntries.size(); index++) {
+        areUuidsEqual = tableEntries[index].uuid == createdEntries[index].uuid;
+    }
+    check(areUuidsEqual, "the table gives the UUIDs of the create methods");
+
+    const uint32_t tableBegins = countBegins(createWithTable);
+    const uint32_t oneByOneBegins = countBegins(createOneByOne);
+    check(tableBegins == 1, "the table opens the Preferences once");
+    check(oneByOneBegins == std::size(declarations), "the create methods open the Preferences for each control");
+
+    // Timed after the counts, so the saved values namespace exists for both
+    const uint32_t tableMicros = timeCreation(createWithTable);
+    const uint32_t oneByOneMicros = timeCreation(createOneByOne);
+    printf("%u controls on the host: table %lu us and %lu Preferences begin, one by one %lu us and %lu begins\n",
+        (unsigned) std::size(declarations), (unsigned long) tableMicros, (unsigned long) tableBegins, (unsigned long) oneByOneMicros,
+        (unsigned long) oneByOneBegins);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Control table test passed\n");
+    return 0;
+}
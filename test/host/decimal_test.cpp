@@ -0,0 +1,106 @@
+// Host test of the decimal control: formatDecimal against the text printf gives for the same value, the scaled integers written
+// by the app reaching the callback unchanged, and the fraction digits lowered until the scaled limits fit in 32 bits.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#define FUZZ_ITERATIONS 100000
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+static bool formatsAs(const int32_t value, const uint8_t fractionDigits, const char* expected) {
+    char text[16];
+    const size_t length = formatDecimal(value, fractionDigits, text);
+    return length == strlen(expected) && strcmp(text, expected) == 0;
+}
+
+// -----------------------------------------------------> FORMAT <--------------------------------------------------------------------------
+
+static void testFormat() {
+    check(formatsAs(2150, 2, "21.50"), "a value with 2 fraction digits");
+    check(formatsAs(-2150, 2, "-21.50"), "a negative value");
+    check(formatsAs(5, 3, "0.005"), "a value under 1 has a leading zero");
+    check(formatsAs(-5, 3, "-0.005"), "a negative value under 1 keeps the sign");
+    check(formatsAs(0, 0, "0") && formatsAs(0, 2, "0.00"), "zero");
+    check(formatsAs(INT32_MIN, 0, "-2147483648"), "the smallest value");
+    check(formatsAs(INT32_MAX, MAX_FRACTION_DIGITS, "2.147483647"), "the largest value with the most digits");
+    check(formatsAs(INT32_MIN, 12, "-2.147483648"), "more digits than MAX_FRACTION_DIGITS are capped");
+
+    // The integer part and the fraction printed with integer division, as a reference
+    std::mt19937 random(42);
+    for (uint32_t iteration = 0; iteration < FUZZ_ITERATIONS; iteration++) {
+        const int32_t value = (int32_t) random();
+        const uint8_t digits = random() % (MAX_FRACTION_DIGITS + 1);
+        const int64_t scale = decimalScale(digits);
+        const int64_t magnitude = (value < 0) ? -(int64_t) value : value;
+        char expected[24];
+        if (digits == 0) snprintf(expected, sizeof(expected), "%" PRId32, value);
+        else snprintf(expected, sizeof(expected), "%s%" PRId64 ".%0*" PRId64, (value < 0) ? "-" : "", magnitude / scale, (int) digits,
+            magnitude % scale);
+        if (!formatsAs(value, digits, expected)) {
+            check(false, "a random value is formatted like the reference");
+            break;
+        }
+    }
+}
+
+// -----------------------------------------------------> CONTROL <-------------------------------------------------------------------------
+
+static uint8_t getUuidDigits(EspBleControlsFactory* controls, IntControl* control) {
+    for (const ControlEntry& entry : controls->getControlEntries()) {
+        if (entry.characteristic == control->getCharacteristic()) return std::stoi(entry.uuid.substr(19, 4), nullptr, 16);
+    }
+    return UINT8_MAX;
+}
+
+static void testControl(EspBleControlsFactory* controls, IntControl* setpoint, const int32_t& received) {
+    for (const int32_t value : { 2150, -2150, 0, INT32_MAX, INT32_MIN }) {
+        uint8_t bytes[sizeof(value)];
+        encodeValue(value, bytes, sizeof(bytes));
+        setpoint->getCharacteristic()->simulateWrite(bytes, sizeof(bytes));
+        check(received == value, "the written scaled value reaches the callback");
+    }
+    char text[16];
+    formatDecimal(received, 2, text);
+    check(strcmp(text, "-21474836.48") == 0, "the received value is formatted with the digits of the control");
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    testFormat();
+
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    int32_t received = 0;
+    IntControl* setpoint = controls->createDecimalControl("Setpoint", -50, 150, 2, 2150, nullptr, [&](int32_t value) { received = value; });
+    IntControl* precise = controls->createDecimalControl("Precise", -2, 2, 12, 0, nullptr, nullptr);
+    IntControl* large = controls->createDecimalControl("Large", 0, 20000, 9, 0, nullptr, nullptr);
+    IntControl* widest = controls->createDecimalControl("Widest", INT16_MIN, INT16_MAX, 9, 0, nullptr, nullptr);
+    controls->startService();
+    transport->simulateConnection(true);
+    controls->updateControls();
+
+    testControl(controls, setpoint, received);
+    check(getUuidDigits(controls, setpoint) == 2, "the digits that fit are kept");
+    check(getUuidDigits(controls, precise) == MAX_FRACTION_DIGITS, "the digits are capped at MAX_FRACTION_DIGITS");
+    check(getUuidDigits(controls, large) == 5, "the digits are lowered until the limits fit in 32 bits");
+    check(getUuidDigits(controls, widest) == 4, "the widest limits keep 4 digits");
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Decimal test passed\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Host test of the HistoryBuffer: the pages read from any sample give back the samples that were added, also when the oldest
+// ones were dropped, and a serialized history loads into a new buffer that then reads and grows like the original.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+#include <random>
+
+#define CAPACITY        100
+#define SAMPLE_SECONDS  300
+#define SAMPLES_COUNT   250
+#define READ_PAGE_SIZE  64
+#define START_EPOCH     1700006400UL
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+struct Sample {
+    uint32_t sequence;
+    uint32_t epoch;
+    int32_t value;
+
+    bool operator==(const Sample& other) const { return sequence == other.sequence && epoch == other.epoch && value == other.value; }
+};
+
+// -----------------------------------------------------> PAGES <---------------------------------------------------------------------------
+
+static bool readVarint(const uint8_t* page, const size_t length, size_t& position, uint32_t& value) {
+    value = 0;
+    for (uint8_t shift = 0; position < length && shift < 35; shift += 7) {
+        const uint8_t byte = page[position++];
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// Decodes a page like the app does, the first sample is absolute and the next ones are differences
+static std::vector<Sample> decodePage(const uint8_t* page, const size_t length) {
+    std::vector<Sample> samples;
+    Sample sample;
+    uint16_t sampleSeconds = 0;
+    uint16_t count = 0;
+    decodeValue(page, length, sample.sequence);
+    decodeValue(page + 4, length - 4, sample.epoch);
+    decodeValue(page + 8, length - 8, sample.value);
+    decodeValue(page + 12, length - 12, sampleSeconds);
+    decodeValue(page + 14, length - 14, count);
+    if (count > 0) samples.push_back(sample);
+    size_t position = 16;
+    uint32_t intervals, zigzag;
+    while (samples.size() < count && readVarint(page, length, position, intervals) && readVarint(page, length, position, zigzag)) {
+        sample.sequence++;
+        sample.epoch += intervals * sampleSeconds;
+        sample.value = (int32_t) ((uint32_t) sample.value + (uint32_t) ((int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1)));
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+static std::vector<Sample> readAll(HistoryBuffer& history, uint32_t fromSequence) {
+    std::vector<Sample> samples;
+    uint8_t page[READ_PAGE_SIZE];
+    while (fromSequence != history.getNextSequence()) {
+        const std::vector<Sample> pageSamples = decodePage(page, history.writePage(fromSequence, page, sizeof(page)));
+        if (pageSamples.empty()) break;
+        samples.insert(samples.end(), pageSamples.begin(), pageSamples.end());
+        fromSequence = pageSamples.back().sequence + 1;
+    }
+    return samples;
+}
+
+static std::vector<Sample> addSamples(HistoryBuffer& history, std::mt19937& random, const uint32_t count, uint32_t& epoch, int32_t& value) {
+    std::vector<Sample> added;
+    for (uint32_t index = 0; index < count; index++) {
+        // Mostly small steps every interval, sometimes a gap or a large jump
+        epoch += SAMPLE_SECONDS * ((random() % 10 == 0) ? 1 + random() % 20 : 1);
+        value = (int32_t) ((uint32_t) value + ((random() % 20 == 0) ? random() : random() % 21 - 10));
+        const uint32_t sequence = history.getNextSequence();
+        history.add(epoch, value);
+        added.push_back({ sequence, epoch, value });
+    }
+    return added;
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    std::mt19937 random(42);
+    uint32_t epoch = START_EPOCH;
+    int32_t value = 2150;
+    HistoryBuffer history(CAPACITY, SAMPLE_SECONDS);
+    check(readAll(history, 0).empty(), "an empty history has no samples");
+    const std::vector<Sample> added = addSamples(history, random, SAMPLES_COUNT, epoch, value);
+
+    check(history.getNextSequence() == SAMPLES_COUNT, "every sample gets a sequence");
+    check(history.getCount() > 0 && history.getCount() <= CAPACITY, "the oldest samples are dropped");
+    const std::vector<Sample> kept(added.end() - history.getCount(), added.end());
+    check(readAll(history, history.getFirstSequence()) == kept, "the pages give back the samples that are kept");
+    check(readAll(history, 0) == kept, "a page asked from a dropped sample starts from the oldest one");
+    const uint32_t middle = history.getFirstSequence() + history.getCount() / 2;
+    check(readAll(history, middle) == std::vector<Sample>(added.begin() + middle, added.end()), "a page can start from any sample");
+
+    const std::vector<uint8_t> data = history.serialize();
+    HistoryBuffer loaded(CAPACITY, SAMPLE_SECONDS);
+    check(loaded.deserialize(data.data(), data.size()), "a serialized history loads");
+    check(loaded.getFirstSequence() == history.getFirstSequence() && loaded.getNextSequence() == history.getNextSequence(),
+        "the loaded history keeps the sequences");
+    check(readAll(loaded, 0) == kept, "the loaded history gives back the same samples");
+
+    // Both grow the same way, the newest sample was restored too
+    std::mt19937 sameRandom = random;
+    uint32_t loadedEpoch = epoch;
+    int32_t loadedValue = value;
+    addSamples(history, random, CAPACITY / 2, epoch, value);
+    addSamples(loaded, sameRandom, CAPACITY / 2, loadedEpoch, loadedValue);
+    check(readAll(loaded, 0) == readAll(history, 0), "the loaded history grows like the original");
+
+    HistoryBuffer otherInterval(CAPACITY, SAMPLE_SECONDS * 2);
+    check(!otherInterval.deserialize(data.data(), data.size()), "a history saved with another interval is dropped");
+    HistoryBuffer smaller(CAPACITY / 4, SAMPLE_SECONDS);
+    check(!smaller.deserialize(data.data(), data.size()), "a history larger than the buffer is dropped");
+    check(!loaded.deserialize(data.data(), 10), "a truncated history is dropped");
+
+    history.clear();
+    check(history.getCount() == 0 && readAll(history, 0).empty(), "a cleared history has no samples");
+    history.add(epoch, value);
+    const std::vector<Sample> afterClear = readAll(history, 0);
+    check(afterClear.size() == 1 && afterClear[0].value == value, "a cleared history starts again from the next sample");
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("History test passed\n");
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Host test of the SimulatedCentral on the MockTransport: the load test makes the writes at the rates it was given, reports
+// the saves it measured, and leaves the saved values of the controls as they were, with its own namespace cleared. It also
+// streams a generated image to an OtaControl with a NullSink. The reports are printed, they are host numbers (no radio, the
+// Preferences in memory), not the ones of a board.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <algorithm>
+#include <cstdio>
+
+#define DURATION_MS     2000
+#define SLIDER_RATE     50
+#define NUMBER_RATE     10
+#define TEXT_RATE       2
+#define SAVED_NUMBER    42
+#define IMAGE_SIZE      (64 * 1024)
+#define CHUNK_SIZE      244
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// The int saved for the control in the namespace, or INT32_MIN if there is none
+static int32_t getSavedValue(EspBleControlsFactory* controls, IntControl* control, const char* preferencesId) {
+    for (const ControlEntry& entry : controls->getControlEntries()) {
+        if (entry.characteristic != control->getCharacteristic()) continue;
+        std::string key = entry.uuid.substr(24, 12);
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+        Preferences preferences;
+        preferences.begin(preferencesId, true);
+        const int32_t value = preferences.isKey(key.c_str()) ? preferences.getInt(key.c_str(), INT32_MIN) : INT32_MIN;
+        preferences.end();
+        return value;
+    }
+    return INT32_MIN;
+}
+
+static void writeValue(IntControl* control, const int32_t value) {
+    uint8_t bytes[sizeof(int32_t)];
+    encodeValue(value, bytes, sizeof(bytes));
+    control->getCharacteristic()->simulateWrite(bytes, sizeof(bytes));
+}
+
+// -----------------------------------------------------> LOAD TEST <-----------------------------------------------------------------------
+
+static void testRun(EspBleControlsFactory* controls, IntControl* slider, IntControl* number) {
+    SimulatedCentral central(controls);
+    check(central.addWrites(SLIDR_UUID_SUFFIX, 1, SLIDER_RATE), "the slider is found");
+    check(central.addWrites(INTGR_UUID_SUFFIX, 1, NUMBER_RATE), "the int is found");
+    check(central.addWrites(STRNG_UUID_SUFFIX, 1, TEXT_RATE), "the string is found");
+    check(!central.addWrites(SLIDR_UUID_SUFFIX, 2, SLIDER_RATE), "a missing instance isn't found");
+    check(!central.addWrites(ANGLE_UUID_SUFFIX, 1, SLIDER_RATE), "a missing control isn't found");
+
+    const int32_t savedSlider = getSavedValue(controls, slider, PREFERENCES_ID);
+    const uint32_t writesBefore = hostPreferencesStats.writes;
+    const LoadTestReport report = central.run(DURATION_MS);
+    SimulatedCentral::printReport(report, Serial);
+
+    check(report.durationMs == DURATION_MS, "the run lasts the duration it was given");
+    check(report.writes == (SLIDER_RATE + NUMBER_RATE + TEXT_RATE) * DURATION_MS / 1000, "the writes follow the rates");
+    check(report.writesPerSecond == SLIDER_RATE + NUMBER_RATE + TEXT_RATE, "the throughput is the sum of the rates");
+    check(report.dispatchP50Us <= report.dispatchP90Us && report.dispatchP90Us <= report.dispatchP99Us &&
+        report.dispatchP99Us <= report.dispatchMaxUs, "the dispatch percentiles are ordered");
+    // Each write of the int and the string is saved by a task, the burst of the high rate slider once at the end
+    check(report.persisted == (NUMBER_RATE + TEXT_RATE) * DURATION_MS / 1000 + 1, "every save is measured");
+    check(hostPreferencesStats.writes - writesBefore == report.persisted, "the measured saves are the ones made");
+    check(report.persistP50Us <= report.persistMaxUs, "the persist percentiles are ordered");
+
+    check(getSavedValue(controls, number, PREFERENCES_ID) == SAVED_NUMBER, "the saved value of the int is kept");
+    check(getSavedValue(controls, slider, PREFERENCES_ID) == savedSlider, "the saved value of the slider is kept");
+    check(hostPreferences.count(LOAD_TEST_PREFERENCES_ID) == 0, "the load test namespace is cleared");
+
+    writeValue(number, SAVED_NUMBER + 1);
+    hostRunTasks();
+    check(getSavedValue(controls, number, PREFERENCES_ID) == SAVED_NUMBER + 1, "the writes after the run are saved as before");
+}
+
+static void testFirmwareStream(EspBleControlsFactory* controls, OtaControl* benchmark) {
+    SimulatedCentral central(controls);
+    const FirmwareStreamReport report = central.streamFirmware(benchmark, IMAGE_SIZE, CHUNK_SIZE);
+    SimulatedCentral::printReport(report, Serial);
+    check(report.status == OTA_DONE, "the NullSink accepts the streamed image");
+    check(report.bytes == IMAGE_SIZE, "the whole image is streamed");
+    check(report.resentChunks == 0, "no chunk is sent again without losses");
+    check(report.acks > 0, "the windows are acknowledged");
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    IntControl* slider = controls->createSliderControl("Level", 0, 100, 1, 0, nullptr, [](int32_t) {});
+    IntControl* number = controls->createIntControl("Number", 0, 1000, 0, nullptr, [](int32_t) {});
+    controls->createStringControl("Text", 32, "", nullptr, [](const std::string&) {});
+    OtaControl* benchmark = controls->createOtaControl("Benchmark", new NullSink());
+    controls->startService();
+    hostRunTasks();
+    transport->simulateConnection(true);
+    controls->updateControls();
+    writeValue(number, SAVED_NUMBER);
+    hostRunTasks();
+
+    testRun(controls, slider, number);
+    testFirmwareStream(controls, benchmark);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Load test passed\n");
+    return 0;
+}
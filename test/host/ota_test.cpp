@@ -0,0 +1,156 @@
+// Host test of the firmware update: images are streamed through an OtaControl on the MockTransport, like the app does it,
+// into a PartitionSink (the host Update only counts the bytes, the signatures are checked with OpenSSL through the mbedTLS
+// stubs). It checks the CRC and the signature paths, that the recorder keeps the commands but not the chunks, and prints the
+// throughput of the protocol on the host, with no radio.
+// Build and run it with "make" in this folder.
+
+#include <EspBleControls.h>
+#include <openssl/ec.h>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#define IMAGE_SIZE          (1024 * 1024)
+#define CHUNK_SIZE          OTA_MAX_CHUNK_SIZE
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// -----------------------------------------------------> KEYS <----------------------------------------------------------------------------
+
+struct SigningKey {
+    EVP_PKEY* key;
+    std::string publicKeyPem;
+};
+
+static SigningKey createKey(const char* curveName) {
+    SigningKey signingKey;
+    signingKey.key = EVP_EC_gen(curveName);
+    BIO* output = BIO_new(BIO_s_mem());
+    PEM_write_bio_PUBKEY(output, signingKey.key);
+    char* pem = nullptr;
+    const long length = BIO_get_mem_data(output, &pem);
+    signingKey.publicKeyPem.assign(pem, length);
+    BIO_free(output);
+    return signingKey;
+}
+
+// The DER signature of the SHA-256 of the image, as the signing tool of the app makes it
+static std::vector<uint8_t> sign(const SigningKey& signingKey, const std::vector<uint8_t>& image) {
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    size_t length = 0;
+    EVP_DigestSignInit(context, nullptr, EVP_sha256(), nullptr, signingKey.key);
+    EVP_DigestSign(context, nullptr, &length, image.data(), image.size());
+    std::vector<uint8_t> signature(length);
+    EVP_DigestSign(context, signature.data(), &length, image.data(), image.size());
+    signature.resize(length);
+    EVP_MD_CTX_free(context);
+    return signature;
+}
+
+// -----------------------------------------------------> STREAMING <-----------------------------------------------------------------------
+
+struct StreamResult {
+    OtaStatus status;
+    uint32_t durationUs;
+    uint32_t acks;
+};
+
+static OtaStatus getAckStatus(OtaControl* control) {
+    const std::string ack = control->getCharacteristic()->getValue();
+    return ack.empty() ? OTA_IDLE : (OtaStatus) ack[0];
+}
+
+// Sends the image in windows of chunks and waits for the ack of each window, like the app
+static StreamResult streamImage(OtaControl* control, const std::vector<uint8_t>& image, const uint32_t imageCrc,
+    const std::vector<uint8_t>& signature) {
+    BLECharacteristic* characteristic = control->getCharacteristic();
+    const uint32_t acksBefore = control->getAcksCount();
+    const uint32_t startTimeStamp = micros();
+    uint8_t message[1 + sizeof(uint16_t) + CHUNK_SIZE];
+    message[0] = OTA_START;
+    encodeValue((uint32_t) image.size(), message + 1, sizeof(message) - 1);
+    encodeValue(imageCrc, message + 5, sizeof(message) - 5);
+    characteristic->simulateWrite(message, 9);
+    uint16_t sequence = 0;
+    for (size_t position = 0; position < image.size() && getAckStatus(control) != OTA_CRC_ERROR; position += CHUNK_SIZE) {
+        const size_t chunkSize = std::min((size_t) CHUNK_SIZE, image.size() - position);
+        message[0] = OTA_DATA;
+        encodeValue(sequence++, message + 1, sizeof(message) - 1);
+        memcpy(message + 3, image.data() + position, chunkSize);
+        characteristic->simulateWrite(message, 3 + chunkSize);
+        if (sequence % control->getWindowChunks() == 0) check(getAckStatus(control) == OTA_WINDOW_ACK, "each window is acked");
+    }
+    std::vector<uint8_t> end = { OTA_END };
+    end.insert(end.end(), signature.begin(), signature.end());
+    characteristic->simulateWrite(end.data(), end.size());
+    return { control->getStatus(), micros() - startTimeStamp, control->getAcksCount() - acksBefore };
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    const SigningKey appKey = createKey("P-256");
+    const SigningKey otherKey = createKey("P-256");
+    const SigningKey k1Key = createKey("secp256k1");
+    OtaControl* keyControl = controls->createOtaControl("Firmware", new PartitionSink(appKey.publicKeyPem.c_str()));
+    OtaControl* k1Control = controls->createOtaControl("Firmware (secp256k1)", new PartitionSink(k1Key.publicKeyPem.c_str()));
+    OtaControl* keylessControl = controls->createOtaControl("Firmware (no key)");
+    controls->startService();
+    transport->simulateConnection(true);
+    controls->updateControls();
+
+    std::vector<uint8_t> image(IMAGE_SIZE);
+    std::mt19937 random(42);
+    for (uint8_t& byte : image) byte = random();
+    const uint32_t imageCrc = updateCrc32(0, image.data(), image.size());
+    const std::vector<uint8_t> signature = sign(appKey, image);
+
+    const StreamResult accepted = streamImage(keyControl, image, imageCrc, signature);
+    check(accepted.status == OTA_DONE, "a signed image is accepted");
+    check(Update.progress() == image.size(), "the whole image reaches the partition");
+    check(streamImage(keyControl, image, imageCrc ^ 1, signature).status == OTA_CRC_ERROR, "a corrupted image is refused");
+    check(streamImage(keyControl, image, imageCrc, sign(otherKey, image)).status == OTA_SIGNATURE_ERROR,
+        "an image signed with another key is refused");
+    std::vector<uint8_t> tampered = image;
+    tampered[IMAGE_SIZE / 2] ^= 0x80;
+    check(streamImage(keyControl, tampered, updateCrc32(0, tampered.data(), tampered.size()), signature).status == OTA_SIGNATURE_ERROR,
+        "a changed image is refused, even with a matching CRC");
+    check(streamImage(k1Control, image, imageCrc, sign(k1Key, image)).status == OTA_SIGNATURE_ERROR,
+        "a key on another curve is refused");
+    check(streamImage(keylessControl, image, imageCrc, {}).status == OTA_SIGNATURE_ERROR, "no key and no secure boot is refused");
+    hostSecureBoot = true;
+    check(streamImage(keylessControl, image, imageCrc, {}).status == OTA_DONE, "no key with secure boot is left to the bootloader");
+    hostSecureBoot = false;
+
+    // Only the commands around the chunks are recorded, not the chunks
+    controls->enableTrafficRecorder(64, false);
+    TrafficRecorder* recorder = controls->getTrafficRecorder();
+    const uint32_t firstRecord = recorder->getNextSequence();
+    check(streamImage(keyControl, image, imageCrc, signature).status == OTA_DONE, "an image is accepted while recording");
+    std::vector<uint8_t> recordedOpcodes;
+    TrafficRecord record;
+    for (uint32_t sequence = firstRecord; sequence < recorder->getNextSequence(); sequence++) {
+        if (recorder->get(sequence, record) && record.type == WRITE_EVENT) recordedOpcodes.push_back(record.payload[0]);
+    }
+    check(recordedOpcodes == std::vector<uint8_t>({ OTA_START, OTA_END }), "only the start and the end of an update are recorded");
+
+    printf("Firmware on the host (no radio): %lu bytes in %lu us (%.0f kB/s), %lu acks\n", (unsigned long) image.size(),
+        (unsigned long) accepted.durationUs, accepted.durationUs > 0 ? image.size() * 1000.0 / accepted.durationUs : 0.0,
+        (unsigned long) accepted.acks);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("OTA test passed\n");
+    return 0;
+}
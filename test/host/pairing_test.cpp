@@ -0,0 +1,93 @@
+// Host test of the pairing with a passkey on the MockTransport: the peer is authorised by the loop once its pairing succeeded,
+// and a pairing that succeeds after it was rejected or timed out never authorises it.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+
+#define PASSKEY                 123456
+#define AUTH_TIMEOUT_SECONDS    5
+
+static uint32_t failures = 0;
+static uint32_t receivedWrites = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// Whether a write reaches the control, which happens only while the peer is authorised
+static bool isWriteAccepted(IntControl* slider) {
+    const uint32_t writesBefore = receivedWrites;
+    uint8_t bytes[sizeof(int32_t)];
+    encodeValue((int32_t) 10, bytes, sizeof(bytes));
+    slider->getCharacteristic()->simulateWrite(bytes, sizeof(bytes));
+    return receivedWrites != writesBefore;
+}
+
+// -----------------------------------------------------> PAIRING <-------------------------------------------------------------------------
+
+static void testSuccess(EspBleControlsFactory* controls, MockTransport* transport, IntControl* slider) {
+    transport->simulateConnection(true);
+    check(!isWriteAccepted(slider), "the peer isn't authorised before the loop processed its pairing");
+    controls->updateControls();
+    check(controls->getPairingState() == AUTHORISED, "a successful pairing authorises the peer");
+    check(isWriteAccepted(slider), "the writes of an authorised peer are accepted");
+    transport->simulateConnection(false);
+    controls->updateControls();
+    check(!isWriteAccepted(slider), "the peer isn't authorised after it left");
+}
+
+static void testLateSuccessAfterRejection(EspBleControlsFactory* controls, MockTransport* transport, IntControl* slider) {
+    const uint32_t failuresBefore = controls->getPairingStats().failures;
+    transport->simulateConnection(true, false);
+    transport->simulateAuthentication(false, 0x05);
+    transport->simulateAuthentication(true);
+    check(!isWriteAccepted(slider), "a success right after a rejection doesn't authorise the peer");
+    controls->updateControls();
+    check(controls->getPairingState() != AUTHORISED, "the rejected pairing stays rejected");
+    check(controls->getPairingStats().failures == failuresBefore + 1, "the rejection is counted");
+    check(controls->getPairingStats().lastFailure == AUTH_REJECTED, "the failure is a rejection");
+    check(!isWriteAccepted(slider), "the writes after a rejection are ignored");
+    controls->updateControls();
+}
+
+static void testLateSuccessAfterTimeout(EspBleControlsFactory* controls, MockTransport* transport, IntControl* slider) {
+    static const BleAddress peerAddress = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    transport->simulateConnection(true, false);
+    controls->updateControls();
+    check(controls->getPairingState() == AWAITING_AUTH, "the peer waits for its pairing");
+    hostMillis += AUTH_TIMEOUT_SECONDS * 1000UL;
+    controls->updateControls();
+    check(controls->getPairingStats().lastFailure == AUTH_TIMEOUT, "the pairing times out");
+    // The stack reports the pairing after the device gave up on it and before the disconnection was processed
+    controls->onAuthentication(true, 0, peerAddress);
+    check(!isWriteAccepted(slider), "a success after the timeout doesn't authorise the peer");
+    controls->updateControls();
+    check(controls->getPairingState() != AUTHORISED, "the timed out pairing stays rejected");
+    check(!isWriteAccepted(slider), "the writes after the timeout are ignored");
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", PASSKEY, transport);
+    controls->setPairingTimeouts(AUTH_TIMEOUT_SECONDS, 0);
+    IntControl* slider = controls->createSliderControl("Level", 0, 1000, 0, 0, nullptr, [](int32_t) { receivedWrites++; });
+    controls->startService();
+    hostRunTasks();
+
+    testSuccess(controls, transport, slider);
+    testLateSuccessAfterRejection(controls, transport, slider);
+    testLateSuccessAfterTimeout(controls, transport, slider);
+    testSuccess(controls, transport, slider);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Pairing test passed\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Host tool that replays a traffic dump against the controls of main.cpp, built with ESP_BLE_CONTROLS_MOCK like the tests.
+//   ./build/replay_tool dump.bin  prints what each control receives while the dump is replayed
+//   ./build/replay_tool           checks the tool itself: it records a session (with high rate writes that carry a sequence
+//                                 trailer, one of them stale), dumps it, loads the dump in a second factory, replays it and
+//                                 checks that the controls receive the same values. "make" runs it this way.
+// A dump is the pages read from the traffic dump characteristic, each one preceded by its length (uint16, little endian).
+// The records are matched to the controls by handle: with the mock build the handles are the creation order, so a dump taken
+// on a board flashed with the esp32-c3-mock environment (main.cpp with enableTrafficRecorder()) replays as it was recorded.
+
+#include <EspBleControls.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define RECORDER_CAPACITY   64
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// -----------------------------------------------------> CONTROLS <------------------------------------------------------------------------
+// The controls of main.cpp in the same order, so they get the same handles. Each callback adds what it received to the log.
+
+struct Session {
+    MockTransport* transport;
+    EspBleControlsFactory* controls;
+    ControlPublisher<std::string> isLightOn;
+    ControlPublisher<int32_t> intValue;
+    IntControl* slider;
+    StringControl* text;
+    std::vector<std::string> log;
+};
+
+static void createSession(Session& session) {
+    session.transport = new MockTransport();
+    session.controls = new EspBleControlsFactory("Kitchen Controller", 228378, session.transport);
+    session.controls->enableTrafficRecorder(RECORDER_CAPACITY, false);
+    std::vector<std::string>& log = session.log;
+    EspBleControlsFactory* controls = session.controls;
+    controls->createClockControl("Contoller Clock", 1730000000UL, 1, [&log](uint32_t value) { log.push_back("clock " + std::to_string(value)); });
+    controls->createIntervalControl("Lights on Timer", 5, 5, [](bool isOn) {});
+    controls->createSwitchControl("Light Switch", "OFF", &session.isLightOn, [&log](std::string value) { log.push_back("switch " + value); });
+    controls->createMomentaryControl("Momentary Light Switch", "OFF", false, &session.isLightOn, [&log](std::string value) {
+        log.push_back("momentary " + value);
+    });
+    controls->createColorControl("Light Color", false, { 0xFF, 0, 0, 0 }, nullptr, [&log](const RgbColor& value) {
+        log.push_back("color " + std::to_string(value.red) + "," + std::to_string(value.green) + "," + std::to_string(value.blue));
+    });
+    session.slider = controls->createSliderControl("Integer Slider", -255, 255, 32, 0, &session.intValue, [&log](int32_t value) {
+        log.push_back("slider " + std::to_string(value));
+    });
+    controls->createIntControl("Integer Input", -512, 512, 0, &session.intValue, [&log](int32_t value) { log.push_back("int " + std::to_string(value)); });
+    controls->createFloatControl("Float Input", -255, 255, 123.45, nullptr, [&log](float_t value) { log.push_back("float " + std::to_string(value)); });
+    session.text = controls->createStringControl("Text Input", 128, "Text", nullptr, [&log](std::string value) { log.push_back("text " + value); });
+    controls->createAngleControl("Angle Adjustment", 55, false, nullptr, [&log](uint32_t value) { log.push_back("angle " + std::to_string(value)); });
+    controls->startService();
+    hostRunTasks();
+    session.log.clear();
+}
+
+// -----------------------------------------------------> DUMP FILES <----------------------------------------------------------------------
+
+static bool saveDump(TrafficRecorder* recorder, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) return false;
+    uint8_t page[TRAFFIC_PAGE_SIZE];
+    uint32_t cursor = recorder->getFirstSequence();
+    while (cursor != recorder->getNextSequence()) {
+        // The app reads the pages the same way: it writes the cursor, reads a page and moves the cursor after its records
+        const uint16_t pageSize = recorder->writePage(cursor, page, sizeof(page));
+        uint16_t recordsCount = 0;
+        decodeValue(page + sizeof(uint32_t), pageSize - sizeof(uint32_t), recordsCount);
+        uint8_t sizeBytes[sizeof(pageSize)];
+        encodeValue(pageSize, sizeBytes, sizeof(sizeBytes));
+        fwrite(sizeBytes, 1, sizeof(sizeBytes), file);
+        fwrite(page, 1, pageSize, file);
+        cursor += recordsCount;
+    }
+    fclose(file);
+    return true;
+}
+
+static uint32_t loadDump(TrafficRecorder* recorder, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) return 0;
+    uint32_t recordsCount = 0;
+    uint8_t sizeBytes[sizeof(uint16_t)];
+    uint8_t page[TRAFFIC_PAGE_SIZE];
+    while (fread(sizeBytes, 1, sizeof(sizeBytes), file) == sizeof(sizeBytes)) {
+        uint16_t pageSize = 0;
+        decodeValue(sizeBytes, sizeof(sizeBytes), pageSize);
+        if (pageSize > sizeof(page) || fread(page, 1, pageSize, file) != pageSize) break;
+        recordsCount += recorder->readPage(page, pageSize);
+    }
+    fclose(file);
+    return recordsCount;
+}
+
+static void replay(Session& session) {
+    session.controls->replayTraffic(0);
+    while (session.controls->isReplayingTraffic()) session.controls->updateControls();
+}
+
+// -----------------------------------------------------> SELF CHECK <----------------------------------------------------------------------
+
+static void writeSequenced(BLECharacteristic* characteristic, const int32_t value, const uint16_t sequence) {
+    uint8_t bytes[sizeof(int32_t) + WRITE_SEQUENCE_SIZE] = {};
+    encodeValue(value, bytes, sizeof(bytes));
+    encodeValue(sequence, bytes + sizeof(int32_t) + 1, sizeof(bytes) - sizeof(int32_t) - 1);
+    characteristic->simulateWrite(bytes, sizeof(bytes));
+}
+
+static void selfCheck(const char* path) {
+    Session recorded;
+    createSession(recorded);
+    recorded.transport->simulateConnection(true);
+    recorded.controls->updateControls();
+    writeSequenced(recorded.slider->getCharacteristic(), 10, 1);
+    writeSequenced(recorded.slider->getCharacteristic(), 30, 3);
+    writeSequenced(recorded.slider->getCharacteristic(), 20, 2); // Stale, dropped when recorded and when replayed
+    recorded.text->getCharacteristic()->simulateWrite((const uint8_t*) "Hello", 5);
+    recorded.transport->simulateConnection(false);
+    recorded.controls->updateControls();
+    recorded.transport->simulateConnection(true);
+    recorded.controls->updateControls();
+    writeSequenced(recorded.slider->getCharacteristic(), -5, 1); // A new connection numbers its writes from scratch
+    recorded.transport->simulateConnection(false);
+    recorded.controls->savePendingValues(true);
+    check(saveDump(recorded.controls->getTrafficRecorder(), path), "the dump is saved");
+
+    Session replayed;
+    createSession(replayed);
+    TrafficRecorder* recorder = replayed.controls->getTrafficRecorder();
+    const uint32_t loadedCount = loadDump(recorder, path);
+    const uint32_t recordsBefore = recorder->getNextSequence();
+    check(loadedCount == recorded.controls->getTrafficRecorder()->getNextSequence(), "every record is loaded");
+    replay(replayed);
+    check(recorder->getNextSequence() == recordsBefore, "nothing is recorded while replaying");
+
+    const std::vector<std::string> expected = { "slider 10", "slider 30", "text Hello", "slider -5" };
+    check(recorded.log == expected, "the recorded session reaches the controls");
+    check(replayed.log == recorded.log, "the replay reaches the controls with the same values");
+    for (const std::string& entry : replayed.log) printf("  %s\n", entry.c_str());
+    remove(path);
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        Session session;
+        createSession(session);
+        const uint32_t recordsCount = loadDump(session.controls->getTrafficRecorder(), argv[1]);
+        printf("%lu records loaded from %s\n", (unsigned long) recordsCount, argv[1]);
+        session.controls->getTrafficRecorder()->dump(Serial);
+        replay(session);
+        for (const std::string& entry : session.log) printf("%s\n", entry.c_str());
+        return recordsCount > 0 ? 0 : 1;
+    }
+    selfCheck("build/replay_check.bin");
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Replay check passed\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Host test of the debounced saves of the high rate controls: a burst of sequenced writes is saved once, SAVE_DEBOUNCE_MS after
+// the last write, with the value of that write even if the characteristic changed since, and a stale write isn't saved.
+// The other controls still save each write from a task. The flash is the Preferences stub, so its accesses can be counted.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <algorithm>
+#include <cstdio>
+
+#define BURST_WRITES    20
+#define WRITE_GAP_MS    20
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+static void writeSequenced(IntControl* control, const int32_t value, const uint16_t sequence) {
+    uint8_t bytes[sizeof(int32_t) + WRITE_SEQUENCE_SIZE] = { 0 };
+    encodeValue(value, bytes, sizeof(bytes));
+    encodeValue(sequence, bytes + sizeof(int32_t) + 1, sizeof(uint16_t));
+    control->getCharacteristic()->simulateWrite(bytes, sizeof(bytes));
+}
+
+static void writeValue(IntControl* control, const int32_t value) {
+    uint8_t bytes[sizeof(int32_t)];
+    encodeValue(value, bytes, sizeof(bytes));
+    control->getCharacteristic()->simulateWrite(bytes, sizeof(bytes));
+}
+
+// The saved int, or INT32_MIN if there is none
+static int32_t getSavedValue(EspBleControlsFactory* controls, IntControl* control) {
+    for (const ControlEntry& entry : controls->getControlEntries()) {
+        if (entry.characteristic != control->getCharacteristic()) continue;
+        std::string key = entry.uuid.substr(24, 12);
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+        Preferences preferences;
+        preferences.begin(PREFERENCES_ID, true);
+        const int32_t value = preferences.isKey(key.c_str()) ? preferences.getInt(key.c_str(), INT32_MIN) : INT32_MIN;
+        preferences.end();
+        return value;
+    }
+    return INT32_MIN;
+}
+
+// -----------------------------------------------------> DEBOUNCED SAVES <-----------------------------------------------------------------
+
+static void testBurst(EspBleControlsFactory* controls, IntControl* slider) {
+    const uint32_t writesBefore = hostPreferencesStats.writes;
+    for (uint16_t sequence = 1; sequence <= BURST_WRITES; sequence++) {
+        writeSequenced(slider, sequence * 10, sequence);
+        hostMillis += WRITE_GAP_MS;
+        controls->updateControls();
+    }
+    check(hostPreferencesStats.writes == writesBefore, "nothing is saved while the writes go on");
+
+    // The characteristic changes after the last write, the value of the write is the one saved
+    const int32_t otherValue = -1;
+    slider->getCharacteristic()->setValue((uint8_t*) &otherValue, sizeof(otherValue));
+    hostMillis += SAVE_DEBOUNCE_MS;
+    controls->updateControls();
+    check(hostPreferencesStats.writes == writesBefore + 1, "the burst is saved once");
+    check(getSavedValue(controls, slider) == BURST_WRITES * 10, "the value of the last write is saved");
+    hostMillis += SAVE_DEBOUNCE_MS;
+    controls->updateControls();
+    check(hostPreferencesStats.writes == writesBefore + 1, "a saved value isn't saved again");
+
+    // A stale write is dropped, so nothing is waiting to be saved
+    writeSequenced(slider, 5, 1);
+    hostMillis += SAVE_DEBOUNCE_MS;
+    controls->updateControls();
+    check(hostPreferencesStats.writes == writesBefore + 1, "a stale write isn't saved");
+
+    writeSequenced(slider, 1234, BURST_WRITES + 1);
+    controls->savePendingValues(true);
+    check(getSavedValue(controls, slider) == 1234, "a forced save doesn't wait for the writes to stop");
+}
+
+static void testTaskSave(EspBleControlsFactory* controls, IntControl* number) {
+    const uint32_t writesBefore = hostPreferencesStats.writes;
+    writeValue(number, 42);
+    writeValue(number, 43);
+    hostRunTasks();
+    check(hostPreferencesStats.writes == writesBefore + 2, "the other controls save each write");
+    check(getSavedValue(controls, number) == 43, "the last write of the other controls is saved");
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    IntControl* slider = controls->createSliderControl("Level", 0, 1000, 0, 0, nullptr, [](int32_t) {});
+    IntControl* number = controls->createIntControl("Number", 0, 0, 0, nullptr, [](int32_t) {});
+    controls->startService();
+    hostRunTasks();
+    transport->simulateConnection(true);
+    controls->updateControls();
+
+    testBurst(controls, slider);
+    testTaskSave(controls, number);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Save test passed\n");
+    return 0;
+}
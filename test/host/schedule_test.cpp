@@ -0,0 +1,91 @@
+// Host test of the interval controls and the schedules on a VirtualClock: a week is simulated and the state changes are counted,
+// a day is run through updateControls() to count the toggle callbacks, and the intervals that don't divide the day in whole
+// minutes are left out of the schedules.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+
+#define START_EPOCH         1700006400UL // Wednesday 15 November 2023, 00:00 UTC
+#define WEEK_MS             (7 * DAY_SECONDS * 1000UL)
+#define SIMULATION_STEP_MS  60000
+#define LOOP_STEP_MS        1000
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// The first division is in the most significant bit of the first byte, ON every other division
+static void writeAlternating(IntervalControl* interval, const size_t bytesCount) {
+    const std::vector<uint8_t> bytes(bytesCount, 0xAA);
+    interval->getCharacteristic()->simulateWrite(bytes.data(), bytes.size());
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    VirtualClock clock(START_EPOCH);
+    setClockSource(&clock);
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 123456, transport);
+    controls->createClockControl("Clock", START_EPOCH, 0, [](uint32_t) {});
+    uint32_t hourlyToggles = 0;
+    int8_t hourlyState = -1;
+    // One hour ON, one OFF: two state changes every two hours
+    IntervalControl* hourly = controls->createIntervalControl("Hourly", 60, 1, [&](bool isOn) {
+        if (hourlyState != -1 && isOn != (hourlyState == 1)) hourlyToggles++;
+        hourlyState = isOn;
+    });
+    IntervalControl* weekdays = controls->createIntervalControl("Weekdays", 60, 0, nullptr);
+    CalendarControl* weekdaysCalendar = controls->createWeekDaysControl("Weekdays", true, 0b0111110);
+    // 40 divisions of 36 minutes divide the day, 56 divisions don't
+    IntervalControl* uneven = controls->createIntervalControl("Uneven", 30, 0, nullptr);
+    IntervalControl* irregular = controls->createIntervalControl("Irregular", 30, 0, nullptr);
+    ScheduleControl* hourlySchedule = controls->createScheduleControl(0, nullptr);
+    hourlySchedule->addRule(hourly, {});
+    ScheduleControl* weekdaysSchedule = controls->createScheduleControl(0, nullptr);
+    weekdaysSchedule->addRule(weekdays, { weekdaysCalendar });
+    ScheduleControl* unevenSchedule = controls->createScheduleControl(0, nullptr);
+    unevenSchedule->addRule(uneven, {});
+    ScheduleControl* irregularSchedule = controls->createScheduleControl(0, nullptr);
+    irregularSchedule->addRule(irregular, {});
+    controls->startService();
+    transport->simulateConnection(true);
+    controls->updateControls();
+
+    writeAlternating(hourly, DAY_HOURS / 8);
+    writeAlternating(weekdays, DAY_HOURS / 8);
+    writeAlternating(uneven, 40 / 8);
+    writeAlternating(irregular, 56 / 8);
+    check(irregular->getState() == -1, "an interval that doesn't divide the day has no state");
+
+    // The simulation starts and ends at midnight, when the hourly intervals turn on
+    const SimulationReport report = controls->simulate(&clock, WEEK_MS, SIMULATION_STEP_MS);
+    check(report.steps == WEEK_MS / SIMULATION_STEP_MS, "the week is simulated in steps");
+    check(report.intervalTransitions[0] == 7 * DAY_HOURS, "the hourly interval changes every hour of the week");
+    check(report.intervalTransitions[2] == 7 * 40, "an interval of 36 minutes changes 40 times a day");
+    check(report.intervalTransitions[3] == 0, "an interval that doesn't divide the day never changes");
+    check(report.scheduleTransitions[0] == 7 * DAY_HOURS, "the schedule follows its interval");
+    check(report.scheduleTransitions[1] == 5 * DAY_HOURS, "the schedule changes only on the weekdays");
+    check(report.scheduleTransitions[2] == 7 * 40, "a schedule of 36 minute divisions follows its interval");
+    check(report.scheduleTransitions[3] == 0, "the schedule leaves out the interval that doesn't divide the day");
+
+    // A day through the loop: the toggle callback sees each state change once
+    for (uint32_t elapsedMs = 0; elapsedMs < DAY_SECONDS * 1000UL; elapsedMs += LOOP_STEP_MS) {
+        clock.advance(LOOP_STEP_MS);
+        controls->updateControls();
+    }
+    check(hourlyToggles == DAY_HOURS, "the loop toggles the hourly interval every hour");
+    setClockSource(nullptr);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Schedule test passed\n");
+    return 0;
+}
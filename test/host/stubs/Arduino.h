@@ -0,0 +1,66 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// -----------------------------------------------------> HOST ARDUINO CORE <---------------------------------------------------------------
+// The few parts of the Arduino core used by the library, to build it on the host with ESP_BLE_CONTROLS_MOCK.
+// millis() only moves when a test sets or advances hostMillis (delay() advances it too), so the timers are deterministic.
+// micros() reads the real time of the host, the durations measured by the library are host durations.
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <malloc.h>
+
+typedef bool boolean;
+
+inline uint32_t hostMillis = 0;
+inline uint32_t hostRestarts = 0; // Calls to esp_restart(), the host keeps running
+
+inline uint32_t millis() { return hostMillis; }
+inline uint32_t micros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+inline void delay(const uint32_t milliseconds) { hostMillis += milliseconds; }
+inline void esp_restart() { hostRestarts++; }
+inline uint32_t esp_random() { return (uint32_t) rand(); }
+
+class Print {
+public:
+    virtual ~Print() {};
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list arguments;
+        va_start(arguments, format);
+        const int length = vprintf(format, arguments);
+        va_end(arguments);
+        return length > 0 ? length : 0;
+    };
+    size_t print(const char* text) { return fputs(text, stdout) >= 0 ? strlen(text) : 0; };
+    size_t println(const char* text = "") { return print(text) + print("\n"); };
+    size_t write(const uint8_t* data, const size_t length) { return fwrite(data, 1, length, stdout); };
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(const unsigned long baudRate) {};
+};
+
+inline HardwareSerial Serial;
+
+// The heap figures are the host allocator's (zero with the address sanitizer, it replaces the allocator)
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return HEAP_SIZE - std::min((size_t) HEAP_SIZE, mallinfo2().uordblks); };
+    uint32_t getMinFreeHeap() { return getFreeHeap(); };
+private:
+    static const uint32_t HEAP_SIZE = 0x40000000;
+};
+
+inline EspClass ESP;
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef ESP32Time_h
+#define ESP32Time_h
+
+// -----------------------------------------------------> HOST ESP32TIME <------------------------------------------------------------------
+// The RTC of the host build counts from the epoch it was set to with millis(), so it only moves with hostMillis.
+
+#include <Arduino.h>
+
+class ESP32Time {
+public:
+    ESP32Time(const unsigned long offset = 0) {};
+    void setTime(const unsigned long epoch = 1609459200, const int microseconds = 0) {
+        m_epochMillis = (uint64_t) epoch * 1000 + microseconds / 1000;
+        m_setMillis = millis();
+    };
+    unsigned long getEpoch() { return getTimeMillis() / 1000; };
+    long getMillis() { return getTimeMillis() % 1000; };
+    long getMicros() { return getMillis() * 1000; };
+private:
+    uint64_t getTimeMillis() { return m_epochMillis + (uint32_t) (millis() - m_setMillis); };
+    uint64_t m_epochMillis = 0;
+    uint32_t m_setMillis = 0;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef Preferences_h
+#define Preferences_h
+
+// -----------------------------------------------------> HOST PREFERENCES <----------------------------------------------------------------
+// The NVS namespaces are kept in memory for the whole run, like the flash between two resets. A value is read back only with
+// the type it was saved with, as with the NVS. hostPreferencesStats counts the accesses, to compare ways of saving the values.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+struct HostPreferencesStats {
+    uint32_t begins;
+    uint32_t writes;
+    uint32_t reads;
+};
+
+inline std::map<std::string, std::map<std::string, std::pair<char, std::vector<uint8_t>>>> hostPreferences;
+inline HostPreferencesStats hostPreferencesStats = {};
+
+class Preferences {
+public:
+    bool begin(const char* name, const bool readOnly = false) {
+        hostPreferencesStats.begins++;
+        m_name = name;
+        m_isReadOnly = readOnly;
+        m_isOpen = true;
+        return true;
+    };
+    void end() { m_isOpen = false; };
+    bool clear() {
+        if (!isWritable()) return false;
+        hostPreferences.erase(m_name);
+        return true;
+    };
+    bool remove(const char* key) { return isWritable() && hostPreferences[m_name].erase(key) > 0; };
+    bool isKey(const char* key) { return m_isOpen && getEntry(key) != nullptr; };
+
+    size_t putInt(const char* key, const int32_t value) { return put(key, 'i', &value, sizeof(value)); };
+    size_t putUInt(const char* key, const uint32_t value) { return put(key, 'u', &value, sizeof(value)); };
+    size_t putFloat(const char* key, const float value) { return put(key, 'f', &value, sizeof(value)); };
+    size_t putString(const char* key, const char* value) { return put(key, 's', value, strlen(value) + 1); };
+    size_t putBytes(const char* key, const void* value, const size_t length) { return put(key, 'b', value, length); };
+
+    int32_t getInt(const char* key, const int32_t defaultValue = 0) { return get(key, 'i', defaultValue); };
+    uint32_t getUInt(const char* key, const uint32_t defaultValue = 0) { return get(key, 'u', defaultValue); };
+    float getFloat(const char* key, const float defaultValue = 0) { return get(key, 'f', defaultValue); };
+    size_t getString(const char* key, char* value, const size_t maxLength) {
+        const std::vector<uint8_t>* bytes = getBytes(key, 's');
+        if (bytes == nullptr || bytes->size() > maxLength) return 0;
+        memcpy(value, bytes->data(), bytes->size());
+        return bytes->size();
+    };
+    size_t getBytesLength(const char* key) {
+        const std::vector<uint8_t>* bytes = getBytes(key, 'b');
+        return bytes != nullptr ? bytes->size() : 0;
+    };
+    size_t getBytes(const char* key, void* value, const size_t maxLength) {
+        const std::vector<uint8_t>* bytes = getBytes(key, 'b');
+        if (bytes == nullptr || bytes->size() > maxLength) return 0;
+        memcpy(value, bytes->data(), bytes->size());
+        return bytes->size();
+    };
+
+private:
+    bool isWritable() { return m_isOpen && !m_isReadOnly; };
+    const std::pair<char, std::vector<uint8_t>>* getEntry(const char* key) {
+        auto space = hostPreferences.find(m_name);
+        if (space == hostPreferences.end()) return nullptr;
+        auto entry = space->second.find(key);
+        return (entry != space->second.end()) ? &entry->second : nullptr;
+    };
+    const std::vector<uint8_t>* getBytes(const char* key, const char type) {
+        if (!m_isOpen) return nullptr;
+        hostPreferencesStats.reads++;
+        const std::pair<char, std::vector<uint8_t>>* entry = getEntry(key);
+        return (entry != nullptr && entry->first == type) ? &entry->second : nullptr;
+    };
+    size_t put(const char* key, const char type, const void* value, const size_t length) {
+        if (!isWritable()) return 0;
+        hostPreferencesStats.writes++;
+        const uint8_t* bytes = (const uint8_t*) value;
+        hostPreferences[m_name][key] = { type, std::vector<uint8_t>(bytes, bytes + length) };
+        return length;
+    };
+    template <typename ValueType>
+    ValueType get(const char* key, const char type, const ValueType defaultValue) {
+        const std::vector<uint8_t>* bytes = getBytes(key, type);
+        if (bytes == nullptr) return defaultValue;
+        ValueType value;
+        memcpy(&value, bytes->data(), sizeof(value));
+        return value;
+    };
+    std::string m_name;
+    bool m_isOpen = false;
+    bool m_isReadOnly = false;
+};
+
+#endif
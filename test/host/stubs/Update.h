@@ -0,0 +1,33 @@
+#ifndef Update_h
+#define Update_h
+
+// -----------------------------------------------------> HOST UPDATE <---------------------------------------------------------------------
+// Counts the image bytes instead of writing a partition.
+
+#include <cstddef>
+#include <cstdint>
+
+#define U_FLASH 0
+
+class UpdateClass {
+public:
+    bool begin(const size_t size, const int command = U_FLASH) {
+        m_size = size;
+        m_written = 0;
+        return true;
+    };
+    size_t write(uint8_t* data, const size_t length) {
+        m_written += length;
+        return length;
+    };
+    bool end(const bool evenIfRemaining = false) { return evenIfRemaining || m_written == m_size; };
+    void abort() { m_written = 0; };
+    size_t progress() { return m_written; };
+private:
+    size_t m_size = 0;
+    size_t m_written = 0;
+};
+
+inline UpdateClass Update;
+
+#endif
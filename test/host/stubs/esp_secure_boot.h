@@ -0,0 +1,6 @@
+#pragma once
+
+// The host has no secure boot unless a test says otherwise.
+inline bool hostSecureBoot = false;
+
+inline bool esp_secure_boot_enabled() { return hostSecureBoot; }
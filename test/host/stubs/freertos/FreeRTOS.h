@@ -0,0 +1,25 @@
+#pragma once
+
+// -----------------------------------------------------> HOST FREERTOS <-------------------------------------------------------------------
+// The host build runs on one thread: the critical sections and the mutexes do nothing, a tick is a millisecond.
+
+#include <cstdint>
+
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(milliseconds) (milliseconds)
+
+typedef struct { int count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) ((mux)->count++)
+#define portEXIT_CRITICAL(mux) ((mux)->count--)
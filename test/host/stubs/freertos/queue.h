@@ -0,0 +1,34 @@
+#pragma once
+
+// A queue keeps copies of the items, like the FreeRTOS queues. Nothing waits on the host, the timeouts are ignored.
+
+#include "FreeRTOS.h"
+#include <cstring>
+#include <deque>
+#include <vector>
+
+struct HostQueue {
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+inline QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t itemSize) {
+    return new HostQueue { length, itemSize, {} };
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, const TickType_t timeout) {
+    HostQueue* hostQueue = (HostQueue*) queue;
+    if (hostQueue->items.size() >= hostQueue->length) return pdFALSE;
+    const uint8_t* bytes = (const uint8_t*) item;
+    hostQueue->items.emplace_back(bytes, bytes + hostQueue->itemSize);
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, const TickType_t timeout) {
+    HostQueue* hostQueue = (HostQueue*) queue;
+    if (hostQueue->items.empty()) return pdFALSE;
+    memcpy(item, hostQueue->items.front().data(), hostQueue->itemSize);
+    hostQueue->items.pop_front();
+    return pdTRUE;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Nothing runs concurrently on the host, a mutex is always free.
+
+#include "FreeRTOS.h"
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new int(0); }
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) { delete (int*) semaphore; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, const TickType_t timeout) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
@@ -0,0 +1,40 @@
+#pragma once
+
+// The tasks don't start on their own, they run in the order they were created when a test calls hostRunTasks()
+// (the tasks they create run in the same call), or when the library waits in vTaskDelay(), which also moves millis() forward.
+
+#include "FreeRTOS.h"
+#include <Arduino.h>
+#include <deque>
+#include <utility>
+
+typedef void (*TaskFunction_t)(void*);
+
+inline std::deque<std::pair<TaskFunction_t, void*>> hostTasks;
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, const uint32_t stackSize, void* parameters,
+    UBaseType_t priority, TaskHandle_t* handle) {
+    hostTasks.push_back({ function, parameters });
+    if (handle != nullptr) *handle = (TaskHandle_t) function;
+    return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t task) {}
+
+//Runs the tasks created so far, returns how many ran.
+inline uint32_t hostRunTasks() {
+    uint32_t count = 0;
+    while (!hostTasks.empty()) {
+        const std::pair<TaskFunction_t, void*> task = hostTasks.front();
+        hostTasks.pop_front();
+        task.first(task.second);
+        count++;
+    }
+    return count;
+}
+
+// A task that waits lets the others run, like on the board
+inline void vTaskDelay(const TickType_t ticks) {
+    delay(ticks);
+    hostRunTasks();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Only the curve of a key pair, to check it like with mbedTLS 2.28
+
+typedef enum {
+    MBEDTLS_ECP_DP_NONE = 0, MBEDTLS_ECP_DP_SECP192R1, MBEDTLS_ECP_DP_SECP224R1, MBEDTLS_ECP_DP_SECP256R1, MBEDTLS_ECP_DP_SECP384R1,
+    MBEDTLS_ECP_DP_SECP521R1, MBEDTLS_ECP_DP_BP256R1, MBEDTLS_ECP_DP_BP384R1, MBEDTLS_ECP_DP_BP512R1, MBEDTLS_ECP_DP_CURVE25519,
+    MBEDTLS_ECP_DP_SECP192K1, MBEDTLS_ECP_DP_SECP224K1, MBEDTLS_ECP_DP_SECP256K1, MBEDTLS_ECP_DP_CURVE448
+} mbedtls_ecp_group_id;
+
+typedef struct {
+    mbedtls_ecp_group_id id;
+} mbedtls_ecp_group;
+
+typedef struct {
+    mbedtls_ecp_group grp;
+} mbedtls_ecp_keypair;
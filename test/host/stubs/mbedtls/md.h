@@ -0,0 +1,53 @@
+#pragma once
+
+// -----------------------------------------------------> HOST MBEDTLS <--------------------------------------------------------------------
+// The subset of the mbedTLS API used by the library, on top of OpenSSL (libcrypto) so the host tests check real digests
+// and signatures. Only SHA-256 is available.
+
+#include <cstddef>
+#include <openssl/evp.h>
+
+typedef enum { MBEDTLS_MD_NONE = 0, MBEDTLS_MD_SHA256 = 6 } mbedtls_md_type_t;
+
+typedef struct mbedtls_md_info_t { mbedtls_md_type_t type; } mbedtls_md_info_t;
+
+typedef struct {
+    const mbedtls_md_info_t* md_info;
+    void* md_ctx;
+    void* hmac_ctx;
+} mbedtls_md_context_t;
+
+inline const mbedtls_md_info_t* mbedtls_md_info_from_type(const mbedtls_md_type_t type) {
+    static const mbedtls_md_info_t sha256Info = { MBEDTLS_MD_SHA256 };
+    return (type == MBEDTLS_MD_SHA256) ? &sha256Info : nullptr;
+}
+
+inline void mbedtls_md_init(mbedtls_md_context_t* context) {
+    context->md_info = nullptr;
+    context->md_ctx = nullptr;
+    context->hmac_ctx = nullptr;
+}
+
+inline void mbedtls_md_free(mbedtls_md_context_t* context) {
+    EVP_MD_CTX_free((EVP_MD_CTX*) context->md_ctx);
+    mbedtls_md_init(context);
+}
+
+inline int mbedtls_md_setup(mbedtls_md_context_t* context, const mbedtls_md_info_t* info, const int hmac) {
+    if (info == nullptr || hmac != 0) return -1;
+    context->md_info = info;
+    context->md_ctx = EVP_MD_CTX_new();
+    return 0;
+}
+
+inline int mbedtls_md_starts(mbedtls_md_context_t* context) {
+    return EVP_DigestInit_ex((EVP_MD_CTX*) context->md_ctx, EVP_sha256(), nullptr) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_md_update(mbedtls_md_context_t* context, const unsigned char* input, const size_t length) {
+    return EVP_DigestUpdate((EVP_MD_CTX*) context->md_ctx, input, length) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_md_finish(mbedtls_md_context_t* context, unsigned char* output) {
+    return EVP_DigestFinal_ex((EVP_MD_CTX*) context->md_ctx, output, nullptr) == 1 ? 0 : -1;
+}
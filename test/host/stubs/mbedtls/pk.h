@@ -0,0 +1,79 @@
+#pragma once
+
+// Public keys in PEM and ECDSA verification (DER signatures), on top of OpenSSL like md.h. Only the P-256 and secp256k1 curves
+// are told apart, the others show as MBEDTLS_ECP_DP_NONE.
+
+#include "ecp.h"
+#include "md.h"
+#include <cstring>
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+
+typedef enum { MBEDTLS_PK_NONE = 0, MBEDTLS_PK_RSA, MBEDTLS_PK_ECKEY, MBEDTLS_PK_ECKEY_DH, MBEDTLS_PK_ECDSA } mbedtls_pk_type_t;
+
+typedef struct {
+    const void* pk_info;
+    void* pk_ctx; // HostPublicKey, it starts with the key pair like with mbedTLS
+} mbedtls_pk_context;
+
+struct HostPublicKey {
+    mbedtls_ecp_keypair keypair;
+    EVP_PKEY* key;
+};
+
+inline mbedtls_ecp_keypair* mbedtls_pk_ec(const mbedtls_pk_context publicKey) {
+    return (mbedtls_ecp_keypair*) publicKey.pk_ctx;
+}
+
+#define MBEDTLS_ERR_PK_KEY_INVALID_FORMAT -0x3D00
+#define MBEDTLS_ERR_PK_BAD_INPUT_DATA     -0x3E80
+#define MBEDTLS_ERR_ECP_VERIFY_FAILED     -0x4E00
+
+inline void mbedtls_pk_init(mbedtls_pk_context* context) {
+    context->pk_info = nullptr;
+    context->pk_ctx = nullptr;
+}
+
+inline EVP_PKEY* hostGetKey(const mbedtls_pk_context* context) {
+    return (context->pk_ctx != nullptr) ? ((HostPublicKey*) context->pk_ctx)->key : nullptr;
+}
+
+inline void mbedtls_pk_free(mbedtls_pk_context* context) {
+    if (context->pk_ctx != nullptr) EVP_PKEY_free(hostGetKey(context));
+    delete (HostPublicKey*) context->pk_ctx;
+    mbedtls_pk_init(context);
+}
+
+// As with mbedTLS, the length of a PEM key includes its null terminator
+inline int mbedtls_pk_parse_public_key(mbedtls_pk_context* context, const unsigned char* key, const size_t length) {
+    if (length == 0 || key[length - 1] != '\0') return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    BIO* input = BIO_new_mem_buf(key, length - 1);
+    EVP_PKEY* publicKey = PEM_read_bio_PUBKEY(input, nullptr, nullptr, nullptr);
+    BIO_free(input);
+    if (publicKey == nullptr) return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    char curveName[32] = "";
+    EVP_PKEY_get_group_name(publicKey, curveName, sizeof(curveName), nullptr);
+    mbedtls_ecp_group_id curve = MBEDTLS_ECP_DP_NONE;
+    if (strcmp(curveName, "prime256v1") == 0) curve = MBEDTLS_ECP_DP_SECP256R1;
+    if (strcmp(curveName, "secp256k1") == 0) curve = MBEDTLS_ECP_DP_SECP256K1;
+    context->pk_ctx = new HostPublicKey { { { curve } }, publicKey };
+    return 0;
+}
+
+inline int mbedtls_pk_can_do(const mbedtls_pk_context* context, const mbedtls_pk_type_t type) {
+    if (context->pk_ctx == nullptr) return 0;
+    const int keyType = EVP_PKEY_get_base_id(hostGetKey(context));
+    if (type == MBEDTLS_PK_RSA) return keyType == EVP_PKEY_RSA;
+    return (type == MBEDTLS_PK_ECKEY || type == MBEDTLS_PK_ECDSA) && keyType == EVP_PKEY_EC;
+}
+
+inline int mbedtls_pk_verify(mbedtls_pk_context* context, const mbedtls_md_type_t type, const unsigned char* hash,
+    const size_t hashLength, const unsigned char* signature, const size_t signatureLength) {
+    if (context->pk_ctx == nullptr || type != MBEDTLS_MD_SHA256) return MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    EVP_PKEY_CTX* verifier = EVP_PKEY_CTX_new(hostGetKey(context), nullptr);
+    const bool isValid = verifier != nullptr && EVP_PKEY_verify_init(verifier) == 1 &&
+        EVP_PKEY_CTX_set_signature_md(verifier, EVP_sha256()) == 1 &&
+        EVP_PKEY_verify(verifier, signature, signatureLength, hash, hashLength) == 1;
+    EVP_PKEY_CTX_free(verifier);
+    return isValid ? 0 : MBEDTLS_ERR_ECP_VERIFY_FAILED;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The host stubs follow the API of mbedTLS 2.28, the version of arduino-esp32 2.x (IDF 4.4)
+#define MBEDTLS_VERSION_NUMBER 0x021C0000
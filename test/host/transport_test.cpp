@@ -0,0 +1,83 @@
+// Host test of the MockTransport, with the library built against MockBle.h (ESP_BLE_CONTROLS_MOCK) and the stubs of this folder:
+// each characteristic gets its own handle, the confirmations reach the right notification and nothing is sent or confirmed
+// while the peer is disconnected. It prints the getTransportStats() of the mock build, they are host numbers, not board ones.
+// Build and run it with "make" in this folder, it needs g++ and the OpenSSL headers (libssl-dev).
+
+#include <EspBleControls.h>
+#include <cstdio>
+#include <set>
+
+#define SLIDERS_COUNT   8
+
+static uint32_t failures = 0;
+
+static void check(const bool condition, const char* message) {
+    if (condition) return;
+    failures++;
+    printf("FAIL %s\n", message);
+}
+
+// -----------------------------------------------------> HANDLES <-------------------------------------------------------------------------
+
+static void testHandles(EspBleControlsFactory* controls, MockTransport* transport) {
+    std::set<uint16_t> handles;
+    for (const ControlEntry& entry : controls->getControlEntries()) {
+        const uint16_t handle = transport->getHandle(entry.characteristic);
+        check(handle != 0, "every characteristic has a handle");
+        check(handle == entry.characteristic->getHandle(), "the mock characteristic has the transport handle");
+        handles.insert(handle);
+    }
+    check(handles.size() == controls->getControlEntries().size(), "the handles are distinct");
+}
+
+// -----------------------------------------------------> NOTIFICATIONS <-------------------------------------------------------------------
+
+static void testNotifications(EspBleControlsFactory* controls, MockTransport* transport, std::vector<ControlPublisher<int32_t>>& levels) {
+    // Without a peer nothing goes out and nothing is confirmed
+    for (size_t index = 0; index < levels.size(); index++) levels[index].setValue((int32_t) index + 1, nullptr);
+    NotificationStats stats = controls->getNotificationStats();
+    check(transport->getNotificationsCount() == 0, "no notification is sent while disconnected");
+    check(stats.sent == 0, "no notification is confirmed while disconnected");
+
+    // The notifier gives up on the unconfirmed ones after its timeout, the values still queued go out once connected
+    hostMillis += NOTIFICATION_TIMEOUT_MS;
+    transport->simulateConnection(true);
+    controls->updateControls();
+    const uint32_t notifiedBefore = transport->getNotificationsCount();
+    const uint32_t sentBefore = controls->getNotificationStats().sent;
+    check(notifiedBefore == stats.queued - NOTIFICATIONS_IN_FLIGHT, "the queued values are sent once connected");
+    for (size_t index = 0; index < levels.size(); index++) levels[index].setValue((int32_t) index + 100, nullptr);
+    stats = controls->getNotificationStats();
+    check(transport->getNotificationsCount() - notifiedBefore == levels.size(), "each value is notified once while connected");
+    check(stats.sent - sentBefore == levels.size(), "each notification is confirmed with its own handle");
+    check(stats.retries == 0, "no confirmation is taken for a failure");
+    transport->simulateConnection(false);
+}
+
+// -----------------------------------------------------> MAIN <----------------------------------------------------------------------------
+
+int main() {
+    MockTransport* transport = new MockTransport();
+    EspBleControlsFactory* controls = new EspBleControlsFactory("Host", 0, transport);
+    std::vector<ControlPublisher<int32_t>> levels(SLIDERS_COUNT);
+    for (ControlPublisher<int32_t>& level : levels) {
+        controls->createSliderControl("Level", 0, 1000, 0, 0, &level, [](int32_t) {});
+    }
+    controls->startService();
+    hostRunTasks();
+
+    testHandles(controls, transport);
+    testNotifications(controls, transport, levels);
+
+    const TransportStats stats = controls->getTransportStats();
+    // The free heap is the one of the host allocator, it says nothing about a board so it isn't printed
+    printf("Mock transport on the host: startup %lu us, stack heap %lu bytes\n", (unsigned long) stats.startupMicros,
+        (unsigned long) stats.stackHeapBytes);
+
+    if (failures > 0) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+    printf("Transport test passed\n");
+    return 0;
+}